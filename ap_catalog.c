@@ -0,0 +1,227 @@
+/* ap_catalog.c */
+#include "ap_catalog.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "string.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+static const char *TAG = "AP_CATALOG";
+
+/**
+ * Image layout, little-endian, built by tools/ap_catalog_gen.py:
+ *   header
+ *   uint16_t buckets[bucket_count]     entry index + 1 per bucket, 0 for an empty bucket
+ *   ap_catalog_record_t entries[count] sorted by SSID, 4-byte aligned
+ *   strings                            SSID and password of each entry, both null-terminated
+ * The buckets form an open addressing table over the CRC32 of the SSIDs,
+ * the same hash the AP record lookups use, probed linearly.
+ */
+#define AP_CATALOG_MAGIC 0x54435041             // "APCT"
+#define AP_CATALOG_VERSION 1
+#define AP_CATALOG_SSID_MAX_LEN 32
+#define AP_CATALOG_PASSWORD_MAX_LEN 64
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint16_t bucket_count;      // Power of two, more than count
+    uint16_t reserved;
+    uint32_t entries_offset;    // From the start of the image
+    uint32_t strings_offset;
+    uint32_t image_size;
+    uint32_t crc;               // CRC32 of the image after the header
+} ap_catalog_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t ssid_hash;
+    uint32_t ssid_offset;       // Into the strings, the password follows the SSID's terminator
+    uint8_t ssid_len;
+    uint8_t password_len;
+    uint8_t bssid[6];
+} ap_catalog_record_t;
+
+// Everything below is only changed by open and close, readers need no lock
+static const uint8_t* catalog = NULL;
+static esp_partition_mmap_handle_t catalog_mmap;
+static const ap_catalog_header_t* header = NULL;
+static const uint16_t* buckets = NULL;
+static const ap_catalog_record_t* records = NULL;
+static const char* strings = NULL;
+
+static esp_err_t check_image(const uint8_t* image, size_t size)
+{
+    const ap_catalog_header_t* hdr = (const ap_catalog_header_t*)image;
+    if (hdr->bucket_count == 0 || (hdr->bucket_count & (hdr->bucket_count - 1)) ||
+        hdr->bucket_count <= hdr->count) {
+        ESP_LOGE(TAG, "Invalid bucket count %u for %u entries", hdr->bucket_count, hdr->count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr->entries_offset < sizeof(ap_catalog_header_t) + hdr->bucket_count * sizeof(uint16_t) ||
+        hdr->entries_offset % 4 ||
+        hdr->strings_offset < hdr->entries_offset + (uint32_t)hdr->count * sizeof(ap_catalog_record_t) ||
+        hdr->strings_offset > size) {
+        ESP_LOGE(TAG, "Invalid section offsets");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, image + sizeof(ap_catalog_header_t), size - sizeof(ap_catalog_header_t));
+    if (crc != hdr->crc) {
+        ESP_LOGE(TAG, "CRC mismatch: stored 0x%08" PRIx32 ", computed 0x%08" PRIx32, hdr->crc, crc);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // Lookups trust these from now on
+    const uint16_t* table = (const uint16_t*)(image + sizeof(ap_catalog_header_t));
+    for (int bucket = 0; bucket < hdr->bucket_count; bucket++) {
+        if (table[bucket] > hdr->count) {
+            ESP_LOGE(TAG, "Bucket %d points past the entries", bucket);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    const ap_catalog_record_t* entries = (const ap_catalog_record_t*)(image + hdr->entries_offset);
+    const char* text = (const char*)(image + hdr->strings_offset);
+    uint32_t strings_size = size - hdr->strings_offset;
+    for (int i = 0; i < hdr->count; i++) {
+        const ap_catalog_record_t* entry = &entries[i];
+        uint32_t end = entry->ssid_offset + entry->ssid_len + 1 + entry->password_len + 1;
+        if (entry->ssid_len == 0 || entry->ssid_len > AP_CATALOG_SSID_MAX_LEN ||
+            entry->password_len > AP_CATALOG_PASSWORD_MAX_LEN || end > strings_size ||
+            text[entry->ssid_offset + entry->ssid_len] != '\0' || text[end - 1] != '\0') {
+            ESP_LOGE(TAG, "Entry %d is malformed", i);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t ap_catalog_open(void)
+{
+    if (catalog) {
+        return ESP_OK;
+    }
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                                                CONFIG_AP_RECORDS_CATALOG_PARTITION);
+    if (!partition) {
+        ESP_LOGI(TAG, "No partition '%s', catalog disabled", CONFIG_AP_RECORDS_CATALOG_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ap_catalog_header_t hdr;
+    esp_err_t ret = esp_partition_read(partition, 0, &hdr, sizeof(hdr));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read catalog header: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    if (hdr.magic != AP_CATALOG_MAGIC || hdr.version != AP_CATALOG_VERSION) {
+        ESP_LOGW(TAG, "Partition '%s' holds no catalog image (magic 0x%08" PRIx32 ", version %u)",
+                 CONFIG_AP_RECORDS_CATALOG_PARTITION, hdr.magic, hdr.version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (hdr.image_size < sizeof(hdr) || hdr.image_size > partition->size) {
+        ESP_LOGE(TAG, "Catalog image size %" PRIu32 " does not fit the partition", hdr.image_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const void* image;
+    ret = esp_partition_mmap(partition, 0, hdr.image_size, ESP_PARTITION_MMAP_DATA, &image, &catalog_mmap);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map catalog: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = check_image(image, hdr.image_size);
+    if (ret != ESP_OK) {
+        esp_partition_munmap(catalog_mmap);
+        return ret;
+    }
+
+    catalog = image;
+    header = (const ap_catalog_header_t*)catalog;
+    buckets = (const uint16_t*)(catalog + sizeof(ap_catalog_header_t));
+    records = (const ap_catalog_record_t*)(catalog + header->entries_offset);
+    strings = (const char*)(catalog + header->strings_offset);
+    ESP_LOGI(TAG, "Mapped catalog with %u entries (%" PRIu32 " bytes)", header->count, header->image_size);
+    return ESP_OK;
+}
+
+void ap_catalog_close(void)
+{
+    if (!catalog) {
+        return;
+    }
+    catalog = NULL;
+    header = NULL;
+    buckets = NULL;
+    records = NULL;
+    strings = NULL;
+    esp_partition_munmap(catalog_mmap);
+}
+
+bool ap_catalog_is_open(void)
+{
+    return catalog != NULL;
+}
+
+int ap_catalog_get_count(void)
+{
+    return catalog ? header->count : 0;
+}
+
+static void fill_entry(const ap_catalog_record_t* record, ap_catalog_entry_t* entry)
+{
+    entry->ssid = strings + record->ssid_offset;
+    entry->password = entry->ssid + record->ssid_len + 1;
+    entry->bssid = record->bssid;
+}
+
+esp_err_t ap_catalog_get(int index, ap_catalog_entry_t* entry)
+{
+    if (!catalog) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!entry || index < 0 || index >= header->count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    fill_entry(&records[index], entry);
+    return ESP_OK;
+}
+
+esp_err_t ap_catalog_find(const char* ssid, ap_catalog_entry_t* entry, int* index)
+{
+    if (!catalog) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!ssid) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t len = strnlen(ssid, AP_CATALOG_SSID_MAX_LEN + 1);
+    if (len == 0 || len > AP_CATALOG_SSID_MAX_LEN) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t hash = esp_rom_crc32_le(0, (const uint8_t*)ssid, len);
+    uint32_t mask = header->bucket_count - 1;
+    // There is always an empty bucket, so every probe run ends
+    for (uint32_t bucket = hash & mask; buckets[bucket]; bucket = (bucket + 1) & mask) {
+        const ap_catalog_record_t* record = &records[buckets[bucket] - 1];
+        if (record->ssid_hash == hash && record->ssid_len == len &&
+            memcmp(strings + record->ssid_offset, ssid, len) == 0) {
+            if (entry) {
+                fill_entry(record, entry);
+            }
+            if (index) {
+                *index = buckets[bucket] - 1;
+            }
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
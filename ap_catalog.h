@@ -0,0 +1,75 @@
+/* ap_catalog.h */
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A credential in the catalog
+ * @note The pointers refer to the memory-mapped partition and stay valid until
+ *       ap_catalog_close().
+ */
+typedef struct {
+    const char* ssid;                       ///< Null-terminated
+    const char* password;                   ///< Null-terminated, empty for open networks
+    const uint8_t* bssid;                   ///< 6 bytes, all zero if any BSSID may be used
+} ap_catalog_entry_t;
+
+/**
+ * @brief Map the catalog partition (CONFIG_AP_RECORDS_CATALOG_PARTITION)
+ * @note The catalog is read in place from flash, nothing is copied to RAM.
+ *       The image is checked against its CRC once here. After this the
+ *       catalog never changes, so all other functions may be called from any
+ *       task without a lock.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no catalog
+ *         partition, ESP_ERR_INVALID_VERSION or ESP_ERR_INVALID_CRC if it does
+ *         not hold a valid image, error code otherwise
+ */
+esp_err_t ap_catalog_open(void);
+
+/**
+ * @brief Unmap the catalog
+ * @note Invalidates every ap_catalog_entry_t handed out. Only call it when no
+ *       other task can be reading the catalog.
+ */
+void ap_catalog_close(void);
+
+/**
+ * @brief Whether a catalog is mapped
+ */
+bool ap_catalog_is_open(void);
+
+/**
+ * @brief Get the number of catalog entries
+ * @return Number of entries, 0 if no catalog is mapped
+ */
+int ap_catalog_get_count(void);
+
+/**
+ * @brief Get a catalog entry by index
+ * @note Entries are sorted by SSID.
+ * @param index Index of the entry (0 to ap_catalog_get_count()-1)
+ * @param entry Pointer to store the entry
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index is invalid,
+ *         ESP_ERR_INVALID_STATE if no catalog is mapped
+ */
+esp_err_t ap_catalog_get(int index, ap_catalog_entry_t* entry);
+
+/**
+ * @brief Find a catalog entry by SSID in constant time
+ * @param ssid SSID to search for
+ * @param entry Pointer to store the entry (can be NULL if only checking existence)
+ * @param index Pointer to store the index (can be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if not found,
+ *         ESP_ERR_INVALID_STATE if no catalog is mapped
+ */
+esp_err_t ap_catalog_find(const char* ssid, ap_catalog_entry_t* entry, int* index);
+
+#ifdef __cplusplus
+}
+#endif
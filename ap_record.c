@@ -4,458 +4,3213 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_mac.h"
+#include "esp_rom_crc.h"
 #include "string.h"
 #include "nvs.h"
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+#include "esp_system.h"
+#include "freertos/queue.h"
+#endif
+
+#ifdef CONFIG_AP_RECORDS_CATALOG
+#include "ap_catalog.h"
+#endif
 
 static const char *TAG = "AP_RECORDS";
 
-// Storage configuration - internal to this component
-#define AP_RECORDS_NAMESPACE "ap_storage"
-#define AP_RECORDS_KEY "ap_records"
+// Storage configuration - internal to this component
+#define AP_RECORDS_NAMESPACE "ap_storage"
+#define AP_RECORDS_INDEX_KEY "ap_index"
+#define AP_RECORDS_LEGACY_KEY "ap_records"     // Whole ap_record_t as one blob (old layout)
+#define AP_RECORDS_RECORD_KEY_FMT "ap_rec%u"   // One record per storage slot
+#define AP_RECORDS_USAGE_KEY_FMT "ap_use%u"   // One usage log entry per key, appends never rewrite earlier entries
+#define AP_RECORDS_KEY_BUF_SIZE 17              // Either format with any %u value; blob_storage rejects keys over 15 chars
+
+// On-flash format
+#define AP_RECORDS_INDEX_VERSION 1
+#define AP_RECORDS_INDEX_HEADER_SIZE 2
+#define AP_RECORDS_INDEX_MAX_SLOTS 255
+#define AP_RECORDS_RECORD_MAGIC 0xA5
+#define AP_RECORDS_RECORD_VERSION 1
+#define AP_RECORDS_SSID_MAX_LEN (sizeof(((ap_info_t*)0)->ssid) - 1)
+#define AP_RECORDS_PASSWORD_MAX_LEN (sizeof(((ap_info_t*)0)->password) - 1)
+#define AP_RECORDS_RECORD_MAX_SIZE (sizeof(ap_record_header_t) + 1 + AP_RECORDS_SSID_MAX_LEN + \
+                                    1 + AP_RECORDS_PASSWORD_MAX_LEN)
+#define AP_RECORDS_LEGACY_MAX_COUNT 5           // Kconfig limit when the single-blob layout was in use
+#define AP_RECORDS_USAGE_ENTRY_SIZE 9           // Slot, 16 bit SSID check, 16 bit use count, 32 bit last use time
+#define AP_RECORDS_USAGE_LOG_MAX_SIZE (CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES * AP_RECORDS_USAGE_ENTRY_SIZE)
+
+#ifdef CONFIG_AP_RECORDS_AB_SLOTS
+#define AP_RECORDS_AB_FLAG BLOB_STORAGE_FLAG_AB_SLOTS
+#else
+#define AP_RECORDS_AB_FLAG 0
+#endif
+
+#ifdef CONFIG_AP_RECORDS_DEFERRED_COMMIT
+#define AP_RECORDS_STORAGE_FLAGS (BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_DEFERRED_COMMIT | \
+                                  BLOB_STORAGE_FLAG_ELIDE_UNCHANGED | AP_RECORDS_AB_FLAG)
+#else
+#define AP_RECORDS_STORAGE_FLAGS (BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_CACHE | \
+                                  BLOB_STORAGE_FLAG_ELIDE_UNCHANGED | AP_RECORDS_AB_FLAG)
+#endif
+
+// Record handles only live for one read or save, the record cache below replaces their RAM cache
+#define AP_RECORDS_RECORD_FLAGS (BLOB_STORAGE_FLAG_PERSISTENT | AP_RECORDS_AB_FLAG)
+
+// Usage log handles also live for one access, each write is a single small entry
+#define AP_RECORDS_USAGE_FLAGS BLOB_STORAGE_FLAG_PERSISTENT
+
+#define AP_RECORDS_BITMAP_SIZE ((CONFIG_MAX_AP_COUNT + 7) / 8)
+
+// Lookup table buckets: a power of two of at least twice the record count
+#define AP_RECORDS_LOOKUP_SIZE (CONFIG_MAX_AP_COUNT <= 4 ? 8 : CONFIG_MAX_AP_COUNT <= 8 ? 16 : \
+                                CONFIG_MAX_AP_COUNT <= 16 ? 32 : CONFIG_MAX_AP_COUNT <= 32 ? 64 : \
+                                CONFIG_MAX_AP_COUNT <= 64 ? 128 : CONFIG_MAX_AP_COUNT <= 128 ? 256 : 512)
+#define AP_RECORDS_LOOKUP_MASK (AP_RECORDS_LOOKUP_SIZE - 1)
+#define AP_RECORDS_SAVE_BATCH_RECORDS 4         // Record handles open at once while saving, one NVS commit per group
+#define AP_RECORDS_NO_SLOT 0xFF                 // End of the eviction order
+#define AP_RECORDS_SCORE_KNOWN_BSSID 20         // Scan match scoring, on top of RSSI + 100
+#define AP_RECORDS_SCORE_PER_DOUBLING 6         // Per doubling of the decayed use count
+#define AP_RECORDS_SCORE_STRONG_AUTH 5          // WPA2 or better
+#define AP_RECORDS_SCORE_OPEN_MISMATCH 30       // Open network, but a password is stored
+#define AP_RECORDS_SCORE_FAST_CONNECT 20        // Connected instantly before, one point less per AP_RECORDS_SCORE_CONNECT_MS_STEP
+#define AP_RECORDS_SCORE_CONNECT_MS_STEP 250
+#define AP_RECORDS_SCORE_FAILURES 20            // All attempts failed so far
+#define AP_RECORDS_CONNECT_MS_WEIGHT 4          // New time to IP counts 1/4 in the average
+#define AP_RECORDS_PEEK_ATTEMPTS 8              // Lock-free snapshot reads tried before waiting for the writers on the lock
+
+/**
+ * Index blob: which storage slot holds the record at each list position.
+ * Only the header and count slot bytes are stored. Sized for any count an
+ * older or newer firmware may have written, so a CONFIG_MAX_AP_COUNT change
+ * never makes it unreadable.
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t count;
+    uint8_t slots[AP_RECORDS_INDEX_MAX_SLOTS];
+} ap_records_index_t;
+
+/**
+ * Compact record header, followed by a length-prefixed SSID and a
+ * length-prefixed password without terminators
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t bssid[6];
+    uint16_t use_count;
+    uint32_t last_used;
+    // Connection stats, see ap_records_stats_t
+    uint32_t last_success;
+    uint16_t success_count;
+    uint16_t failure_count;
+    uint16_t avg_connect_ms;
+    int8_t last_rssi;
+    uint8_t last_channel;
+    uint8_t last_disconnect_reason;
+} ap_record_header_t;
+
+// ap_info_t as older firmware stored it, raw in the single ap_records blob
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t password[65];
+    uint8_t bssid[6];
+    uint8_t use_count;
+} ap_info_legacy_t;
+
+#define AP_RECORDS_ALL_SLOTS_BITMAP_SIZE ((AP_RECORDS_INDEX_MAX_SLOTS + 8) / 8)
+
+/**
+ * Hot part of a record, indexed by storage slot: everything matching and
+ * ranking look at, 16 bytes per record. Passwords and full SSIDs are the cold
+ * part, they stay in NVS and are only read through the record cache for the
+ * record actually returned.
+ */
+typedef struct {
+    uint32_t ssid_hash;         // CRC32 of the SSID; the low 16 bits are the usage log check
+    uint32_t last_used;         // Use clock at the last use
+    uint16_t use_count;         // Use frequency as of last_used, see record_use()
+    uint8_t bssid[6];
+} ap_records_meta_t;
+
+// Bookkeeping of a record, indexed by storage slot; kept apart so lookups do not pull it in
+typedef struct {
+    uint32_t save_seq;          // Last save that wrote or erased this slot
+    uint8_t position;           // List position while the slot holds a record
+    uint8_t rank_prev;          // Neighbours in the eviction order, least valuable first
+    uint8_t rank_next;
+} ap_records_state_t;
+
+/**
+ * A record's SSID and password, read from storage on demand. Entries whose
+ * content is not known to be on flash yet are pinned until a save confirms it.
+ */
+typedef struct {
+    bool valid;
+    bool unsaved;               // Changed since the last save snapshot, this is the only copy
+    uint8_t slot;
+    uint32_t last_used;         // Cache clock at the last access, the oldest unpinned entry is evicted
+    uint8_t ssid[sizeof(((ap_info_t*)0)->ssid)];
+    uint8_t password[sizeof(((ap_info_t*)0)->password)];
+} ap_records_cache_entry_t;
+
+/**
+ * Everything one save writes, copied out of the live record list in the
+ * caller's context so the storage task never touches the list itself
+ */
+typedef struct {
+    uint8_t slot;
+    uint8_t size;
+    uint8_t data[AP_RECORDS_RECORD_MAX_SIZE];
+} ap_records_pending_record_t;
+
+typedef struct {
+    uint32_t seq;               // Save sequence number, see save_seq_done
+    bool redo;                  // Rewrites everything earlier saves left unconfirmed
+    bool write_index;
+    uint16_t index_size;
+    uint8_t index[AP_RECORDS_INDEX_HEADER_SIZE + CONFIG_MAX_AP_COUNT];
+    uint8_t stale_slots[AP_RECORDS_BITMAP_SIZE];
+    bool clear_usage_log;
+    uint8_t usage_entries;      // Usage log keys to erase, from entry 0
+    ap_records_save_cb_t callback;
+    void* callback_arg;
+    int8_t usage_append;        // Usage log entry this request only appends, -1 for a save
+    uint8_t usage_entry[AP_RECORDS_USAGE_ENTRY_SIZE];
+    uint8_t record_count;
+    ap_records_pending_record_t records[];
+} ap_records_save_request_t;
+
+/**
+ * Handles for one group of record writes in a save; records are written in
+ * groups so only a few handles are open however many records change
+ */
+typedef struct {
+    blob_storage_batch_t batch;
+    blob_storage_batch_op_t ops[AP_RECORDS_SAVE_BATCH_RECORDS + 2];
+    blob_storage_handle_t handles[AP_RECORDS_SAVE_BATCH_RECORDS];
+    int handle_count;
+} ap_records_save_batch_t;
+
+// Static instance - only this component manages it
+static bool is_initialized = false;
+
+/**
+ * Public functions run under records_lock. While they change the record list,
+ * the metadata or the cache they also make records_seq odd, so lock-free
+ * readers can tell a snapshot that raced with them. These write sections only
+ * touch RAM: flash I/O, saves and waits for the storage task happen outside
+ * them, so a reader never waits for flash and the storage task can always
+ * finish a read.
+ */
+static SemaphoreHandle_t records_lock = NULL;
+static volatile uint32_t records_seq = 0;
+static int write_depth = 0;                 // Nesting of write sections, only touched under records_lock
+static bool walking = false;                // ap_records_for_each() is calling its visitor, under records_lock
+static blob_storage_handle_t index_handle = {0};
+
+// Records never move in RAM: the list is a dense array of storage slots, the metadata is kept per slot
+static int record_count = 0;
+static uint8_t record_order[CONFIG_MAX_AP_COUNT] = {0};     // Storage slot at each list position
+static ap_records_meta_t record_meta[CONFIG_MAX_AP_COUNT] = {0};
+static ap_records_state_t record_state[CONFIG_MAX_AP_COUNT] = {0};
+static ap_records_stats_t record_stats[CONFIG_MAX_AP_COUNT] = {0};     // Saved with the record whenever it is written
+static uint8_t free_slots[CONFIG_MAX_AP_COUNT] = {0};       // Stack of slots without a record
+static int free_slot_count = 0;
+
+// Records linked by rank, the head is the next eviction victim
+static uint8_t rank_head = AP_RECORDS_NO_SLOT;
+static uint8_t rank_tail = AP_RECORDS_NO_SLOT;
+static uint32_t use_clock = 0;              // Counts record uses, the newest last_used of any record
+
+static ap_records_cache_entry_t record_cache[CONFIG_AP_RECORDS_CACHE_SIZE] = {0};
+static uint32_t cache_clock = 0;
+static ap_record_t* readonly_records = NULL;                // Filled by ap_records_get_readonly()
+
+static uint8_t dirty_slots[AP_RECORDS_BITMAP_SIZE] = {0};   // Slots whose record must be rewritten
+static uint8_t stale_slots[AP_RECORDS_BITMAP_SIZE] = {0};   // Freed slots whose key must be erased
+static uint8_t stats_slots[AP_RECORDS_BITMAP_SIZE] = {0};   // Slots whose statistics changed in RAM, written by the next save
+static bool index_dirty = false;
+// Set by whoever writes a save, the storage task included, which cannot take records_lock: use atomics
+static bool save_failed = false;            // A save did not complete, redo everything unconfirmed on the next one
+
+// Saves are numbered; every slot written or erased by saves up to save_seq_done is on flash
+static uint32_t save_seq_taken = 0;
+static uint32_t save_seq_done = 0;
+static bool save_unconfirmed = false;       // A save failed, hold save_seq_done until a redo lands
+
+// Open addressing lookup tables over the records: storage slot + 1 per bucket, 0 for an empty bucket
+static uint8_t ssid_lookup[AP_RECORDS_LOOKUP_SIZE] = {0};
+static uint8_t bssid_lookup[AP_RECORDS_LOOKUP_SIZE] = {0};     // Records without a BSSID are not in here
+
+// Use counts changed since the last save, appended here instead of rewriting the records.
+// Entry i is stored under its own key, so an append writes one entry and nothing else.
+static uint8_t usage_log[AP_RECORDS_USAGE_LOG_MAX_SIZE] = {0};
+static uint8_t usage_log_count = 0;                 // Entries in usage_log, all of them stored
+static bool usage_append_failed = false;            // The storage task failed an append, set with atomics
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+#define AP_RECORDS_SHUTDOWN_FLUSH_MS 1000
+
+// Storage task state; a NULL queue entry is a flush barrier
+static QueueHandle_t storage_queue = NULL;
+static SemaphoreHandle_t flush_lock = NULL;         // Serializes flush callers
+static SemaphoreHandle_t barrier_done_sem = NULL;   // Given whenever the task passes a barrier
+static uint32_t barriers_posted = 0;                // Only changed under flush_lock
+static uint32_t barriers_done = 0;                  // Only changed by the storage task, read with atomics
+static TaskHandle_t storage_task_handle = NULL;
+#endif
+
+static inline void set_slot_bit(uint8_t* bitmap, int slot)
+{
+    bitmap[slot / 8] |= (uint8_t)(1 << (slot % 8));
+}
+
+static inline void clear_slot_bit(uint8_t* bitmap, int slot)
+{
+    bitmap[slot / 8] &= (uint8_t)~(1 << (slot % 8));
+}
+
+static inline bool test_slot_bit(const uint8_t* bitmap, int slot)
+{
+    return (bitmap[slot / 8] >> (slot % 8)) & 1;
+}
+
+static inline bool slot_in_use(int slot)
+{
+    int position = record_state[slot].position;
+    return position < record_count && record_order[position] == slot;
+}
+
+static inline bool save_seq_confirmed(uint32_t seq)
+{
+    return (int32_t)(__atomic_load_n(&save_seq_done, __ATOMIC_ACQUIRE) - seq) >= 0;
+}
+
+static void mark_record_dirty(uint8_t slot)
+{
+    set_slot_bit(dirty_slots, slot);
+}
+
+// Rebuild the free slot stack from the slots in use, lowest slot on top
+static void reset_free_slots(void)
+{
+    free_slot_count = 0;
+    for (int slot = CONFIG_MAX_AP_COUNT - 1; slot >= 0; slot--) {
+        if (!slot_in_use(slot)) {
+            free_slots[free_slot_count++] = (uint8_t)slot;
+        }
+    }
+}
+
+// Take a given storage slot off the free stack, for a record that keeps its key
+static void take_slot(uint8_t slot)
+{
+    for (int i = 0; i < free_slot_count; i++) {
+        if (free_slots[i] == slot) {
+            memmove(&free_slots[i], &free_slots[i + 1], free_slot_count - i - 1);
+            free_slot_count--;
+            return;
+        }
+    }
+}
+
+// Take a storage slot not used by any current record
+static uint8_t alloc_slot(void)
+{
+    uint8_t slot = free_slots[--free_slot_count];   // Callers only allocate when a record is free
+    clear_slot_bit(stale_slots, slot);
+    return slot;
+}
+
+static void release_slot(uint8_t slot)
+{
+    free_slots[free_slot_count++] = slot;
+    clear_slot_bit(dirty_slots, slot);
+    clear_slot_bit(stats_slots, slot);
+    set_slot_bit(stale_slots, slot);
+    index_dirty = true;
+}
+
+static inline void lock_records(void)
+{
+    if (records_lock) {
+        xSemaphoreTakeRecursive(records_lock, portMAX_DELAY);
+    }
+}
+
+static inline void unlock_records(void)
+{
+    if (records_lock) {
+        xSemaphoreGiveRecursive(records_lock);
+    }
+}
+
+// Changes from inside a visitor would move the records under the walk and the views it handed out
+static bool in_walk(void)
+{
+    if (walking) {
+        ESP_LOGE(TAG, "AP records cannot change during ap_records_for_each()");
+    }
+    return walking;
+}
+
+// Enter a write section: takes the lock and makes records_seq odd. No flash I/O until end_write().
+static void begin_write(void)
+{
+    lock_records();
+#ifdef CONFIG_AP_RECORDS_DEBUG_CHECKS
+    if (walking) {
+        abort();
+    }
+#endif
+    if (write_depth++ == 0) {
+        __atomic_store_n(&records_seq, records_seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+#ifdef CONFIG_AP_RECORDS_DEBUG_CHECKS
+static esp_err_t check_records(void);
+#endif
+
+static void end_write(void)
+{
+    if (--write_depth == 0) {
+        __atomic_store_n(&records_seq, records_seq + 1, __ATOMIC_RELEASE);
+#ifdef CONFIG_AP_RECORDS_DEBUG_CHECKS
+        // Still under the lock; outside the write section, as the check may read SSIDs from flash
+        if (is_initialized && check_records() != ESP_OK) {
+            abort();
+        }
+#endif
+    }
+    unlock_records();
+}
+
+/**
+ * Fields that lock-free readers copy are stored with relaxed atomics in write
+ * sections and loaded with them by the readers: record_count, record_order,
+ * rank_tail, the position and rank_prev of record_state, the bssid, use_count
+ * and last_used of record_meta, and the valid, slot, ssid and password of
+ * cache entries. records_seq decides whether a copy is used; the atomics only
+ * keep the racing accesses defined. Writers read them plainly under the lock.
+ */
+#define SHARED_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define SHARED_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+// Byte-wise copy to or from shared fields; front to back, so it also moves an array down in place
+static void shared_copy(void* dst, const void* src, size_t len)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    for (size_t i = 0; i < len; i++) {
+        SHARED_STORE(d[i], SHARED_LOAD(s[i]));
+    }
+}
+
+static void shared_zero(void* dst, size_t len)
+{
+    uint8_t* d = dst;
+    for (size_t i = 0; i < len; i++) {
+        SHARED_STORE(d[i], 0);
+    }
+}
+
+// Start of a lock-free read, an odd value means a writer is busy
+static inline uint32_t read_begin(void)
+{
+    return __atomic_load_n(&records_seq, __ATOMIC_ACQUIRE);
+}
+
+// Whether everything read since read_begin() returned seq is consistent
+static inline bool read_valid(uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(seq & 1) && __atomic_load_n(&records_seq, __ATOMIC_RELAXED) == seq;
+}
+
+/**
+ * Whether a reader whose snapshots keep racing writers may wait for them on
+ * records_lock. The storage task may not, lock holders can be waiting for it;
+ * write sections never do, so it retries until the writer is done instead.
+ */
+static bool reader_may_lock(void)
+{
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    return !storage_task_handle || xTaskGetCurrentTaskHandle() != storage_task_handle;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Eviction rank of a record. The use count halves every aging period of the
+ * use clock, so one doubling of the count is worth one period of recency and
+ * the order of two records only changes when one of them is used.
+ */
+static uint32_t record_rank(uint16_t use_count, uint32_t last_used)
+{
+    uint32_t doublings = 31 - __builtin_clz((uint32_t)use_count | 1);
+    return last_used + doublings * CONFIG_AP_RECORDS_AGING_PERIOD;
+}
+
+static uint32_t slot_rank(uint8_t slot)
+{
+    return record_rank(record_meta[slot].use_count, record_meta[slot].last_used);
+}
+
+static inline bool rank_below(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static void rank_unlink(uint8_t slot)
+{
+    ap_records_state_t* state = &record_state[slot];
+    if (state->rank_prev != AP_RECORDS_NO_SLOT) {
+        record_state[state->rank_prev].rank_next = state->rank_next;
+    } else {
+        rank_head = state->rank_next;
+    }
+    if (state->rank_next != AP_RECORDS_NO_SLOT) {
+        SHARED_STORE(record_state[state->rank_next].rank_prev, state->rank_prev);
+    } else {
+        SHARED_STORE(rank_tail, state->rank_prev);
+    }
+}
+
+static void rank_link(uint8_t slot)
+{
+    // Records are mostly linked right after a use and rank near the top, so search from the tail
+    uint32_t rank = slot_rank(slot);
+    uint8_t prev = rank_tail;
+    while (prev != AP_RECORDS_NO_SLOT && rank_below(rank, slot_rank(prev))) {
+        prev = record_state[prev].rank_prev;
+    }
+
+    ap_records_state_t* state = &record_state[slot];
+    SHARED_STORE(state->rank_prev, prev);
+    state->rank_next = (prev != AP_RECORDS_NO_SLOT) ? record_state[prev].rank_next : rank_head;
+    if (prev != AP_RECORDS_NO_SLOT) {
+        record_state[prev].rank_next = slot;
+    } else {
+        rank_head = slot;
+    }
+    if (state->rank_next != AP_RECORDS_NO_SLOT) {
+        SHARED_STORE(record_state[state->rank_next].rank_prev, slot);
+    } else {
+        SHARED_STORE(rank_tail, slot);
+    }
+}
+
+static void rank_rebuild(void)
+{
+    rank_head = AP_RECORDS_NO_SLOT;
+    SHARED_STORE(rank_tail, AP_RECORDS_NO_SLOT);
+    // Equal ranks keep the list order, the first one is the most valuable
+    for (int i = record_count - 1; i >= 0; i--) {
+        rank_link(record_order[i]);
+    }
+}
+
+// Use count of a record decayed by the aging periods that ended since its last use
+static uint16_t decayed_use_count(uint8_t slot)
+{
+    uint32_t periods = use_clock / CONFIG_AP_RECORDS_AGING_PERIOD -
+                       record_meta[slot].last_used / CONFIG_AP_RECORDS_AGING_PERIOD;
+    return (periods < 16) ? (uint16_t)(record_meta[slot].use_count >> periods) : 0;
+}
+
+// Record a use: decay the count, then count this one
+static void record_use(uint8_t slot)
+{
+    ap_records_meta_t* meta = &record_meta[slot];
+    use_clock++;
+    uint16_t count = decayed_use_count(slot);
+
+    SHARED_STORE(meta->use_count, (count < UINT16_MAX) ? count + 1 : count);
+    SHARED_STORE(meta->last_used, use_clock);
+    rank_unlink(slot);
+    rank_link(slot);
+}
+
+/**
+ * Move the use clock up to the newest use of any record and rebuild the
+ * eviction order. With reset the clock restarts from the records alone.
+ */
+static void sync_use_clock(bool reset)
+{
+    for (int i = 0; i < record_count; i++) {
+        uint32_t last_used = record_meta[record_order[i]].last_used;
+        if ((reset && i == 0) || (int32_t)(last_used - use_clock) > 0) {
+            use_clock = last_used;
+        }
+    }
+    rank_rebuild();
+}
+
+static int find_least_used(void)
+{
+    return record_state[rank_head].position;
+}
+
+static uint32_t lookup_hash(const uint8_t* key, size_t len)
+{
+    return esp_rom_crc32_le(0, key, len);
+}
+
+static uint32_t ssid_hash(const char* ssid)
+{
+    return lookup_hash((const uint8_t*)ssid, strnlen(ssid, AP_RECORDS_SSID_MAX_LEN));
+}
+
+static uint32_t bssid_hash(const uint8_t* bssid)
+{
+    return lookup_hash(bssid, 6);
+}
+
+static uint32_t ssid_hash_at(int slot)
+{
+    return record_meta[slot].ssid_hash;
+}
+
+static uint32_t bssid_hash_at(int slot)
+{
+    return bssid_hash(record_meta[slot].bssid);
+}
+
+static bool bssid_is_set(const uint8_t* bssid)
+{
+    static const uint8_t unset[6] = {0};
+    return memcmp(bssid, unset, sizeof(unset)) != 0;
+}
+
+static void lookup_put(uint8_t* table, uint32_t hash, int slot)
+{
+    uint32_t bucket = hash & AP_RECORDS_LOOKUP_MASK;
+    while (table[bucket]) {
+        bucket = (bucket + 1) & AP_RECORDS_LOOKUP_MASK;
+    }
+    table[bucket] = (uint8_t)(slot + 1);
+}
+
+// Take a slot out of a table, moving later members of its probe run back into the gap
+static void lookup_take(uint8_t* table, uint32_t hash, int slot, uint32_t (*hash_at)(int))
+{
+    uint32_t gap = hash & AP_RECORDS_LOOKUP_MASK;
+    while (table[gap] != slot + 1) {
+        if (!table[gap]) {
+            return;
+        }
+        gap = (gap + 1) & AP_RECORDS_LOOKUP_MASK;
+    }
+
+    uint32_t next = gap;
+    for (;;) {
+        next = (next + 1) & AP_RECORDS_LOOKUP_MASK;
+        if (!table[next]) {
+            break;
+        }
+        uint32_t home = hash_at(table[next] - 1) & AP_RECORDS_LOOKUP_MASK;
+        // Move it unless its home bucket lies cyclically in (gap, next]
+        if (((next - home) & AP_RECORDS_LOOKUP_MASK) >= ((next - gap) & AP_RECORDS_LOOKUP_MASK)) {
+            table[gap] = table[next];
+            gap = next;
+        }
+    }
+    table[gap] = 0;
+}
+
+static void lookup_insert(int slot)
+{
+    lookup_put(ssid_lookup, ssid_hash_at(slot), slot);
+    if (bssid_is_set(record_meta[slot].bssid)) {
+        lookup_put(bssid_lookup, bssid_hash_at(slot), slot);
+    }
+}
+
+// Call while the metadata of slot still holds the indexed SSID hash and BSSID
+static void lookup_remove(int slot)
+{
+    lookup_take(ssid_lookup, ssid_hash_at(slot), slot, ssid_hash_at);
+    if (bssid_is_set(record_meta[slot].bssid)) {
+        lookup_take(bssid_lookup, bssid_hash_at(slot), slot, bssid_hash_at);
+    }
+}
+
+static void lookup_rebuild(void)
+{
+    memset(ssid_lookup, 0, sizeof(ssid_lookup));
+    memset(bssid_lookup, 0, sizeof(bssid_lookup));
+    for (int i = 0; i < record_count; i++) {
+        lookup_insert(record_order[i]);
+    }
+}
+
+// Lowest list position with this BSSID, like a scan of the list would find
+static int lookup_bssid(const uint8_t* bssid)
+{
+    if (!bssid_is_set(bssid)) {
+        for (int i = 0; i < record_count; i++) {
+            if (!bssid_is_set(record_meta[record_order[i]].bssid)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    int found = -1;
+    uint32_t bucket = bssid_hash(bssid) & AP_RECORDS_LOOKUP_MASK;
+    while (bssid_lookup[bucket]) {
+        uint8_t slot = bssid_lookup[bucket] - 1;
+        if (memcmp(record_meta[slot].bssid, bssid, 6) == 0 && (found < 0 || record_state[slot].position < found)) {
+            found = record_state[slot].position;
+        }
+        bucket = (bucket + 1) & AP_RECORDS_LOOKUP_MASK;
+    }
+    return found;
+}
+
+static size_t encode_record(const ap_info_t* info, const ap_records_stats_t* stats, uint8_t* buf)
+{
+    ap_record_header_t header = {
+        .magic = AP_RECORDS_RECORD_MAGIC,
+        .version = AP_RECORDS_RECORD_VERSION,
+        .use_count = info->use_count,
+        .last_used = info->last_used,
+        .last_success = stats->last_success,
+        .success_count = stats->success_count,
+        .failure_count = stats->failure_count,
+        .avg_connect_ms = stats->avg_connect_ms,
+        .last_rssi = stats->last_rssi,
+        .last_channel = stats->last_channel,
+        .last_disconnect_reason = stats->last_disconnect_reason,
+    };
+    memcpy(header.bssid, info->bssid, sizeof(header.bssid));
+    memcpy(buf, &header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    size_t ssid_len = strnlen((const char*)info->ssid, AP_RECORDS_SSID_MAX_LEN);
+    size_t password_len = strnlen((const char*)info->password, AP_RECORDS_PASSWORD_MAX_LEN);
+
+    buf[offset++] = (uint8_t)ssid_len;
+    memcpy(&buf[offset], info->ssid, ssid_len);
+    offset += ssid_len;
+
+    buf[offset++] = (uint8_t)password_len;
+    memcpy(&buf[offset], info->password, password_len);
+    offset += password_len;
+
+    return offset;
+}
+
+// Decode a compact record; stats can be NULL
+static esp_err_t decode_record(const uint8_t* buf, size_t size, ap_info_t* info, ap_records_stats_t* stats)
+{
+    memset(info, 0, sizeof(ap_info_t));
+    if (stats) {
+        memset(stats, 0, sizeof(ap_records_stats_t));
+    }
+
+    ap_record_header_t header;
+    if (size == 0 || buf[0] != AP_RECORDS_RECORD_MAGIC) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (size < sizeof(header) + 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (header.version != AP_RECORDS_RECORD_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    size_t offset = sizeof(header);
+
+    size_t ssid_len = buf[offset++];
+    if (ssid_len > AP_RECORDS_SSID_MAX_LEN || offset + ssid_len + 1 > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(info->ssid, &buf[offset], ssid_len);
+    offset += ssid_len;
+
+    size_t password_len = buf[offset++];
+    if (password_len > AP_RECORDS_PASSWORD_MAX_LEN || offset + password_len != size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(info->password, &buf[offset], password_len);
+
+    memcpy(info->bssid, header.bssid, sizeof(info->bssid));
+    info->use_count = header.use_count;
+    info->last_used = header.last_used;
+    if (stats) {
+        stats->last_success = header.last_success;
+        stats->success_count = header.success_count;
+        stats->failure_count = header.failure_count;
+        stats->avg_connect_ms = header.avg_connect_ms;
+        stats->last_rssi = header.last_rssi;
+        stats->last_channel = header.last_channel;
+        stats->last_disconnect_reason = header.last_disconnect_reason;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t open_record_handle(int slot, blob_storage_handle_t* handle)
+{
+    char key[AP_RECORDS_KEY_BUF_SIZE];
+    snprintf(key, sizeof(key), AP_RECORDS_RECORD_KEY_FMT, (uint8_t)slot);
+    return blob_storage_create_handle_ex(handle, AP_RECORDS_NAMESPACE, key,
+                                         AP_RECORDS_RECORD_MAX_SIZE, AP_RECORDS_RECORD_FLAGS);
+}
+
+static esp_err_t open_usage_handle(int entry, blob_storage_handle_t* handle)
+{
+    char key[AP_RECORDS_KEY_BUF_SIZE];
+    snprintf(key, sizeof(key), AP_RECORDS_USAGE_KEY_FMT, (unsigned)entry);
+    return blob_storage_create_handle_ex(handle, AP_RECORDS_NAMESPACE, key,
+                                         AP_RECORDS_USAGE_ENTRY_SIZE, AP_RECORDS_USAGE_FLAGS);
+}
+
+static esp_err_t read_record(int slot, ap_info_t* info, ap_records_stats_t* stats)
+{
+    blob_storage_handle_t handle;
+    esp_err_t ret = open_record_handle(slot, &handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint8_t buf[AP_RECORDS_RECORD_MAX_SIZE];
+    size_t size = sizeof(buf);
+    ret = blob_storage_read(&handle, buf, &size);
+    blob_storage_close_handle(&handle);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return decode_record(buf, size, info, stats);
+}
+
+static void erase_slots(const uint8_t* slots)
+{
+    for (int slot = 0; slot < AP_RECORDS_INDEX_MAX_SLOTS; slot++) {
+        if (!test_slot_bit(slots, slot)) {
+            continue;
+        }
+
+        blob_storage_handle_t handle;
+        if (open_record_handle(slot, &handle) == ESP_OK) {
+            blob_storage_delete(&handle);
+            blob_storage_close_handle(&handle);
+        }
+    }
+}
+
+static bool cache_entry_pinned(const ap_records_cache_entry_t* entry)
+{
+    return entry->unsaved || !save_seq_confirmed(record_state[entry->slot].save_seq);
+}
+
+// Cache entry of a slot without counting it as a use, for readers that must not change the LRU order
+static ap_records_cache_entry_t* cache_peek(uint8_t slot)
+{
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        if (SHARED_LOAD(record_cache[i].valid) && SHARED_LOAD(record_cache[i].slot) == slot) {
+            return &record_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static ap_records_cache_entry_t* cache_find(uint8_t slot)
+{
+    ap_records_cache_entry_t* entry = cache_peek(slot);
+    if (entry) {
+        entry->last_used = ++cache_clock;
+    }
+    return entry;
+}
+
+static void cache_drop(uint8_t slot)
+{
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        if (record_cache[i].valid && record_cache[i].slot == slot) {
+            SHARED_STORE(record_cache[i].valid, false);
+        }
+    }
+}
+
+// A free entry, or the least recently used one that is safe to drop
+static ap_records_cache_entry_t* cache_victim(void)
+{
+    ap_records_cache_entry_t* victim = NULL;
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        ap_records_cache_entry_t* entry = &record_cache[i];
+        if (!entry->valid) {
+            return entry;
+        }
+        if (!cache_entry_pinned(entry) && (!victim || (int32_t)(entry->last_used - victim->last_used) < 0)) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Free up a cache entry for a writer. When every entry holds changes that are
+ * not on flash yet, they are saved first and a failed save is returned, so
+ * this is never called inside a write section. The caller assigns the entry
+ * before the next cache call.
+ */
+static esp_err_t cache_claim(ap_records_cache_entry_t** entry)
+{
+    *entry = cache_victim();
+    if (!*entry) {
+        esp_err_t ret = ap_records_save();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to save AP records to free a cache entry: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        *entry = cache_victim();
+    }
+    if (!*entry) {
+        ESP_LOGE(TAG, "AP record cache full of unsaved records");
+        return ESP_ERR_NO_MEM;
+    }
+
+    begin_write();
+    SHARED_STORE((*entry)->valid, false);
+    end_write();
+    return ESP_OK;
+}
+
+static void cache_assign(ap_records_cache_entry_t* entry, uint8_t slot)
+{
+    SHARED_STORE(entry->valid, true);
+    entry->unsaved = false;
+    SHARED_STORE(entry->slot, slot);
+    entry->last_used = ++cache_clock;
+}
+
+/**
+ * SSID and password of a record in use, copied into info. A record that is not
+ * cached is read from storage and takes the cache entry of a record that is on
+ * flash; lookups never write, so with every entry holding unsaved changes it
+ * is only read into info.
+ */
+static esp_err_t fetch_record(uint8_t slot, ap_info_t* info)
+{
+    const ap_records_cache_entry_t* cached = cache_find(slot);
+    if (cached) {
+        memcpy(info->ssid, cached->ssid, sizeof(info->ssid));
+        memcpy(info->password, cached->password, sizeof(info->password));
+        return ESP_OK;
+    }
+
+    esp_err_t ret = read_record(slot, info, NULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read AP record in slot %d: %s", slot, esp_err_to_name(ret));
+        return ret;
+    }
+
+    // The views of a walk point into the cache, a lookup from its visitor only reads
+    ap_records_cache_entry_t* entry = walking ? NULL : cache_victim();
+    if (!entry) {
+        return ESP_OK;
+    }
+
+    // Replacing a cache entry is a change to lock-free readers
+    begin_write();
+    cache_assign(entry, slot);
+    shared_copy(entry->ssid, info->ssid, sizeof(entry->ssid));
+    shared_copy(entry->password, info->password, sizeof(entry->password));
+    end_write();
+    return ESP_OK;
+}
+
+// Hot fields of a record into info; the SSID and password come from fetch_record() or the cache
+static void fill_info(uint8_t slot, ap_info_t* info)
+{
+    memcpy(info->bssid, record_meta[slot].bssid, sizeof(info->bssid));
+    info->use_count = record_meta[slot].use_count;
+    info->last_used = record_meta[slot].last_used;
+}
+
+// Copies at most size - 1 bytes of str into a shared field and zero-fills the rest
+static void set_shared_string(uint8_t* field, size_t size, const char* str)
+{
+    size_t len = strnlen(str, size - 1);
+    for (size_t i = 0; i < size; i++) {
+        SHARED_STORE(field[i], (i < len) ? (uint8_t)str[i] : 0);
+    }
+}
+
+static void set_record_content(ap_records_cache_entry_t* entry, const char* ssid, const char* password)
+{
+    set_shared_string(entry->ssid, sizeof(entry->ssid), ssid);
+    set_shared_string(entry->password, sizeof(entry->password), password);
+    entry->unsaved = true;
+}
+
+/**
+ * Find the slot of a record by SSID; hash matches are confirmed against the
+ * stored SSID. info, if not NULL, receives the SSID and password of the match.
+ */
+static esp_err_t lookup_ssid(const char* ssid, uint8_t* slot, ap_info_t* info)
+{
+    uint32_t hash = ssid_hash(ssid);
+    uint32_t bucket = hash & AP_RECORDS_LOOKUP_MASK;
+    ap_info_t scratch;
+    ap_info_t* candidate_info = info ? info : &scratch;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    while (ssid_lookup[bucket]) {
+        uint8_t candidate = ssid_lookup[bucket] - 1;
+        if (record_meta[candidate].ssid_hash == hash) {
+            ret = fetch_record(candidate, candidate_info);
+            if (ret != ESP_OK) {
+                break;
+            }
+            if (strcmp((const char*)candidate_info->ssid, ssid) == 0) {
+                *slot = candidate;
+                break;
+            }
+            ret = ESP_ERR_NOT_FOUND;
+        }
+        bucket = (bucket + 1) & AP_RECORDS_LOOKUP_MASK;
+    }
+
+    if (!info) {
+        memset(scratch.password, 0, sizeof(scratch.password));
+    }
+    return ret;
+}
+
+// Append a record with the given content at the end of the list
+static void place_record(uint8_t slot, const ap_info_t* info)
+{
+    ap_records_meta_t* meta = &record_meta[slot];
+    meta->ssid_hash = ssid_hash((const char*)info->ssid);
+    shared_copy(meta->bssid, info->bssid, sizeof(meta->bssid));
+    SHARED_STORE(meta->use_count, info->use_count);
+    SHARED_STORE(meta->last_used, info->last_used);
+    memset(&record_stats[slot], 0, sizeof(record_stats[slot]));
+    SHARED_STORE(record_state[slot].position, (uint8_t)record_count);
+    SHARED_STORE(record_order[record_count], slot);
+    SHARED_STORE(record_count, record_count + 1);
+    rank_link(slot);
+}
+
+static void remove_at(int position)
+{
+    uint8_t slot = record_order[position];
+    lookup_remove(slot);
+    rank_unlink(slot);
+    cache_drop(slot);
+    release_slot(slot);
+
+    // Only the slot numbers of the later records move
+    shared_copy(&record_order[position], &record_order[position + 1], record_count - position - 1);
+    SHARED_STORE(record_count, record_count - 1);
+    for (int i = position; i < record_count; i++) {
+        SHARED_STORE(record_state[record_order[i]].position, (uint8_t)i);
+    }
+}
+
+static void remove_all(void)
+{
+    for (int i = 0; i < record_count; i++) {
+        release_slot(record_order[i]);
+    }
+    SHARED_STORE(record_count, 0);
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        SHARED_STORE(record_cache[i].valid, false);
+    }
+    reset_free_slots();
+    lookup_rebuild();
+    rank_rebuild();
+}
+
+/**
+ * Place a record read from storage, in a write section of its own. slot is
+ * its current storage slot, or -1 if it needs a new one. When more records are
+ * stored than fit, the most used ones are kept. *position is the list
+ * position, or -1 if the record was dropped. Fails only if making room in the
+ * cache for a record without a slot did.
+ */
+static esp_err_t adopt_record(const ap_info_t* info, int slot, int* position)
+{
+    ap_records_cache_entry_t* entry = NULL;
+
+    if (slot < 0) {
+        // Only in RAM until the next save, keep it in the cache
+        esp_err_t ret = cache_claim(&entry);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    begin_write();
+    if (record_count == CONFIG_MAX_AP_COUNT) {
+        *position = find_least_used();
+        if (!rank_below(slot_rank(record_order[*position]), record_rank(info->use_count, info->last_used))) {
+            ESP_LOGW(TAG, "No room for stored AP record %s, dropping it", (const char*)info->ssid);
+            *position = -1;
+            end_write();
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "Dropping less used AP record in slot %d to make room", record_order[*position]);
+        remove_at(*position);
+    }
+
+    if (entry) {
+        slot = alloc_slot();
+        cache_assign(entry, (uint8_t)slot);
+        set_record_content(entry, (const char*)info->ssid, (const char*)info->password);
+        mark_record_dirty((uint8_t)slot);
+        index_dirty = true;
+    } else {
+        take_slot((uint8_t)slot);
+    }
+
+    *position = record_count;
+    place_record((uint8_t)slot, info);
+    lookup_insert(slot);
+    if ((int32_t)(info->last_used - use_clock) > 0) {
+        use_clock = info->last_used;
+    }
+    end_write();
+    return ESP_OK;
+}
+
+// A raw ap_info_t of the single-blob layout
+static void decode_legacy_info(const uint8_t* buf, ap_info_t* info)
+{
+    ap_info_legacy_t raw;
+    memcpy(&raw, buf, sizeof(raw));
+    memset(info, 0, sizeof(ap_info_t));
+    memcpy(info->ssid, raw.ssid, AP_RECORDS_SSID_MAX_LEN);
+    memcpy(info->password, raw.password, AP_RECORDS_PASSWORD_MAX_LEN);
+    memcpy(info->bssid, raw.bssid, sizeof(info->bssid));
+    info->use_count = raw.use_count;
+}
+
+// Parse the old single-blob layout: CONFIG_MAX_AP_COUNT raw ap_info_t followed by the record count
+static esp_err_t migrate_legacy_blob(void)
+{
+    const size_t legacy_max_size = AP_RECORDS_LEGACY_MAX_COUNT * sizeof(ap_info_legacy_t) + 1;
+
+    blob_storage_handle_t legacy_handle;
+    esp_err_t ret = blob_storage_create_handle_ex(&legacy_handle, AP_RECORDS_NAMESPACE, AP_RECORDS_LEGACY_KEY,
+                                                  legacy_max_size, BLOB_STORAGE_FLAG_PERSISTENT);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint8_t* buf = malloc(legacy_max_size);
+    if (!buf) {
+        blob_storage_close_handle(&legacy_handle);
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t size = legacy_max_size;
+    ret = blob_storage_read(&legacy_handle, buf, &size);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = ESP_ERR_NOT_FOUND;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read legacy AP records: %s", esp_err_to_name(ret));
+    } else if (size < 1 || (size - 1) % sizeof(ap_info_legacy_t) != 0 ||
+               buf[size - 1] > (size - 1) / sizeof(ap_info_legacy_t)) {
+        ESP_LOGW(TAG, "Invalid legacy AP records, resetting");
+        blob_storage_delete(&legacy_handle);
+        ret = ESP_ERR_INVALID_SIZE;
+    } else {
+        int stored = buf[size - 1];
+        for (int i = 0; i < stored && ret == ESP_OK; i++) {
+            ap_info_t info;
+            int position;
+            decode_legacy_info(&buf[i * sizeof(ap_info_legacy_t)], &info);
+            if (info.ssid[0] != '\0') {
+                ret = adopt_record(&info, -1, &position);
+            }
+        }
+
+        index_dirty = true;
+        if (ret == ESP_OK) {
+            ret = ap_records_save();
+        }
+        if (ret == ESP_OK) {
+            // Records are safe in their own keys now, the old blob is no longer needed
+            blob_storage_delete(&legacy_handle);
+            ESP_LOGI(TAG, "Migrated %d of %d legacy AP records", record_count, stored);
+        }
+    }
+
+    free(buf);
+    blob_storage_close_handle(&legacy_handle);
+    return ret;
+}
+
+static bool has_pending_changes(void)
+{
+    if (index_dirty || __atomic_load_n(&save_failed, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&usage_append_failed, __ATOMIC_ACQUIRE) ||
+        usage_log_count == CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES) {
+        return true;
+    }
+    for (int i = 0; i < AP_RECORDS_BITMAP_SIZE; i++) {
+        if (dirty_slots[i] || stale_slots[i] || stats_slots[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Move the pending changes into a save request and mark them clean.
+ * Returns NULL if out of memory; the changes then stay pending.
+ */
+static ap_records_save_request_t* take_save_snapshot(void)
+{
+    // Claim the failure flag at once, a save failing meanwhile sets it again for the next snapshot
+    bool redo = __atomic_exchange_n(&save_failed, false, __ATOMIC_ACQ_REL);
+    if (redo) {
+        // Unknown how far the failed save got: redo every write and erase not confirmed yet, and the index
+        for (int slot = 0; slot < CONFIG_MAX_AP_COUNT; slot++) {
+            if (!save_seq_confirmed(record_state[slot].save_seq)) {
+                set_slot_bit(slot_in_use(slot) ? dirty_slots : stale_slots, slot);
+            }
+        }
+        index_dirty = true;
+    }
+
+    // Fold the usage log into the records, their use counts in RAM already include it; failed appends too
+    __atomic_store_n(&usage_append_failed, false, __ATOMIC_RELAXED);
+    for (int e = 0; e < usage_log_count; e++) {
+        uint8_t slot = usage_log[e * AP_RECORDS_USAGE_ENTRY_SIZE];
+        if (slot < CONFIG_MAX_AP_COUNT && slot_in_use(slot)) {
+            mark_record_dirty(slot);
+        }
+    }
+    for (int i = 0; i < AP_RECORDS_BITMAP_SIZE; i++) {
+        dirty_slots[i] |= stats_slots[i];
+        stats_slots[i] = 0;
+    }
+
+    int dirty_count = 0;
+    for (int i = 0; i < record_count; i++) {
+        dirty_count += test_slot_bit(dirty_slots, record_order[i]);
+    }
+
+    ap_records_save_request_t* request = malloc(sizeof(ap_records_save_request_t) +
+                                                dirty_count * sizeof(ap_records_pending_record_t));
+    if (!request) {
+        if (redo) {
+            __atomic_store_n(&save_failed, true, __ATOMIC_RELEASE);
+        }
+        return NULL;
+    }
+
+    request->seq = ++save_seq_taken;
+    request->redo = redo;
+    request->clear_usage_log = redo || usage_log_count > 0;
+    request->usage_entries = redo ? CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES : usage_log_count;
+    request->callback = NULL;
+    request->callback_arg = NULL;
+    request->usage_append = -1;
+    usage_log_count = 0;
+
+    request->record_count = 0;
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        if (!test_slot_bit(dirty_slots, slot)) {
+            continue;
+        }
+        clear_slot_bit(dirty_slots, slot);
+
+        // Changed content is in the cache; records only rewritten for their use count or format come from flash
+        ap_info_t info;
+        ap_records_cache_entry_t* entry = cache_find(slot);
+        if (entry) {
+            memcpy(info.ssid, entry->ssid, sizeof(info.ssid));
+            memcpy(info.password, entry->password, sizeof(info.password));
+            entry->unsaved = false;
+        } else {
+            esp_err_t ret = read_record(slot, &info, NULL);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "AP record in slot %d unreadable (%s), not rewriting it", slot, esp_err_to_name(ret));
+                continue;
+            }
+        }
+        fill_info(slot, &info);
+
+        ap_records_pending_record_t* record = &request->records[request->record_count++];
+        record->slot = slot;
+        record->size = (uint8_t)encode_record(&info, &record_stats[slot], record->data);
+        record_state[slot].save_seq = request->seq;
+    }
+
+    request->write_index = index_dirty;
+    if (index_dirty) {
+        request->index[0] = AP_RECORDS_INDEX_VERSION;
+        request->index[1] = (uint8_t)record_count;
+        memcpy(&request->index[AP_RECORDS_INDEX_HEADER_SIZE], record_order, record_count);
+        request->index_size = AP_RECORDS_INDEX_HEADER_SIZE + record_count;
+        index_dirty = false;
+    }
+
+    for (int slot = 0; slot < CONFIG_MAX_AP_COUNT; slot++) {
+        if (test_slot_bit(stale_slots, slot)) {
+            record_state[slot].save_seq = request->seq;
+        }
+    }
+    memcpy(request->stale_slots, stale_slots, sizeof(stale_slots));
+    memset(stale_slots, 0, sizeof(stale_slots));
+    return request;
+}
+
+static void save_batch_close_handles(ap_records_save_batch_t* save)
+{
+    while (save->handle_count > 0) {
+        blob_storage_close_handle(&save->handles[--save->handle_count]);
+    }
+}
+
+// Commit the current group and start the next one
+static esp_err_t save_batch_commit(ap_records_save_batch_t* save)
+{
+    esp_err_t ret = blob_storage_batch_commit(&save->batch);
+    save_batch_close_handles(save);
+    if (ret == ESP_OK) {
+        ret = blob_storage_batch_begin(&save->batch, save->ops, sizeof(save->ops) / sizeof(save->ops[0]));
+    }
+    return ret;
+}
+
+// Free handle of the current group, committing the group first if it is full
+static esp_err_t save_batch_next_handle(ap_records_save_batch_t* save, blob_storage_handle_t** handle)
+{
+    if (save->handle_count == AP_RECORDS_SAVE_BATCH_RECORDS) {
+        esp_err_t ret = save_batch_commit(save);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    *handle = &save->handles[save->handle_count];
+    return ESP_OK;
+}
+
+// Write a record to a slot, or erase the slot if data is NULL
+static esp_err_t save_batch_add_slot(ap_records_save_batch_t* save, uint8_t slot, const void* data, size_t size)
+{
+    blob_storage_handle_t* handle;
+    esp_err_t ret = save_batch_next_handle(save, &handle);
+    if (ret == ESP_OK) {
+        ret = open_record_handle(slot, handle);
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    save->handle_count++;
+
+    return data ? blob_storage_batch_add(&save->batch, handle, data, size) :
+                  blob_storage_batch_add_delete(&save->batch, handle);
+}
+
+// Erase a usage log entry
+static esp_err_t save_batch_erase_usage(ap_records_save_batch_t* save, int entry)
+{
+    blob_storage_handle_t* handle;
+    esp_err_t ret = save_batch_next_handle(save, &handle);
+    if (ret == ESP_OK) {
+        ret = open_usage_handle(entry, handle);
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    save->handle_count++;
+    return blob_storage_batch_add_delete(&save->batch, handle);
+}
+
+/**
+ * Write a save request to storage; safe to run on the storage task. Records
+ * go out in groups of AP_RECORDS_SAVE_BATCH_RECORDS, a typical save is one
+ * group and one commit.
+ */
+static esp_err_t write_save_snapshot(const ap_records_save_request_t* request)
+{
+    ap_records_save_batch_t* save = calloc(1, sizeof(ap_records_save_batch_t));
+    esp_err_t ret = save ? blob_storage_batch_begin(&save->batch, save->ops, sizeof(save->ops) / sizeof(save->ops[0]))
+                         : ESP_ERR_NO_MEM;
+
+    // Records first, so the index never points at a record that was not written
+    for (int i = 0; i < request->record_count && ret == ESP_OK; i++) {
+        const ap_records_pending_record_t* record = &request->records[i];
+        ret = save_batch_add_slot(save, record->slot, record->data, record->size);
+    }
+
+    if (request->write_index && ret == ESP_OK) {
+        ret = blob_storage_batch_add(&save->batch, &index_handle, request->index, request->index_size);
+    }
+
+    // Erase freed slots last, they are no longer referenced by the index
+    for (int slot = 0; slot < CONFIG_MAX_AP_COUNT && ret == ESP_OK; slot++) {
+        if (test_slot_bit(request->stale_slots, slot)) {
+            ret = save_batch_add_slot(save, (uint8_t)slot, NULL, 0);
+        }
+    }
+
+    // The log is folded into the records written above
+    for (int e = 0; e < request->usage_entries && ret == ESP_OK; e++) {
+        ret = save_batch_erase_usage(save, e);
+    }
+
+    if (ret == ESP_OK) {
+        ret = blob_storage_batch_commit(&save->batch);
+    }
+    if (save) {
+        save_batch_close_handles(save);
+        free(save);
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save AP records: %s", esp_err_to_name(ret));
+        __atomic_store_n(&save_unconfirmed, true, __ATOMIC_RELAXED);
+        __atomic_store_n(&save_failed, true, __ATOMIC_RELEASE);
+    } else if (request->redo || !__atomic_load_n(&save_unconfirmed, __ATOMIC_RELAXED)) {
+        // A later save landing does not cover an earlier failed one, only a redo does
+        __atomic_store_n(&save_unconfirmed, false, __ATOMIC_RELAXED);
+        __atomic_store_n(&save_seq_done, request->seq, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+// Write one usage log entry; safe to run on the storage task
+static esp_err_t write_usage_entry(int index, const uint8_t* entry)
+{
+    blob_storage_handle_t handle;
+    esp_err_t ret = open_usage_handle(index, &handle);
+    if (ret == ESP_OK) {
+        ret = blob_storage_write(&handle, entry, AP_RECORDS_USAGE_ENTRY_SIZE);
+        blob_storage_close_handle(&handle);
+    }
+    return ret;
+}
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+static void storage_task(void* arg)
+{
+    (void)arg;
+    ap_records_save_request_t* request;
+
+    for (;;) {
+        if (xQueueReceive(storage_queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if (!request) {
+            // Everything queued before this barrier is written
+            __atomic_store_n(&barriers_done, barriers_done + 1, __ATOMIC_RELEASE);
+            xSemaphoreGive(barrier_done_sem);
+            continue;
+        }
+
+        if (request->usage_append >= 0) {
+            if (write_usage_entry(request->usage_append, request->usage_entry) != ESP_OK) {
+                // The use is in RAM and its record is folded in by the next save; make sure there is one
+                ESP_LOGW(TAG, "Failed to append AP usage log entry %d", request->usage_append);
+                __atomic_store_n(&usage_append_failed, true, __ATOMIC_RELEASE);
+            }
+            free(request);
+            continue;
+        }
+
+        esp_err_t ret = write_save_snapshot(request);
+        if (request->callback) {
+            request->callback(ret, request->callback_arg);
+        }
+        free(request);
+    }
+}
+
+static void storage_shutdown_handler(void)
+{
+    ap_records_flush(AP_RECORDS_SHUTDOWN_FLUSH_MS);
+}
+
+static void start_storage_task(void)
+{
+    storage_queue = xQueueCreate(CONFIG_AP_RECORDS_STORAGE_QUEUE_LEN, sizeof(ap_records_save_request_t*));
+    flush_lock = xSemaphoreCreateMutex();
+    barrier_done_sem = xSemaphoreCreateBinary();
+
+    if (storage_queue && flush_lock && barrier_done_sem &&
+        xTaskCreate(storage_task, "ap_storage", CONFIG_AP_RECORDS_STORAGE_TASK_STACK_SIZE, NULL,
+                    CONFIG_AP_RECORDS_STORAGE_TASK_PRIORITY, &storage_task_handle) == pdPASS) {
+        esp_register_shutdown_handler(storage_shutdown_handler);
+        return;
+    }
+
+    ESP_LOGW(TAG, "Failed to start AP record storage task, saving synchronously");
+    if (storage_queue) {
+        vQueueDelete(storage_queue);
+        storage_queue = NULL;
+    }
+    if (flush_lock) {
+        vSemaphoreDelete(flush_lock);
+        flush_lock = NULL;
+    }
+    if (barrier_done_sem) {
+        vSemaphoreDelete(barrier_done_sem);
+        barrier_done_sem = NULL;
+    }
+}
+#endif
+
+// Queued saves must land before the records are read or saved synchronously
+static void wait_for_storage_task(void)
+{
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    if (storage_queue) {
+        ap_records_flush(UINT32_MAX);
+    }
+#endif
+}
+
+// Tells a usage log entry of a removed record from one of the record now in its slot
+static uint16_t usage_check(uint8_t slot)
+{
+    return (uint16_t)record_meta[slot].ssid_hash;
+}
+
+static void put_usage_entry(int index, uint8_t slot, uint16_t use_count, uint32_t last_used)
+{
+    uint8_t* entry = &usage_log[index * AP_RECORDS_USAGE_ENTRY_SIZE];
+    uint16_t check = usage_check(slot);
+    entry[0] = slot;
+    entry[1] = (uint8_t)check;
+    entry[2] = (uint8_t)(check >> 8);
+    entry[3] = (uint8_t)use_count;
+    entry[4] = (uint8_t)(use_count >> 8);
+    entry[5] = (uint8_t)last_used;
+    entry[6] = (uint8_t)(last_used >> 8);
+    entry[7] = (uint8_t)(last_used >> 16);
+    entry[8] = (uint8_t)(last_used >> 24);
+}
+
+// Apply one logged use on top of the record just loaded; false if it does not belong to a current record
+static bool apply_usage_entry(const uint8_t* entry)
+{
+    uint8_t slot = entry[0];
+
+    if (slot >= CONFIG_MAX_AP_COUNT || !slot_in_use(slot)) {
+        return false;
+    }
+    ap_records_meta_t* meta = &record_meta[slot];
+
+    uint16_t check = entry[1] | ((uint16_t)entry[2] << 8);
+    uint16_t use_count = entry[3] | ((uint16_t)entry[4] << 8);
+    uint32_t last_used = entry[5] | ((uint32_t)entry[6] << 8) | ((uint32_t)entry[7] << 16) | ((uint32_t)entry[8] << 24);
+
+    if (usage_check(slot) != check) {
+        return false;
+    }
+
+    // Entries older than the saved record are ignored
+    int32_t newer = (int32_t)(last_used - meta->last_used);
+    if (newer > 0 || (newer == 0 && use_count > meta->use_count)) {
+        SHARED_STORE(meta->use_count, use_count);
+        SHARED_STORE(meta->last_used, last_used);
+    }
+    return true;
+}
+
+/**
+ * Apply the logged uses on top of the records just loaded. Stored entries
+ * keep their position, so the next append goes after the last one and the
+ * next save erases them all; entries that do not apply stay as placeholders.
+ * All entries are read before any is applied, in one write section.
+ */
+static void replay_usage_log(void)
+{
+    int applied = 0;
+
+    for (int e = 0; e < CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES; e++) {
+        blob_storage_handle_t handle;
+        if (open_usage_handle(e, &handle) != ESP_OK) {
+            break;
+        }
+
+        uint8_t* entry = &usage_log[e * AP_RECORDS_USAGE_ENTRY_SIZE];
+        size_t size = AP_RECORDS_USAGE_ENTRY_SIZE;
+        esp_err_t ret = blob_storage_read(&handle, entry, &size);
+        blob_storage_close_handle(&handle);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            entry[0] = AP_RECORDS_NO_SLOT;      // A gap left by a fold that was cut short
+            continue;
+        }
+
+        usage_log_count = (uint8_t)(e + 1);
+        if (ret != ESP_OK || size != AP_RECORDS_USAGE_ENTRY_SIZE) {
+            entry[0] = AP_RECORDS_NO_SLOT;
+        }
+    }
+
+    begin_write();
+    for (int e = 0; e < usage_log_count; e++) {
+        uint8_t* entry = &usage_log[e * AP_RECORDS_USAGE_ENTRY_SIZE];
+        if (entry[0] == AP_RECORDS_NO_SLOT) {
+            continue;
+        }
+        if (apply_usage_entry(entry)) {
+            applied++;
+        } else {
+            entry[0] = AP_RECORDS_NO_SLOT;
+        }
+    }
+    sync_use_clock(true);
+    end_write();
+
+    ESP_LOGD(TAG, "Applied %d of %d AP usage log entries", applied, usage_log_count);
+}
+
+/**
+ * Store entry index of the usage log. With the storage task the write is
+ * queued like a save: behind any save queued before, which may still have to
+ * erase the old log, and without waiting for flash.
+ */
+static esp_err_t store_usage_entry(int index)
+{
+    const uint8_t* entry = &usage_log[index * AP_RECORDS_USAGE_ENTRY_SIZE];
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    if (storage_queue) {
+        ap_records_save_request_t* request = calloc(1, sizeof(ap_records_save_request_t));
+        if (!request) {
+            return ESP_ERR_NO_MEM;
+        }
+        request->usage_append = (int8_t)index;
+        memcpy(request->usage_entry, entry, AP_RECORDS_USAGE_ENTRY_SIZE);
+
+        if (xQueueSend(storage_queue, &request, 0) != pdTRUE) {
+            free(request);
+            ESP_LOGW(TAG, "AP record storage queue full");
+            return ESP_ERR_TIMEOUT;
+        }
+        return ESP_OK;
+    }
+#endif
+
+    return write_usage_entry(index, entry);
+}
+
+// Append the current use count and time of a record to the usage log
+static esp_err_t log_usage(uint8_t slot)
+{
+    esp_err_t ret;
+
+    // A full log is folded into the records first; the storage task writes that save before the append
+    if (usage_log_count == CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES) {
+        ret = ap_records_save_async(NULL, NULL);
+        if (ret != ESP_OK) {
+            mark_record_dirty(slot);
+            return ret;
+        }
+    }
+
+    put_usage_entry(usage_log_count, slot, record_meta[slot].use_count, record_meta[slot].last_used);
+    ret = store_usage_entry(usage_log_count);
+    if (ret != ESP_OK) {
+        // Persist it with the record on the next save instead
+        mark_record_dirty(slot);
+        return ret;
+    }
+
+    usage_log_count++;
+    return ESP_OK;
+}
+
+esp_err_t ap_records_init(void)
+{
+    if (is_initialized) {
+        ESP_LOGD(TAG, "AP records already initialized");
+        return ESP_OK;
+    }
+
+    // Clear the record list
+    SHARED_STORE(record_count, 0);
+    reset_free_slots();
+
+    if (!records_lock) {
+        records_lock = xSemaphoreCreateRecursiveMutex();
+        if (!records_lock) {
+            ESP_LOGE(TAG, "Failed to create records lock");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    
+    // Initialize blob storage system
+    esp_err_t ret = blob_storage_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize blob storage: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    // Create the storage handle for the record index; record and usage log handles are opened per access
+    ret = blob_storage_create_handle_ex(&index_handle,
+                                      AP_RECORDS_NAMESPACE,
+                                      AP_RECORDS_INDEX_KEY,
+                                      sizeof(ap_records_index_t),
+                                      AP_RECORDS_STORAGE_FLAGS);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create storage handle: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    start_storage_task();
+#endif
+
+#ifdef CONFIG_AP_RECORDS_CATALOG
+    ap_catalog_open();      // Optional, logs why if there is none
+#endif
+
+    is_initialized = true;
+    ESP_LOGI(TAG, "AP records manager initialized");
+    
+    // Automatically try to load existing data
+    ret = ap_records_load();
+    if (ret == ESP_ERR_NOT_FOUND) {
+        
+        ESP_LOGI(TAG, "No existing AP records found, starting fresh");
+        
+        return ret;
+    } else if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to load AP records: %s", esp_err_to_name(ret));
+    }
+    
+    return ESP_OK;
+}
+
+static esp_err_t ap_records_load_locked(void)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    wait_for_storage_task();
+
+    // Start from a clean slate, anything not saved yet is dropped
+    begin_write();
+    SHARED_STORE(record_count, 0);
+    shared_zero(record_meta, sizeof(record_meta));
+    shared_zero(record_state, sizeof(record_state));
+    shared_zero(record_cache, sizeof(record_cache));
+    reset_free_slots();
+    lookup_rebuild();
+    rank_rebuild();
+    use_clock = 0;
+    memset(dirty_slots, 0, sizeof(dirty_slots));
+    memset(stats_slots, 0, sizeof(stats_slots));
+    memset(stale_slots, 0, sizeof(stale_slots));
+    index_dirty = false;
+    __atomic_store_n(&save_failed, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&usage_append_failed, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&save_unconfirmed, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&save_seq_done, save_seq_taken, __ATOMIC_RELEASE);
+    usage_log_count = 0;
+    end_write();
+    
+    ap_records_index_t index = {0};
+    size_t size = sizeof(index);
+    esp_err_t ret = blob_storage_read(&index_handle, &index, &size);
+    
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = migrate_legacy_blob();
+        if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGD(TAG, "No AP records found in storage");
+        }
+        return ret;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read AP records: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    // Validate loaded index
+    if (size < AP_RECORDS_INDEX_HEADER_SIZE || index.version != AP_RECORDS_INDEX_VERSION ||
+        size != AP_RECORDS_INDEX_HEADER_SIZE + (size_t)index.count) {
+        ESP_LOGW(TAG, "Invalid AP record index in storage, resetting");
+        index_dirty = true;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Slots in range keep their keys; out of range ones (CONFIG_MAX_AP_COUNT shrank) are re-homed after
+    uint8_t seen[AP_RECORDS_ALL_SLOTS_BITMAP_SIZE] = {0};
+    uint8_t orphans[AP_RECORDS_ALL_SLOTS_BITMAP_SIZE] = {0};
+    bool have_orphans = false;
+
+    // Records are read one at a time and each placed in a write section of its own
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < index.count; i++) {
+            int slot = index.slots[i];
+            bool in_range = slot < CONFIG_MAX_AP_COUNT;
+
+            if (in_range != (pass == 0)) {
+                continue;
+            }
+
+            if (test_slot_bit(seen, slot)) {
+                ESP_LOGW(TAG, "Duplicate slot %d in AP record index, dropping it", slot);
+                index_dirty = true;
+                continue;
+            }
+            set_slot_bit(seen, slot);
+
+            ap_info_t info;
+            ap_records_stats_t stats;
+            ret = read_record(slot, &info, &stats);
+
+            if (!in_range) {
+                set_slot_bit(orphans, slot);
+                have_orphans = true;
+            }
+
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "AP record in slot %d unreadable (%s), dropping it", slot, esp_err_to_name(ret));
+                if (in_range) {
+                    set_slot_bit(stale_slots, slot);
+                }
+                index_dirty = true;
+                continue;
+            }
+
+            int position;
+            ret = adopt_record(&info, in_range ? slot : -1, &position);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to re-home AP record in slot %d: %s", slot, esp_err_to_name(ret));
+                return ret;
+            }
+            if (position < 0) {
+                if (in_range) {
+                    set_slot_bit(stale_slots, slot);
+                }
+                index_dirty = true;
+                continue;
+            }
+
+            record_stats[record_order[position]] = stats;
+        }
+    }
+
+    replay_usage_log();
+    ESP_LOGI(TAG, "Loaded %d AP records from storage", record_count);
+
+    // Write back what could not stay as stored: dropped and duplicate entries, re-homed records
+    bool rewrite = index_dirty;
+    for (int i = 0; i < AP_RECORDS_BITMAP_SIZE && !rewrite; i++) {
+        rewrite = dirty_slots[i] != 0;
+    }
+
+    if (rewrite) {
+        ret = ap_records_save();
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to rewrite AP records: %s", esp_err_to_name(ret));
+            return ESP_OK;
+        }
+        if (have_orphans) {
+            erase_slots(orphans);
+        }
+        ESP_LOGI(TAG, "Rewrote the stored AP record index");
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ap_records_load(void)
+{
+    lock_records();
+    esp_err_t ret = ap_records_load_locked();
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_save_locked(void)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    wait_for_storage_task();
+
+    if (!has_pending_changes()) {
+        ESP_LOGD(TAG, "No AP records changed since last save");
+        return ESP_OK;
+    }
+
+    ap_records_save_request_t* request = take_save_snapshot();
+    if (!request) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = write_save_snapshot(request);
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "Saved %d of %d AP records to storage", request->record_count, record_count);
+    }
+
+    free(request);
+    return ret;
+}
+
+esp_err_t ap_records_save(void)
+{
+    lock_records();
+    esp_err_t ret = ap_records_save_locked();
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_save_async_locked(ap_records_save_cb_t callback, void* arg)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    if (storage_queue) {
+        // Leave the changes pending rather than dropping them when the queue is full
+        if (uxQueueSpacesAvailable(storage_queue) == 0) {
+            ESP_LOGW(TAG, "AP record storage queue full");
+            return ESP_ERR_TIMEOUT;
+        }
+
+        ap_records_save_request_t* request = take_save_snapshot();
+        if (!request) {
+            return ESP_ERR_NO_MEM;
+        }
+        request->callback = callback;
+        request->callback_arg = arg;
+
+        if (xQueueSend(storage_queue, &request, 0) != pdTRUE) {
+            // A flush barrier took the last entry; the snapshot is gone, so redo it next time
+            free(request);
+            __atomic_store_n(&save_failed, true, __ATOMIC_RELEASE);
+            ESP_LOGW(TAG, "AP record storage queue full");
+            return ESP_ERR_TIMEOUT;
+        }
+        return ESP_OK;
+    }
+#endif
+
+    esp_err_t ret = ap_records_save();
+    if (callback) {
+        callback(ret, arg);
+    }
+    return ret;
+}
+
+esp_err_t ap_records_save_async(ap_records_save_cb_t callback, void* arg)
+{
+    lock_records();
+    esp_err_t ret = ap_records_save_async_locked(callback, arg);
+    unlock_records();
+    return ret;
+}
+
+esp_err_t ap_records_flush(uint32_t timeout_ms)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    if (!storage_queue) {
+        return ESP_OK;
+    }
+
+    TickType_t timeout = (timeout_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    TickType_t start = xTaskGetTickCount();
+
+    if (xSemaphoreTake(flush_lock, timeout) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    ap_records_save_request_t* barrier = NULL;
+    if (xQueueSend(storage_queue, &barrier, timeout) != pdTRUE) {
+        xSemaphoreGive(flush_lock);
+        return ESP_ERR_TIMEOUT;
+    }
+    uint32_t target = ++barriers_posted;
+
+    // Barriers complete in order; a give left over from an earlier timed out flush only costs a loop
+    esp_err_t ret = ESP_OK;
+    while ((int32_t)(__atomic_load_n(&barriers_done, __ATOMIC_ACQUIRE) - target) < 0) {
+        TickType_t remaining = portMAX_DELAY;
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout) {
+                ret = ESP_ERR_TIMEOUT;
+                break;
+            }
+            remaining = timeout - elapsed;
+        }
+        if (xSemaphoreTake(barrier_done_sem, remaining) != pdTRUE &&
+            (int32_t)(__atomic_load_n(&barriers_done, __ATOMIC_ACQUIRE) - target) < 0) {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+    }
+
+    xSemaphoreGive(flush_lock);
+    return ret;
+#else
+    (void)timeout_ms;
+    return ESP_OK;
+#endif
+}
 
-// Static instance - only this component manages it
-static ap_record_t ap_records = {0};
-static bool is_initialized = false;
-static blob_storage_handle_t storage_handle = {0};
+static esp_err_t ap_records_set_all_locked(const ap_record_t* records)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-esp_err_t ap_records_init(void)
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!records) {
+        ESP_LOGE(TAG, "Invalid records pointer");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Validate record count
+    int count = records->available_records;
+    if (count > CONFIG_MAX_AP_COUNT) {
+        ESP_LOGE(TAG, "Invalid record count: %d (max: %d)", count, CONFIG_MAX_AP_COUNT);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Release the slots of the current records before adopting the new ones
+    begin_write();
+    remove_all();
+    end_write();
+
+    // Adopting may save the records adopted so far to make room in the cache, one write section each
+    for (int i = 0; i < count; i++) {
+        ap_info_t info = records->ap_list[i];
+        info.ssid[AP_RECORDS_SSID_MAX_LEN] = '\0';
+        info.password[AP_RECORDS_PASSWORD_MAX_LEN] = '\0';
+        int position;
+        esp_err_t ret = adopt_record(&info, -1, &position);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (position < 0) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    ESP_LOGD(TAG, "Set %d AP records", record_count);
+    return ESP_OK;
+}
+
+esp_err_t ap_records_set_all(const ap_record_t* records)
 {
-    if (is_initialized) {
-        ESP_LOGD(TAG, "AP records already initialized");
-        return ESP_OK;
+    lock_records();
+    esp_err_t ret = ap_records_set_all_locked(records);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_get_all_locked(ap_record_t* records)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // Clear the structure
-    memset(&ap_records, 0, sizeof(ap_record_t));
-    
-    // Initialize blob storage system
-    esp_err_t ret = blob_storage_init();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize blob storage: %s", esp_err_to_name(ret));
+    if (!records) {
+        ESP_LOGE(TAG, "Invalid records pointer");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(records, 0, sizeof(ap_record_t));
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        esp_err_t ret = fetch_record(slot, &records->ap_list[i]);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        fill_info(slot, &records->ap_list[i]);
+    }
+    records->available_records = (uint8_t)record_count;
+    return ESP_OK;
+}
+
+esp_err_t ap_records_get_all(ap_record_t* records)
+{
+    lock_records();
+    esp_err_t ret = ap_records_get_all_locked(records);
+    unlock_records();
+    return ret;
+}
+
+static const ap_record_t* ap_records_get_readonly_locked(void)
+{
+    if (!is_initialized) {
+        return NULL;
+    }
+
+    if (!readonly_records) {
+        readonly_records = malloc(sizeof(ap_record_t));
+        if (!readonly_records) {
+            return NULL;
+        }
+    }
+
+    if (ap_records_get_all(readonly_records) != ESP_OK) {
+        return NULL;
+    }
+    return readonly_records;
+}
+
+const ap_record_t* ap_records_get_readonly(void)
+{
+    lock_records();
+    const ap_record_t* records = ap_records_get_readonly_locked();
+    unlock_records();
+    return records;
+}
+
+static esp_err_t ap_records_add_locked(const char* ssid, const char* password, const uint8_t* bssid)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!ssid || !password) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGI(TAG,"SSID %s, pass %s",ssid,password);
+    if (strlen(ssid) > AP_RECORDS_SSID_MAX_LEN ||
+        strlen(password) > AP_RECORDS_PASSWORD_MAX_LEN) {
+        ESP_LOGE(TAG, "SSID or password too long");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Check if SSID already exists
+    uint8_t slot;
+    ap_info_t info = {0};
+    ap_records_cache_entry_t* entry;
+    esp_err_t ret = lookup_ssid(ssid, &slot, &info);
+    if (ret == ESP_OK) {
+        ap_records_meta_t* meta = &record_meta[slot];
+        bool unchanged = strcmp((char*)info.password, password) == 0 &&
+                         (!bssid || memcmp(meta->bssid, bssid, 6) == 0);
+        memset(info.password, 0, sizeof(info.password));
+
+        // Re-provisioning identical credentials is not a change, keep the stored blob as is
+        if (unchanged) {
+            ESP_LOGI(TAG, "AP record unchanged: %s", ssid);
+            return ESP_OK;
+        }
+
+        // The new content lives in the cache until it is saved, room there may save pending changes
+        entry = cache_find(slot);
+        if (!entry) {
+            ret = cache_claim(&entry);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+
+        // Update existing record
+        begin_write();
+        if (!entry->valid) {
+            cache_assign(entry, slot);
+        }
+        set_record_content(entry, ssid, password);
+        
+        if (bssid) {
+            lookup_remove(slot);
+            shared_copy(meta->bssid, bssid, 6);
+            lookup_insert(slot);
+        }
+        record_use(slot);
+        mark_record_dirty(slot);
+        end_write();
+        
+        ESP_LOGI(TAG, "Updated existing AP record: %s", ssid);
+        return ESP_OK;
+    } else if (ret != ESP_ERR_NOT_FOUND) {
         return ret;
     }
-    
-    // Create storage handle for AP records
-    ret = blob_storage_create_handle(&storage_handle, 
-                                   AP_RECORDS_NAMESPACE, 
-                                   AP_RECORDS_KEY, 
-                                   sizeof(ap_record_t));
+
+    memset(&info, 0, sizeof(info));
+    strcpy((char*)info.ssid, ssid);
+    strcpy((char*)info.password, password);
+    if (bssid) {
+        memcpy(info.bssid, bssid, 6);
+    }
+    info.use_count = 1;
+        
+    // Room in the cache first, taking it may save pending changes
+    ret = cache_claim(&entry);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to create storage handle: %s", esp_err_to_name(ret));
         return ret;
     }
-    
-    is_initialized = true;
-    ESP_LOGI(TAG, "AP records manager initialized");
-    
-    // Automatically try to load existing data
-    ret = ap_records_load();
-    if (ret == ESP_ERR_NOT_FOUND) {
         
-        ESP_LOGI(TAG, "No existing AP records found, starting fresh");
+    begin_write();
+    info.last_used = ++use_clock;
+    if (record_count < CONFIG_MAX_AP_COUNT) {
+        // Add to available slot
+        slot = alloc_slot();
+        place_record(slot, &info);
+        index_dirty = true;
+        
+        ESP_LOGI(TAG, "Added new AP record: %s (total: %d)", ssid, record_count);
+    } else {
+        // Replace the lowest ranked record; it keeps its slot and list position
+        slot = record_order[find_least_used()];
+        ap_records_meta_t* meta = &record_meta[slot];
         
+        ESP_LOGI(TAG, "Replacing least used AP in slot %d (use count: %u, last used: %" PRIu32 ") with: %s",
+                 slot, meta->use_count, meta->last_used, ssid);
+        lookup_remove(slot);
+        cache_drop(slot);
+        rank_unlink(slot);
+        
+        meta->ssid_hash = ssid_hash(ssid);
+        shared_copy(meta->bssid, info.bssid, 6);
+        SHARED_STORE(meta->use_count, info.use_count);
+        SHARED_STORE(meta->last_used, info.last_used);
+        memset(&record_stats[slot], 0, sizeof(record_stats[slot]));
+        rank_link(slot);
+    }
+        
+    cache_assign(entry, slot);
+    set_record_content(entry, ssid, password);
+    mark_record_dirty(slot);
+    lookup_insert(slot);
+    end_write();
+
+    return ESP_OK;
+}
+
+esp_err_t ap_records_add(const char* ssid, const char* password, const uint8_t* bssid)
+{
+    lock_records();
+    esp_err_t ret = ap_records_add_locked(ssid, password, bssid);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_get_locked(int index, ap_info_t* ap_info)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!ap_info || index < 0 || index >= record_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t slot = record_order[index];
+    esp_err_t ret = fetch_record(slot, ap_info);
+    if (ret != ESP_OK) {
         return ret;
-    } else if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to load AP records: %s", esp_err_to_name(ret));
     }
-    
+
+    fill_info(slot, ap_info);
     return ESP_OK;
 }
 
-esp_err_t ap_records_load(void)
+esp_err_t ap_records_get(int index, ap_info_t* ap_info)
+{
+    lock_records();
+    esp_err_t ret = ap_records_get_locked(index, ap_info);
+    unlock_records();
+    return ret;
+}
+
+// One lock-free copy of a record; false if it raced with a writer and *ret is not the result
+static bool peek_once(int index, ap_info_t* ap_info, esp_err_t* ret)
+{
+    uint32_t seq = read_begin();
+    if (seq & 1) {
+        return false;
+    }
+
+    if (index >= SHARED_LOAD(record_count)) {
+        *ret = ESP_ERR_INVALID_ARG;
+        return read_valid(seq);
+    }
+
+    uint8_t slot = SHARED_LOAD(record_order[index]);
+
+    /*
+     * Unsaved content is only in the cache; anything not cached is on flash as
+     * is and read from NVS right here, outside records_lock. NVS serializes the
+     * read with the writers' saves, and a save that rewrote the slot meanwhile
+     * also changed records_seq, so the copy is retried.
+     */
+    const ap_records_cache_entry_t* entry = cache_peek(slot);
+    if (entry) {
+        shared_copy(ap_info->ssid, entry->ssid, sizeof(ap_info->ssid));
+        shared_copy(ap_info->password, entry->password, sizeof(ap_info->password));
+    } else {
+        *ret = read_record(slot, ap_info, NULL);
+        if (*ret != ESP_OK) {
+            return read_valid(seq);
+        }
+    }
+    shared_copy(ap_info->bssid, record_meta[slot].bssid, sizeof(ap_info->bssid));
+    ap_info->use_count = SHARED_LOAD(record_meta[slot].use_count);
+    ap_info->last_used = SHARED_LOAD(record_meta[slot].last_used);
+
+    *ret = ESP_OK;
+    return read_valid(seq);
+}
+
+esp_err_t ap_records_peek(int index, ap_info_t* ap_info)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
-    
-    size_t size = sizeof(ap_record_t);
-    esp_err_t ret = blob_storage_read(&storage_handle, &ap_records, &size);
-    
-    if (ret == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGD(TAG, "No AP records found in storage");
-        // Initialize with empty records
-        memset(&ap_records, 0, sizeof(ap_record_t));
-        return ESP_ERR_NOT_FOUND;
-    } else if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read AP records: %s", esp_err_to_name(ret));
+
+    if (!ap_info || index < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (int attempt = 1; !peek_once(index, ap_info, &ret); attempt++) {
+        if (attempt >= AP_RECORDS_PEEK_ATTEMPTS) {
+            if (reader_may_lock()) {
+                // Writers kept racing the copy: wait for them, nothing changes while the lock is held
+                lock_records();
+                peek_once(index, ap_info, &ret);
+                unlock_records();
+                break;
+            }
+            vTaskDelay(1);
+        }
+    }
+    return ret;
+}
+
+int ap_records_get_count(void)
+{
+    if (!is_initialized) {
+        return -1;
+    }
+    return __atomic_load_n(&record_count, __ATOMIC_RELAXED);
+}
+
+static esp_err_t ap_records_find_by_ssid_locked(const char* ssid, ap_info_t* ap_info, int* index)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!ssid) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t slot;
+    esp_err_t ret = lookup_ssid(ssid, &slot, ap_info);
+    if (ret != ESP_OK) {
         return ret;
     }
-    
-    // Validate loaded data
-    if (size != sizeof(ap_record_t)) {
-        ESP_LOGW(TAG, "Size mismatch in stored data, resetting");
-        memset(&ap_records, 0, sizeof(ap_record_t));
-        return ESP_ERR_INVALID_SIZE;
+
+    if (ap_info) {
+        fill_info(slot, ap_info);
+    }
+    if (index) {
+        *index = record_state[slot].position;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ap_records_find_by_ssid(const char* ssid, ap_info_t* ap_info, int* index)
+{
+    lock_records();
+    esp_err_t ret = ap_records_find_by_ssid_locked(ssid, ap_info, index);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_find_by_bssid_locked(const uint8_t* bssid, ap_info_t* ap_info, int* index)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!bssid) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int i = lookup_bssid(bssid);
+    if (i < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (ap_info) {
+        esp_err_t ret = ap_records_get(i, ap_info);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    if (index) {
+        *index = i;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ap_records_find_by_bssid(const uint8_t* bssid, ap_info_t* ap_info, int* index)
+{
+    lock_records();
+    esp_err_t ret = ap_records_find_by_bssid_locked(bssid, ap_info, index);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_for_each_locked(uint32_t fields, ap_records_visitor_t visitor, void* arg)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!visitor) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool want_content = fields & (AP_RECORDS_FIELD_SSID | AP_RECORDS_FIELD_PASSWORD);
+    ap_info_t scratch;          // Uncached records are read here instead of through the cache
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        ap_records_view_t view = {
+            .index = i,
+            .bssid = record_meta[slot].bssid,
+            .use_count = record_meta[slot].use_count,
+            .last_used = record_meta[slot].last_used,
+            .stats = &record_stats[slot],
+        };
+
+        if (want_content) {
+            const uint8_t* ssid;
+            const uint8_t* password;
+            const ap_records_cache_entry_t* entry = cache_find(slot);
+            if (entry) {
+                ssid = entry->ssid;
+                password = entry->password;
+            } else {
+                ret = read_record(slot, &scratch, NULL);
+                if (ret != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to read AP record in slot %d: %s", slot, esp_err_to_name(ret));
+                    break;
+                }
+                ssid = scratch.ssid;
+                password = scratch.password;
+            }
+            if (fields & AP_RECORDS_FIELD_SSID) {
+                view.ssid = (const char*)ssid;
+            }
+            if (fields & AP_RECORDS_FIELD_PASSWORD) {
+                view.password = (const char*)password;
+            }
+        }
+
+        walking = true;
+        bool more = visitor(&view, arg);
+        walking = false;
+        if (!more) {
+            break;
+        }
+    }
+
+    if (want_content) {
+        memset(scratch.password, 0, sizeof(scratch.password));
     }
-    
-    if (ap_records.available_records > CONFIG_MAX_AP_COUNT) {
-        ESP_LOGW(TAG, "Invalid record count in stored data, resetting");
-        memset(&ap_records, 0, sizeof(ap_record_t));
+    return ret;
+}
+
+esp_err_t ap_records_for_each(uint32_t fields, ap_records_visitor_t visitor, void* arg)
+{
+    lock_records();
+    esp_err_t ret = ap_records_for_each_locked(fields, visitor, arg);
+    unlock_records();
+    return ret;
+}
+
+// Copies a null-terminated string field, failing rather than truncating it
+static esp_err_t copy_string_field(const uint8_t* str, size_t max_len, void* out, size_t* size)
+{
+    size_t len = strnlen((const char*)str, max_len - 1) + 1;
+    if (*size < len) {
+        *size = len;
         return ESP_ERR_INVALID_SIZE;
     }
-    
-    ESP_LOGI(TAG, "Loaded %d AP records from storage", ap_records.available_records);
+    memcpy(out, str, len - 1);
+    ((char*)out)[len - 1] = '\0';
+    *size = len;
     return ESP_OK;
 }
 
-esp_err_t ap_records_save(void)
+static esp_err_t copy_field(const void* field, size_t len, void* out, size_t* size)
 {
-    if (!is_initialized) {
-        ESP_LOGE(TAG, "AP records not initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-    
-    esp_err_t ret = blob_storage_write(&storage_handle, &ap_records, sizeof(ap_record_t));
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save AP records: %s", esp_err_to_name(ret));
-        return ret;
+    if (*size < len) {
+        *size = len;
+        return ESP_ERR_INVALID_SIZE;
     }
-    
-    ESP_LOGD(TAG, "Saved %d AP records to storage", ap_records.available_records);
+    memcpy(out, field, len);
+    *size = len;
     return ESP_OK;
 }
 
-esp_err_t ap_records_set_all(const ap_record_t* records)
+static esp_err_t ap_records_get_field_locked(int index, ap_records_field_t field, void* out, size_t* size)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!records) {
-        ESP_LOGE(TAG, "Invalid records pointer");
+    if (!out || !size || index < 0 || index >= record_count) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    // Validate record count
-    if (records->available_records > CONFIG_MAX_AP_COUNT) {
-        ESP_LOGE(TAG, "Invalid record count: %d (max: %d)", records->available_records, CONFIG_MAX_AP_COUNT);
+    uint8_t slot = record_order[index];
+    switch (field) {
+    case AP_RECORDS_FIELD_SSID:
+    case AP_RECORDS_FIELD_PASSWORD: {
+        ap_info_t info;
+        esp_err_t ret = fetch_record(slot, &info);
+        if (ret == ESP_OK) {
+            ret = (field == AP_RECORDS_FIELD_SSID)
+                      ? copy_string_field(info.ssid, sizeof(info.ssid), out, size)
+                      : copy_string_field(info.password, sizeof(info.password), out, size);
+        }
+        memset(info.password, 0, sizeof(info.password));
+        return ret;
+    }
+    case AP_RECORDS_FIELD_BSSID:
+        return copy_field(record_meta[slot].bssid, sizeof(record_meta[slot].bssid), out, size);
+    case AP_RECORDS_FIELD_USE_COUNT:
+        return copy_field(&record_meta[slot].use_count, sizeof(record_meta[slot].use_count), out, size);
+    case AP_RECORDS_FIELD_LAST_USED:
+        return copy_field(&record_meta[slot].last_used, sizeof(record_meta[slot].last_used), out, size);
+    case AP_RECORDS_FIELD_STATS:
+        return copy_field(&record_stats[slot], sizeof(record_stats[slot]), out, size);
+    default:
         return ESP_ERR_INVALID_ARG;
     }
+}
 
-    memcpy(&ap_records, records, sizeof(ap_record_t));
-    ESP_LOGD(TAG, "Set %d AP records", ap_records.available_records);
-    return ESP_OK;
+esp_err_t ap_records_get_field(int index, ap_records_field_t field, void* out, size_t* size)
+{
+    lock_records();
+    esp_err_t ret = ap_records_get_field_locked(index, field, out, size);
+    unlock_records();
+    return ret;
 }
 
-esp_err_t ap_records_get_all(ap_record_t* records)
+/**
+ * Score a scan result against its record, higher is better. Returns false if
+ * the record cannot work with that AP at all.
+ */
+static bool score_candidate(const wifi_ap_record_t* ap, bool has_password, const uint8_t* bssid,
+                            uint16_t use_count, const ap_records_stats_t* stats, int16_t* score)
 {
-    if (!is_initialized) {
-        ESP_LOGE(TAG, "AP records not initialized");
-        return ESP_ERR_INVALID_STATE;
+    if (ap->authmode != WIFI_AUTH_OPEN && !has_password) {
+        return false;
     }
 
-    if (!records) {
-        ESP_LOGE(TAG, "Invalid records pointer");
-        return ESP_ERR_INVALID_ARG;
+    int rssi = ap->rssi + 100;
+    int value = (rssi < 0) ? 0 : (rssi > 100) ? 100 : rssi;
+
+    if (memcmp(bssid, ap->bssid, 6) == 0) {
+        value += AP_RECORDS_SCORE_KNOWN_BSSID;
     }
+    value += (31 - __builtin_clz((uint32_t)use_count + 1)) * AP_RECORDS_SCORE_PER_DOUBLING;
 
-    memcpy(records, &ap_records, sizeof(ap_record_t));
-    return ESP_OK;
-}
+    // History: prefer APs that connected quickly and rarely failed
+    if (stats->success_count) {
+        int fast = AP_RECORDS_SCORE_FAST_CONNECT - stats->avg_connect_ms / AP_RECORDS_SCORE_CONNECT_MS_STEP;
+        value += (fast > 0) ? fast : 0;
+    }
+    uint32_t attempts = (uint32_t)stats->success_count + stats->failure_count;
+    if (attempts) {
+        value -= (int)(AP_RECORDS_SCORE_FAILURES * stats->failure_count / attempts);
+    }
 
-const ap_record_t* ap_records_get_readonly(void)
-{
-    if (!is_initialized) {
-        return NULL;
+    switch (ap->authmode) {
+    case WIFI_AUTH_OPEN:
+        if (has_password) {
+            value -= AP_RECORDS_SCORE_OPEN_MISMATCH;
+        }
+        break;
+    case WIFI_AUTH_WPA2_PSK:
+    case WIFI_AUTH_WPA_WPA2_PSK:
+    case WIFI_AUTH_WPA3_PSK:
+    case WIFI_AUTH_WPA2_WPA3_PSK:
+        value += AP_RECORDS_SCORE_STRONG_AUTH;
+        break;
+    default:
+        break;
     }
-    return &ap_records;
+
+    *score = (int16_t)value;
+    return true;
 }
 
-esp_err_t ap_records_add(const char* ssid, const char* password, const uint8_t* bssid)
+static esp_err_t ap_records_match_scan_locked(const wifi_ap_record_t* scan, uint16_t scan_count,
+                                              ap_records_candidate_t* candidates, int* count)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!ssid || !password) {
-        ESP_LOGE(TAG, "Invalid parameters");
-        return ESP_ERR_INVALID_ARG;
-    }
-    ESP_LOGI(TAG,"SSID %s, pass %s",ssid,password);
-    if (strlen(ssid) >= sizeof(ap_records.ap_list[0].ssid) || 
-        strlen(password) >= sizeof(ap_records.ap_list[0].password)) {
-        ESP_LOGE(TAG, "SSID or password too long");
+    if ((!scan && scan_count) || !candidates || !count || *count < 0) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    // Check if SSID already exists
-    for (int i = 0; i < ap_records.available_records; i++) {
-        if (strcmp((char*)ap_records.ap_list[i].ssid, ssid) == 0) {
-            // Update existing record
-            strncpy((char*)ap_records.ap_list[i].password, password, sizeof(ap_records.ap_list[i].password) - 1);
-            ap_records.ap_list[i].password[sizeof(ap_records.ap_list[i].password) - 1] = '\0';
-            
-            if (bssid) {
-                memcpy(ap_records.ap_list[i].bssid, bssid, 6);
-            }
-            ap_records.ap_list[i].use_count++;
-            
-            ESP_LOGI(TAG, "Updated existing AP record: %s", ssid);
-            return ESP_OK;
+    // Candidates stay sorted by score while they are collected; the worst one drops out when full
+    int capacity = *count;
+    int found = 0;
+    for (int i = 0; i < scan_count; i++) {
+        const char* ssid = (const char*)scan[i].ssid;
+        if (ssid[0] == '\0' || strnlen(ssid, sizeof(scan[i].ssid)) > AP_RECORDS_SSID_MAX_LEN) {
+            continue;
         }
-    }
 
-    // Add new record
-    if (ap_records.available_records < CONFIG_MAX_AP_COUNT) {
-        // Add to available slot
-        int index = ap_records.available_records;
-        strncpy((char*)ap_records.ap_list[index].ssid, ssid, sizeof(ap_records.ap_list[index].ssid) - 1);
-        ap_records.ap_list[index].ssid[sizeof(ap_records.ap_list[index].ssid) - 1] = '\0';
-        
-        strncpy((char*)ap_records.ap_list[index].password, password, sizeof(ap_records.ap_list[index].password) - 1);
-        ap_records.ap_list[index].password[sizeof(ap_records.ap_list[index].password) - 1] = '\0';
-        
-        if (bssid) {
-            memcpy(ap_records.ap_list[index].bssid, bssid, 6);
+        uint8_t slot;
+        ap_info_t info;
+        uint8_t record_index;
+        uint16_t catalog_index = 0;
+        int16_t score;
+        esp_err_t ret = lookup_ssid(ssid, &slot, &info);
+        if (ret == ESP_OK) {
+            bool has_password = info.password[0] != '\0';
+            memset(info.password, 0, sizeof(info.password));
+
+            // Last seen only lives in RAM until the record is written for another reason
+            record_stats[slot].last_rssi = scan[i].rssi;
+            record_stats[slot].last_channel = scan[i].primary;
+
+            if (!score_candidate(&scan[i], has_password, record_meta[slot].bssid,
+                                 decayed_use_count(slot), &record_stats[slot], &score)) {
+                continue;
+            }
+            record_index = record_state[slot].position;
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+#ifdef CONFIG_AP_RECORDS_CATALOG
+            // Stored records shadow the catalog; a catalog entry scores like a record never used
+            static const ap_records_stats_t no_stats = {0};
+            ap_catalog_entry_t catalog_entry;
+            int index;
+            if (ap_catalog_find(ssid, &catalog_entry, &index) != ESP_OK ||
+                !score_candidate(&scan[i], catalog_entry.password[0] != '\0', catalog_entry.bssid, 0,
+                                 &no_stats, &score)) {
+                continue;
+            }
+            record_index = AP_RECORDS_CANDIDATE_CATALOG;
+            catalog_index = (uint16_t)index;
+#else
+            continue;
+#endif
         } else {
-            memset(ap_records.ap_list[index].bssid, 0, 6);
+            return ret;
         }
-        
-        ap_records.ap_list[index].use_count = 1;
-        ap_records.available_records++;
-        
-        ESP_LOGI(TAG, "Added new AP record: %s (total: %d)", ssid, ap_records.available_records);
-    } else {
-        // Find record with lowest use_count to replace
-        int min_use_index = 0;
-        for (int i = 1; i < CONFIG_MAX_AP_COUNT; i++) {
-            if (ap_records.ap_list[i].use_count < ap_records.ap_list[min_use_index].use_count) {
-                min_use_index = i;
+
+        int existing = -1;
+        for (int c = 0; c < found; c++) {
+            if (candidates[c].record_index == record_index && candidates[c].catalog_index == catalog_index) {
+                existing = c;
+                break;
             }
         }
-        
-        // Replace the least used record
-        ESP_LOGI(TAG, "Replacing least used AP: %s (use count: %d) with: %s", 
-                 ap_records.ap_list[min_use_index].ssid, ap_records.ap_list[min_use_index].use_count, ssid);
-        
-        strncpy((char*)ap_records.ap_list[min_use_index].ssid, ssid, sizeof(ap_records.ap_list[min_use_index].ssid) - 1);
-        ap_records.ap_list[min_use_index].ssid[sizeof(ap_records.ap_list[min_use_index].ssid) - 1] = '\0';
-        
-        strncpy((char*)ap_records.ap_list[min_use_index].password, password, sizeof(ap_records.ap_list[min_use_index].password) - 1);
-        ap_records.ap_list[min_use_index].password[sizeof(ap_records.ap_list[min_use_index].password) - 1] = '\0';
-        
-        if (bssid) {
-            memcpy(ap_records.ap_list[min_use_index].bssid, bssid, 6);
-        } else {
-            memset(ap_records.ap_list[min_use_index].bssid, 0, 6);
+        if (existing >= 0) {
+            if (candidates[existing].score >= score) {
+                continue;
+            }
+            memmove(&candidates[existing], &candidates[existing + 1], (found - existing - 1) * sizeof(candidates[0]));
+            found--;
+        }
+
+        int position = found;
+        while (position > 0 && candidates[position - 1].score < score) {
+            position--;
+        }
+        if (position >= capacity) {
+            continue;
+        }
+        int moved = ((found < capacity) ? found : capacity - 1) - position;
+        memmove(&candidates[position + 1], &candidates[position], moved * sizeof(candidates[0]));
+        candidates[position] = (ap_records_candidate_t){
+            .scan_index = (uint16_t)i,
+            .record_index = record_index,
+            .catalog_index = catalog_index,
+            .score = score,
+        };
+        if (found < capacity) {
+            found++;
         }
-        
-        ap_records.ap_list[min_use_index].use_count = 1;
     }
 
+    *count = found;
+    ESP_LOGD(TAG, "Matched %d of %d scan results to AP records", found, scan_count);
     return ESP_OK;
 }
 
-esp_err_t ap_records_get(int index, ap_info_t* ap_info)
+esp_err_t ap_records_match_scan(const wifi_ap_record_t* scan, uint16_t scan_count,
+                                ap_records_candidate_t* candidates, int* count)
+{
+    lock_records();
+    esp_err_t ret = ap_records_match_scan_locked(scan, scan_count, candidates, count);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_get_stats_locked(int index, ap_records_stats_t* stats)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!ap_info || index < 0 || index >= ap_records.available_records) {
+    if (!stats || index < 0 || index >= record_count) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    memcpy(ap_info, &ap_records.ap_list[index], sizeof(ap_info_t));
+    *stats = record_stats[record_order[index]];
     return ESP_OK;
 }
 
-int ap_records_get_count(void)
+esp_err_t ap_records_get_stats(int index, ap_records_stats_t* stats)
+{
+    lock_records();
+    esp_err_t ret = ap_records_get_stats_locked(index, stats);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_report_connected_locked(const char* ssid, uint32_t connect_ms)
 {
     if (!is_initialized) {
-        return -1;
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
     }
-    return ap_records.available_records;
+
+    if (!ssid) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t slot;
+    esp_err_t ret = lookup_ssid(ssid, &slot, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ap_records_stats_t* stats = &record_stats[slot];
+    uint16_t sample = (connect_ms < UINT16_MAX) ? (uint16_t)connect_ms : UINT16_MAX;
+    if (stats->success_count == 0) {
+        stats->avg_connect_ms = sample;
+    } else {
+        int32_t delta = ((int32_t)sample - stats->avg_connect_ms) / AP_RECORDS_CONNECT_MS_WEIGHT;
+        stats->avg_connect_ms = (uint16_t)(stats->avg_connect_ms + delta);
+    }
+    if (stats->success_count < UINT16_MAX) {
+        stats->success_count++;
+    }
+    stats->last_success = use_clock;
+    set_slot_bit(stats_slots, slot);
+
+    ESP_LOGD(TAG, "Connected to %s in %" PRIu32 " ms, average %u ms", ssid, connect_ms, stats->avg_connect_ms);
+    return ESP_OK;
 }
 
-esp_err_t ap_records_find_by_ssid(const char* ssid, ap_info_t* ap_info, int* index)
+esp_err_t ap_records_report_connected(const char* ssid, uint32_t connect_ms)
+{
+    lock_records();
+    esp_err_t ret = ap_records_report_connected_locked(ssid, connect_ms);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_report_disconnect_locked(const char* ssid, uint8_t reason, bool connect_failed)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
     if (!ssid) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    for (int i = 0; i < ap_records.available_records; i++) {
-        if (strcmp((char*)ap_records.ap_list[i].ssid, ssid) == 0) {
-            if (ap_info) {
-                memcpy(ap_info, &ap_records.ap_list[i], sizeof(ap_info_t));
-            }
-            if (index) {
-                *index = i;
-            }
-            return ESP_OK;
-        }
+    uint8_t slot;
+    esp_err_t ret = lookup_ssid(ssid, &slot, NULL);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
-    return ESP_ERR_NOT_FOUND;
+    ap_records_stats_t* stats = &record_stats[slot];
+    if (connect_failed && stats->failure_count < UINT16_MAX) {
+        stats->failure_count++;
+    }
+    stats->last_disconnect_reason = reason;
+    set_slot_bit(stats_slots, slot);
+    return ESP_OK;
 }
 
-esp_err_t ap_records_find_by_bssid(const uint8_t* bssid, ap_info_t* ap_info, int* index)
+esp_err_t ap_records_report_disconnect(const char* ssid, uint8_t reason, bool connect_failed)
+{
+    lock_records();
+    esp_err_t ret = ap_records_report_disconnect_locked(ssid, reason, connect_failed);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_increment_use_count_locked(const char* ssid)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!bssid) {
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!ssid) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    for (int i = 0; i < ap_records.available_records; i++) {
-        if (memcmp(ap_records.ap_list[i].bssid, bssid, 6) == 0) {
-            if (ap_info) {
-                memcpy(ap_info, &ap_records.ap_list[i], sizeof(ap_info_t));
-            }
-            if (index) {
-                *index = i;
-            }
-            return ESP_OK;
-        }
+    uint8_t slot;
+    esp_err_t ret = lookup_ssid(ssid, &slot, NULL);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
-    return ESP_ERR_NOT_FOUND;
+    begin_write();
+    record_use(slot);
+    end_write();
+    ESP_LOGD(TAG, "Incremented use count for %s to %u", ssid, record_meta[slot].use_count);
+    return log_usage(slot);
 }
 
 esp_err_t ap_records_increment_use_count(const char* ssid)
+{
+    lock_records();
+    esp_err_t ret = ap_records_increment_use_count_locked(ssid);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_remove_by_ssid_locked(const char* ssid)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
     if (!ssid) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    for (int i = 0; i < ap_records.available_records; i++) {
-        if (strcmp((char*)ap_records.ap_list[i].ssid, ssid) == 0) {
-            ap_records.ap_list[i].use_count++;
-            ESP_LOGD(TAG, "Incremented use count for %s to %d", ssid, ap_records.ap_list[i].use_count);
-            return ESP_OK;
-        }
+    uint8_t slot;
+    esp_err_t ret = lookup_ssid(ssid, &slot, NULL);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
-    return ESP_ERR_NOT_FOUND;
+    begin_write();
+    remove_at(record_state[slot].position);
+    end_write();
+
+    ESP_LOGI(TAG, "Removed AP record: %s (remaining: %d)", ssid, record_count);
+    return ESP_OK;
 }
 
 esp_err_t ap_records_remove_by_ssid(const char* ssid)
+{
+    lock_records();
+    esp_err_t ret = ap_records_remove_by_ssid_locked(ssid);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_remove_by_index_locked(int index)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!ssid) {
-        return ESP_ERR_INVALID_ARG;
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    for (int i = 0; i < ap_records.available_records; i++) {
-        if (strcmp((char*)ap_records.ap_list[i].ssid, ssid) == 0) {
-            // Shift remaining records
-            for (int j = i; j < ap_records.available_records - 1; j++) {
-                memcpy(&ap_records.ap_list[j], &ap_records.ap_list[j + 1], sizeof(ap_info_t));
-            }
-            ap_records.available_records--;
-            
-            // Clear the last record
-            memset(&ap_records.ap_list[ap_records.available_records], 0, sizeof(ap_info_t));
-            
-            ESP_LOGI(TAG, "Removed AP record: %s (remaining: %d)", ssid, ap_records.available_records);
-            return ESP_OK;
-        }
+    if (index < 0 || index >= record_count) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    return ESP_ERR_NOT_FOUND;
+    ESP_LOGI(TAG, "Removing AP record at index %d (slot %d)", index, record_order[index]);
+
+    begin_write();
+    remove_at(index);
+    end_write();
+
+    ESP_LOGI(TAG, "Removed AP record (remaining: %d)", record_count);
+    return ESP_OK;
 }
 
 esp_err_t ap_records_remove_by_index(int index)
+{
+    lock_records();
+    esp_err_t ret = ap_records_remove_by_index_locked(index);
+    unlock_records();
+    return ret;
+}
+
+static esp_err_t ap_records_clear_all_locked(void)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (index < 0 || index >= ap_records.available_records) {
-        return ESP_ERR_INVALID_ARG;
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    ESP_LOGI(TAG, "Removing AP record at index %d: %s", index, ap_records.ap_list[index].ssid);
+    begin_write();
+    remove_all();
+    index_dirty = true;
+    end_write();
 
-    // Shift remaining records
-    for (int i = index; i < ap_records.available_records - 1; i++) {
-        memcpy(&ap_records.ap_list[i], &ap_records.ap_list[i + 1], sizeof(ap_info_t));
-    }
-    ap_records.available_records--;
-    
-    // Clear the last record
-    memset(&ap_records.ap_list[ap_records.available_records], 0, sizeof(ap_info_t));
-    
-    ESP_LOGI(TAG, "Removed AP record (remaining: %d)", ap_records.available_records);
+    ESP_LOGI(TAG, "Cleared all AP records");
     return ESP_OK;
 }
 
 esp_err_t ap_records_clear_all(void)
+{
+    lock_records();
+    esp_err_t ret = ap_records_clear_all_locked();
+    unlock_records();
+    return ret;
+}
+
+// One lock-free walk of the eviction order; false if it raced with a writer and *count is unchanged
+static bool ranked_once(uint8_t* indices, int* count)
+{
+    uint32_t seq = read_begin();
+    if (seq & 1) {
+        return false;
+    }
+
+    int written = 0;
+    int limit = (*count < CONFIG_MAX_AP_COUNT) ? *count : CONFIG_MAX_AP_COUNT;
+    for (uint8_t slot = SHARED_LOAD(rank_tail); slot != AP_RECORDS_NO_SLOT && written < limit;
+         slot = SHARED_LOAD(record_state[slot].rank_prev)) {
+        indices[written++] = SHARED_LOAD(record_state[slot].position);
+    }
+
+    if (!read_valid(seq)) {
+        return false;
+    }
+    *count = written;
+    return true;
+}
+
+esp_err_t ap_records_get_ranked(uint8_t* indices, int* count)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    memset(&ap_records, 0, sizeof(ap_record_t));
-    ESP_LOGI(TAG, "Cleared all AP records");
+    if (!indices || !count || *count < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Lock-free: walk the rank list and start over if a writer changed it meanwhile
+    for (int attempt = 1; !ranked_once(indices, count); attempt++) {
+        if (attempt >= AP_RECORDS_PEEK_ATTEMPTS) {
+            if (reader_may_lock()) {
+                lock_records();
+                ranked_once(indices, count);
+                unlock_records();
+                break;
+            }
+            vTaskDelay(1);
+        }
+    }
     return ESP_OK;
 }
 
-esp_err_t ap_records_sort_by_usage(void)
+static esp_err_t ap_records_sort_by_usage_locked(void)
 {
     if (!is_initialized) {
         ESP_LOGE(TAG, "AP records not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (ap_records.available_records <= 1) {
+    if (in_walk()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (record_count <= 1) {
         return ESP_OK; // Nothing to sort
     }
 
-    // Simple bubble sort by use_count (descending order)
-    for (int i = 0; i < ap_records.available_records - 1; i++) {
-        for (int j = 0; j < ap_records.available_records - i - 1; j++) {
-            if (ap_records.ap_list[j].use_count < ap_records.ap_list[j + 1].use_count) {
-                // Swap records
-                ap_info_t temp;
-                memcpy(&temp, &ap_records.ap_list[j], sizeof(ap_info_t));
-                memcpy(&ap_records.ap_list[j], &ap_records.ap_list[j + 1], sizeof(ap_info_t));
-                memcpy(&ap_records.ap_list[j + 1], &temp, sizeof(ap_info_t));
-            }
+    // The rank list already holds the order, walk it from the most valuable end; only slot numbers move
+    int position = 0;
+    for (uint8_t slot = rank_tail; slot != AP_RECORDS_NO_SLOT; slot = record_state[slot].rank_prev) {
+        if (record_order[position] != slot) {
+            SHARED_STORE(record_order[position], slot);
+            index_dirty = true;
         }
+        SHARED_STORE(record_state[slot].position, (uint8_t)position++);
     }
 
     ESP_LOGD(TAG, "Sorted AP records by usage");
     return ESP_OK;
 }
 
+esp_err_t ap_records_sort_by_usage(void)
+{
+    begin_write();
+    esp_err_t ret = ap_records_sort_by_usage_locked();
+    end_write();
+    return ret;
+}
+
 size_t ap_records_get_size(void)
 {
     return sizeof(ap_record_t);
 }
 
-void ap_records_print_all(void)
+#define AP_RECORDS_CHECK(cond, fmt, ...) do { \
+        if (!(cond)) { \
+            ESP_LOGE(TAG, "Inconsistent AP records: " fmt, ##__VA_ARGS__); \
+            return ESP_ERR_INVALID_STATE; \
+        } \
+    } while (0)
+
+// Whether a lookup table reaches slot from the home bucket of hash
+static bool lookup_reaches(const uint8_t* table, uint32_t hash, int slot)
+{
+    uint32_t bucket = hash & AP_RECORDS_LOOKUP_MASK;
+    while (table[bucket]) {
+        if (table[bucket] == slot + 1) {
+            return true;
+        }
+        bucket = (bucket + 1) & AP_RECORDS_LOOKUP_MASK;
+    }
+    return false;
+}
+
+// SSID of a record without going through fetch_record(), which may fill the cache and reorder it
+static esp_err_t check_read_ssid(uint8_t slot, uint8_t* ssid)
+{
+    const ap_records_cache_entry_t* entry = cache_peek(slot);
+    if (entry) {
+        memcpy(ssid, entry->ssid, sizeof(entry->ssid));
+        return ESP_OK;
+    }
+    ap_info_t info;
+    esp_err_t ret = read_record(slot, &info, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    memcpy(ssid, info.ssid, sizeof(info.ssid));
+    memset(info.password, 0, sizeof(info.password));
+    return ESP_OK;
+}
+
+/**
+ * Check that the list, the free slots, the eviction order, the lookup tables
+ * and the record cache agree with each other. SSIDs are only read from NVS
+ * for records whose SSID hashes collide, to rule out duplicates. Nothing is
+ * changed, the cache LRU order included, so checking does not steer the
+ * workload it checks.
+ */
+static esp_err_t check_records(void)
+{
+    uint8_t seen[AP_RECORDS_BITMAP_SIZE] = {0};
+
+    AP_RECORDS_CHECK(record_count >= 0 && record_count <= CONFIG_MAX_AP_COUNT, "count %d", record_count);
+    AP_RECORDS_CHECK(record_count + free_slot_count == CONFIG_MAX_AP_COUNT, "%d records, %d free slots",
+                     record_count, free_slot_count);
+
+    int bssid_count = 0;
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        AP_RECORDS_CHECK(slot < CONFIG_MAX_AP_COUNT, "slot %d at position %d", slot, i);
+        AP_RECORDS_CHECK(!test_slot_bit(seen, slot), "slot %d listed twice", slot);
+        AP_RECORDS_CHECK(record_state[slot].position == i, "slot %d at position %d claims %d",
+                         slot, i, record_state[slot].position);
+        AP_RECORDS_CHECK((int32_t)(use_clock - record_meta[slot].last_used) >= 0,
+                         "slot %d used at %" PRIu32 ", clock %" PRIu32, slot, record_meta[slot].last_used, use_clock);
+        AP_RECORDS_CHECK(lookup_reaches(ssid_lookup, ssid_hash_at(slot), slot), "slot %d not in SSID lookup", slot);
+        if (bssid_is_set(record_meta[slot].bssid)) {
+            AP_RECORDS_CHECK(lookup_reaches(bssid_lookup, bssid_hash_at(slot), slot),
+                             "slot %d not in BSSID lookup", slot);
+            bssid_count++;
+        }
+        set_slot_bit(seen, slot);
+    }
+
+    for (int i = 0; i < free_slot_count; i++) {
+        uint8_t slot = free_slots[i];
+        AP_RECORDS_CHECK(slot < CONFIG_MAX_AP_COUNT && !test_slot_bit(seen, slot), "free slot %d in use", slot);
+        set_slot_bit(seen, slot);
+    }
+
+    int ssid_entries = 0;
+    int bssid_entries = 0;
+    for (int bucket = 0; bucket < AP_RECORDS_LOOKUP_SIZE; bucket++) {
+        ssid_entries += ssid_lookup[bucket] != 0;
+        bssid_entries += bssid_lookup[bucket] != 0;
+    }
+    AP_RECORDS_CHECK(ssid_entries == record_count, "%d SSID lookup entries", ssid_entries);
+    AP_RECORDS_CHECK(bssid_entries == bssid_count, "%d BSSID lookup entries, %d BSSIDs", bssid_entries, bssid_count);
+
+    // The eviction order links every record once, lowest rank first
+    int linked = 0;
+    uint8_t prev = AP_RECORDS_NO_SLOT;
+    for (uint8_t slot = rank_head; slot != AP_RECORDS_NO_SLOT; slot = record_state[slot].rank_next) {
+        AP_RECORDS_CHECK(linked < record_count && slot_in_use(slot), "eviction order reaches slot %d", slot);
+        AP_RECORDS_CHECK(record_state[slot].rank_prev == prev, "slot %d linked after %d, points to %d",
+                         slot, prev, record_state[slot].rank_prev);
+        AP_RECORDS_CHECK(prev == AP_RECORDS_NO_SLOT || !rank_below(slot_rank(slot), slot_rank(prev)),
+                         "slot %d ranked below slot %d before it", slot, prev);
+        prev = slot;
+        linked++;
+    }
+    AP_RECORDS_CHECK(linked == record_count && rank_tail == prev, "eviction order links %d of %d records",
+                     linked, record_count);
+
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        const ap_records_cache_entry_t* entry = &record_cache[i];
+        if (!entry->valid) {
+            continue;
+        }
+        AP_RECORDS_CHECK(slot_in_use(entry->slot), "cache entry %d holds free slot %d", i, entry->slot);
+        AP_RECORDS_CHECK(cache_peek(entry->slot) == entry, "slot %d cached twice", entry->slot);
+        AP_RECORDS_CHECK(ssid_hash((const char*)entry->ssid) == record_meta[entry->slot].ssid_hash,
+                         "cached SSID of slot %d does not match its hash", entry->slot);
+    }
+
+    // Records sharing an SSID hash also share a probe run, compare their SSIDs
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        uint32_t bucket = ssid_hash_at(slot) & AP_RECORDS_LOOKUP_MASK;
+        for (; ssid_lookup[bucket]; bucket = (bucket + 1) & AP_RECORDS_LOOKUP_MASK) {
+            uint8_t other = ssid_lookup[bucket] - 1;
+            if (record_state[other].position <= i || record_meta[other].ssid_hash != record_meta[slot].ssid_hash) {
+                continue;
+            }
+            uint8_t ssid[sizeof(((ap_info_t*)0)->ssid)];
+            uint8_t other_ssid[sizeof(ssid)];
+            esp_err_t ret = check_read_ssid(slot, ssid);
+            if (ret == ESP_OK) {
+                ret = check_read_ssid(other, other_ssid);
+            }
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Could not compare SSIDs of slots %d and %d: %s", slot, other, esp_err_to_name(ret));
+                continue;
+            }
+            AP_RECORDS_CHECK(strcmp((const char*)ssid, (const char*)other_ssid) != 0,
+                             "SSID '%s' stored in slots %d and %d", ssid, slot, other);
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ap_records_check_locked(void)
+{
+    if (!is_initialized) {
+        ESP_LOGE(TAG, "AP records not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = check_records();
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "AP records consistent: %d records", record_count);
+    }
+    return ret;
+}
+
+esp_err_t ap_records_check(void)
+{
+    lock_records();
+    esp_err_t ret = ap_records_check_locked();
+    unlock_records();
+    return ret;
+}
+
+static void ap_records_print_all_locked(void)
 {
     if (!is_initialized) {
         ESP_LOGW(TAG, "AP records not initialized");
         return;
     }
 
-    ESP_LOGI(TAG, "=== AP Records (Total: %d) ===", ap_records.available_records);
-    for (int i = 0; i < ap_records.available_records; i++) {
-        ESP_LOGI(TAG, "Record %d: SSID='%s', BSSID=" MACSTR ", Use Count=%d", i, (const char*)ap_records.ap_list[i].ssid, MAC2STR(ap_records.ap_list[i].bssid), ap_records.ap_list[i].use_count);
+    ESP_LOGI(TAG, "=== AP Records (Total: %d) ===", record_count);
+    for (int i = 0; i < record_count; i++) {
+        uint8_t slot = record_order[i];
+        ap_info_t info;
+        const char* ssid = (fetch_record(slot, &info) == ESP_OK) ? (const char*)info.ssid : "?";
+        memset(info.password, 0, sizeof(info.password));
+        ESP_LOGI(TAG, "Record %d: SSID='%s', BSSID=" MACSTR ", Use Count=%u, Last Used=%" PRIu32, i, ssid,
+                 MAC2STR(record_meta[slot].bssid), record_meta[slot].use_count, record_meta[slot].last_used);
     }
+}
+
+void ap_records_print_all(void)
+{
+    lock_records();
+    ap_records_print_all_locked();
+    unlock_records();
 }
\ No newline at end of file
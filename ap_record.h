@@ -2,6 +2,7 @@
 #pragma once
 
 #include "esp_err.h"
+#include "esp_wifi_types.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -16,57 +17,176 @@ typedef struct {
     uint8_t ssid[33];                       ///< SSID of the AP (null-terminated)
     uint8_t password[65];                   ///< Password of the AP (null-terminated)
     uint8_t bssid[6];                       ///< MAC address of the AP
-    uint8_t use_count;                      ///< How many times used. Used for LRU replacement
+    uint16_t use_count;                     ///< Use frequency, halves every CONFIG_AP_RECORDS_AGING_PERIOD uses of any record
+    uint32_t last_used;                     ///< Use clock at the last use. With use_count, picks the record to replace
 } ap_info_t;
 
 /**
  * @brief AP records collection structure
+ * @note Only used to exchange whole record sets; the manager itself keeps a few
+ *       bytes of metadata per record in RAM and reads the rest from NVS on demand
  */
 typedef struct {
     ap_info_t ap_list[CONFIG_MAX_AP_COUNT];  
     uint8_t available_records;                 ///< Total records currently available
 } ap_record_t;
 
+/**
+ * @brief Connection statistics of an AP record, saved with the record
+ */
+typedef struct {
+    uint32_t last_success;                  ///< Use clock (see ap_info_t) at the last connection, 0 if never
+    uint16_t success_count;                 ///< Connections reported by ap_records_report_connected(), saturating
+    uint16_t failure_count;                 ///< Failed attempts reported by ap_records_report_disconnect(), saturating
+    uint16_t avg_connect_ms;                ///< Exponential average of the time to get an IP, in ms
+    int8_t last_rssi;                       ///< RSSI when last seen by ap_records_match_scan(), 0 if never
+    uint8_t last_channel;                   ///< Primary channel when last seen, 0 if never
+    uint8_t last_disconnect_reason;         ///< wifi_err_reason_t of the last disconnect, 0 if none
+} ap_records_stats_t;
+
+#define AP_RECORDS_CANDIDATE_CATALOG 0xFF    ///< record_index of a candidate from the catalog, see catalog_index
+
+/**
+ * @brief A scan result with a stored AP record, see ap_records_match_scan()
+ */
+typedef struct {
+    uint16_t scan_index;                    ///< Index into the scan results
+    uint8_t record_index;                   ///< Index of the matching record at match time; removals shift it, look the record up by SSID later
+    uint16_t catalog_index;                 ///< Index for ap_catalog_get() if record_index is AP_RECORDS_CANDIDATE_CATALOG
+    int16_t score;                          ///< Higher is better
+} ap_records_candidate_t;
+
+/**
+ * @brief Fields of an AP record, see ap_records_for_each() and ap_records_get_field()
+ */
+typedef enum {
+    AP_RECORDS_FIELD_SSID = 1 << 0,         ///< char[33], null-terminated
+    AP_RECORDS_FIELD_PASSWORD = 1 << 1,     ///< char[65], null-terminated
+    AP_RECORDS_FIELD_BSSID = 1 << 2,        ///< uint8_t[6]
+    AP_RECORDS_FIELD_USE_COUNT = 1 << 3,    ///< uint16_t, as in ap_info_t
+    AP_RECORDS_FIELD_LAST_USED = 1 << 4,    ///< uint32_t, as in ap_info_t
+    AP_RECORDS_FIELD_STATS = 1 << 5,        ///< ap_records_stats_t
+} ap_records_field_t;
+
+/**
+ * @brief Read-only view of an AP record, passed to an ap_records_visitor_t
+ * @note The pointers refer to the record manager's own tables and cache, not
+ *       to copies, and are only valid during the callback. Copy what is needed
+ *       afterwards.
+ */
+typedef struct {
+    int index;                              ///< Index of the record
+    const char* ssid;                       ///< NULL unless AP_RECORDS_FIELD_SSID was requested
+    const char* password;                   ///< NULL unless AP_RECORDS_FIELD_PASSWORD was requested
+    const uint8_t* bssid;                   ///< Stored BSSID, all zero if none; points into the record table
+    uint16_t use_count;
+    uint32_t last_used;
+    const ap_records_stats_t* stats;        ///< Points into the record table
+} ap_records_view_t;
+
+/**
+ * @brief Callback of ap_records_for_each()
+ * @param view The record
+ * @param arg User argument passed to ap_records_for_each()
+ * @return true to continue with the next record, false to stop
+ */
+typedef bool (*ap_records_visitor_t)(const ap_records_view_t* view, void* arg);
+
+/**
+ * @brief Completion callback of ap_records_save_async()
+ * @param result ESP_OK if the changes were written, error code otherwise
+ * @param arg User argument passed to ap_records_save_async()
+ */
+typedef void (*ap_records_save_cb_t)(esp_err_t result, void* arg);
+
 /**
  * @brief Initialize AP records manager
+ * @note After this, all functions may be called from any task. Calls are
+ *       serialized by a lock; ap_records_get_count(), ap_records_get_ranked()
+ *       and ap_records_peek() read without taking it unless writers keep
+ *       racing them. Flash is never accessed while those readers would have
+ *       to retry.
  * @return ESP_OK on success
  */
 esp_err_t ap_records_init(void);
 
 /**
  * @brief Load AP records from persistent storage
+ * @note Records written by older firmware as the single ap_records blob are
+ *       migrated to one key per record and the blob is erased. Records saved with a
+ *       different CONFIG_MAX_AP_COUNT are re-homed in place; if more records are
+ *       stored than fit, the most used ones are kept
  * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no saved data
  */
 esp_err_t ap_records_load(void);
 
 /**
  * @brief Save AP records to persistent storage
+ * @note Each record is stored under its own key; only records changed since the
+ *       last load or save are written, plus the small index when the list changed
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ap_records_save(void);
 
+/**
+ * @brief Queue the changed AP records for saving and return without waiting for flash
+ * @note With CONFIG_AP_RECORDS_ASYNC_SAVE the changes are written by a low priority
+ *       storage task and callback runs on that task; it may only call the lock-free
+ *       readers, other callers can hold the lock while they wait for that task.
+ *       Otherwise this saves synchronously and calls callback before returning.
+ * @param callback Called with the result once the changes are written (can be NULL)
+ * @param arg User argument passed to callback
+ * @return ESP_OK if queued (or saved), ESP_ERR_TIMEOUT if the queue is full and the
+ *         changes stay pending for the next save, error code otherwise
+ */
+esp_err_t ap_records_save_async(ap_records_save_cb_t callback, void* arg);
+
+/**
+ * @brief Wait until every save queued with ap_records_save_async() is written
+ * @note Returns immediately without CONFIG_AP_RECORDS_ASYNC_SAVE. Also runs
+ *       from a shutdown handler on esp_restart().
+ * @param timeout_ms Maximum time to wait, UINT32_MAX to wait forever
+ * @return ESP_OK when all queued saves are done, ESP_ERR_TIMEOUT otherwise
+ */
+esp_err_t ap_records_flush(uint32_t timeout_ms);
+
 /**
  * @brief Set the entire AP records structure
+ * @note Replaces all current records. Sets larger than CONFIG_AP_RECORDS_CACHE_SIZE
+ *       are partly saved while they are added, so ap_records_peek() can see
+ *       the new records arrive one at a time, as it does during a load.
  * @param records Pointer to ap_record_t structure
- * @return ESP_OK on success, ESP_ERR_INVALID_ARG if records is NULL
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if records is NULL,
+ *         ESP_ERR_NO_MEM if the records could not be saved to make room
  */
 esp_err_t ap_records_set_all(const ap_record_t* records);
 
 /**
  * @brief Get the entire AP records structure
+ * @note Reads every record not in the record cache from NVS
  * @param records Pointer to store the ap_record_t structure
- * @return ESP_OK on success, ESP_ERR_INVALID_ARG if records is NULL
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if records is NULL, error code
+ *         if a record could not be read
  */
 esp_err_t ap_records_get_all(ap_record_t* records);
 
 /**
- * @brief Get pointer to internal AP records (read-only access)
- * @return Pointer to internal ap_record_t structure, NULL if not initialized
+ * @brief Get pointer to a read-only copy of all AP records
+ * @note The copy is filled by ap_records_get_all() on every call and stays
+ *       allocated afterwards (sizeof(ap_record_t) bytes). It does not follow
+ *       later changes, and the next call refills it in place, so it is not safe
+ *       to share between tasks; prefer ap_records_peek() there.
+ * @return Pointer to the copy, NULL if not initialized or on error
  */
 const ap_record_t* ap_records_get_readonly(void);
 
 /**
  * @brief Add a new AP record
+ * @note A changed record stays in the record cache until it is saved. If the
+ *       cache holds nothing but unsaved records, they are saved first.
+ * @note Adding an existing SSID counts as a use. When all CONFIG_MAX_AP_COUNT
+ *       records are taken, the one with the lowest decayed use count is replaced,
+ *       the least recently used one among equals.
  * @param ssid SSID of the AP
  * @param password Password of the AP
  * @param bssid BSSID (MAC address) of the AP (can be NULL)
@@ -78,10 +198,28 @@ esp_err_t ap_records_add(const char* ssid, const char* password, const uint8_t*
  * @brief Get AP record by index
  * @param index Index of the record (0 to ap_records_get_count()-1)
  * @param ap_info Pointer to store the AP info
- * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index is invalid
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index is invalid, error code
+ *         if the record could not be read from NVS
  */
 esp_err_t ap_records_get(int index, ap_info_t* ap_info);
 
+/**
+ * @brief Read an AP record by index without taking the records lock
+ * @note Copies the record as of one consistent point in time and retries when
+ *       a change races with it; if changes keep racing it, it waits for the
+ *       writers on the lock instead. On the storage task it never takes the
+ *       lock and retries until the writer is done, which never needs flash.
+ *       Records not in the record cache are read from NVS on the calling
+ *       task, outside the lock, so such a peek waits for flash like any NVS
+ *       read; they are not added to the cache. Safe from any task, including
+ *       the callback of ap_records_save_async().
+ * @param index Index of the record (0 to ap_records_get_count()-1)
+ * @param ap_info Pointer to store the AP info
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index is invalid, error
+ *         code if the record could not be read from NVS
+ */
+esp_err_t ap_records_peek(int index, ap_info_t* ap_info);
+
 /**
  * @brief Get number of stored AP records
  * @return Number of records, or -1 if not initialized
@@ -107,10 +245,108 @@ esp_err_t ap_records_find_by_ssid(const char* ssid, ap_info_t* ap_info, int* ind
 esp_err_t ap_records_find_by_bssid(const uint8_t* bssid, ap_info_t* ap_info, int* index);
 
 /**
- * @brief Increment use count for an AP
- * @param ssid SSID of the AP that was used
+ * @brief Visit the AP records in list order without copying them
+ * @note The records are locked for the whole walk. The lock is recursive, so
+ *       the visitor may call the reading functions of this component; they do
+ *       not replace cache entries during the walk. Functions that change
+ *       records (add, remove, report, load, ...) fail with
+ *       ESP_ERR_INVALID_STATE when called from the visitor. Other tasks wait
+ *       for the walk to end.
+ * @note BSSID, usage and statistics are always in the view. SSID and password
+ *       are only read if requested in fields. Records not in the record cache
+ *       are then read from NVS into a scratch buffer, so the walk does not
+ *       evict cached records.
+ * @param fields AP_RECORDS_FIELD_SSID and/or AP_RECORDS_FIELD_PASSWORD, other
+ *        bits are ignored
+ * @param visitor Called for each record until it returns false
+ * @param arg User argument for the visitor
+ * @return ESP_OK on success, also when the visitor stopped early,
+ *         ESP_ERR_INVALID_ARG if visitor is NULL, error code if a record
+ *         could not be read from NVS
+ */
+esp_err_t ap_records_for_each(uint32_t fields, ap_records_visitor_t visitor, void* arg);
+
+/**
+ * @brief Copy one field of an AP record
+ * @note Only the requested field is copied, so callers needing an SSID or a
+ *       BSSID never handle the password or a whole ap_info_t.
+ * @param index Index of the record (0 to ap_records_get_count()-1)
+ * @param field Exactly one field
+ * @param out Buffer for the field, see ap_records_field_t for the types
+ * @param size In: size of out. Out: bytes stored, including the null
+ *        terminator for SSID and password, or bytes needed if out is too small
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index or field is
+ *         invalid, ESP_ERR_INVALID_SIZE if out is too small, error code if the
+ *         record could not be read from NVS
+ */
+esp_err_t ap_records_get_field(int index, ap_records_field_t field, void* out, size_t* size);
+
+/**
+ * @brief Match scan results against the AP records in one pass
+ * @note Every scan result is looked up once. Each record appears at most once,
+ *       with its best scoring scan result. The score adds signal strength, a
+ *       bonus for the stored BSSID, the decayed use count of the record, a
+ *       bonus for a short average time to IP and a bonus for WPA2 or better.
+ *       It subtracts the share of failed attempts. Open networks with a stored
+ *       password are penalized and secured ones without a stored password are
+ *       left out.
+ * @note Updates the last seen RSSI and channel of every matched record.
+ * @note With CONFIG_AP_RECORDS_CATALOG, scan results without a record are
+ *       matched against the catalog and scored like a record never used.
+ * @param scan Scan results from esp_wifi_scan_get_ap_records()
+ * @param scan_count Number of scan results
+ * @param candidates Array to store the candidates, best first
+ * @param count In: size of the array. Out: number of candidates stored
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid arguments, error
+ *         code if a record could not be read from NVS
+ */
+esp_err_t ap_records_match_scan(const wifi_ap_record_t* scan, uint16_t scan_count,
+                                ap_records_candidate_t* candidates, int* count);
+
+/**
+ * @brief Get the connection statistics of an AP record
+ * @param index Index of the record (0 to ap_records_get_count()-1)
+ * @param stats Pointer to store the statistics
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if index is invalid
+ */
+esp_err_t ap_records_get_stats(int index, ap_records_stats_t* stats);
+
+/**
+ * @brief Report a successful connection to an AP
+ * @note Statistics are kept in RAM and saved with the record by the next save,
+ *       at the latest when the use logged by ap_records_increment_use_count() is
+ *       folded in. Call this after ap_records_increment_use_count() so the use
+ *       clock includes this use.
+ * @param ssid SSID of the AP
+ * @param connect_ms Time from starting the connection to getting an IP
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if AP not found
+ */
+esp_err_t ap_records_report_connected(const char* ssid, uint32_t connect_ms);
+
+/**
+ * @brief Report a disconnect from an AP, or an attempt that failed
+ * @note Statistics are kept in RAM and saved with the record by the next save
+ * @param ssid SSID of the AP
+ * @param reason wifi_err_reason_t from the disconnect event
+ * @param connect_failed True if this ended a connection attempt, counted as a failure
  * @return ESP_OK on success, ESP_ERR_NOT_FOUND if AP not found
  */
+esp_err_t ap_records_report_disconnect(const char* ssid, uint8_t reason, bool connect_failed);
+
+/**
+ * @brief Increment use count for an AP and persist it
+ * @note The count first decays by the aging periods since the last use of the
+ *       record and saturates at UINT16_MAX.
+ * @note The new count is appended to a small usage log instead of rewriting the
+ *       record, as one NVS key per entry; the log is folded into the records on the next save, or by a
+ *       save of its own once it holds CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES entries
+ * @note With CONFIG_AP_RECORDS_ASYNC_SAVE the append and that save are queued for the
+ *       storage task like ap_records_save_async(), so this never waits for flash
+ * @param ssid SSID of the AP that was used
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if AP not found, ESP_ERR_TIMEOUT if the
+ *         storage queue is full, error code if the log could not be written (the count
+ *         is then saved with the record)
+ */
 esp_err_t ap_records_increment_use_count(const char* ssid);
 
 /**
@@ -133,8 +369,23 @@ esp_err_t ap_records_remove_by_index(int index);
  */
 esp_err_t ap_records_clear_all(void);
 
+/**
+ * @brief Get the indices of the AP records in rank order, most used first
+ * @note The rank order is kept up to date on every use, so this costs one step
+ *       per index and moves no record data. The order is the reverse of the
+ *       replacement order of ap_records_add().
+ * @note Lock-free like ap_records_peek(), and like it falls back to the lock
+ *       when writers keep changing the records
+ * @param indices Array to store the record indices
+ * @param count In: size of the array. Out: number of indices stored
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid arguments
+ */
+esp_err_t ap_records_get_ranked(uint8_t* indices, int* count);
+
 /**
  * @brief Sort AP records by use count (most used first)
+ * @note Counts are compared as decayed to the same time, see
+ *       ap_records_get_ranked(). Only the list order changes, in one pass.
  * @return ESP_OK on success
  */
 esp_err_t ap_records_sort_by_usage(void);
@@ -145,6 +396,17 @@ esp_err_t ap_records_sort_by_usage(void);
  */
 size_t ap_records_get_size(void);
 
+/**
+ * @brief Check the internal consistency of the AP records
+ * @note Verifies the record list, free slots, eviction order, lookup tables
+ *       and record cache against each other, and that no SSID is stored
+ *       twice. With CONFIG_AP_RECORDS_DEBUG_CHECKS this runs after every
+ *       change and aborts on the first violation.
+ * @return ESP_OK if consistent, ESP_ERR_INVALID_STATE if not initialized or
+ *         inconsistent; the violation is logged
+ */
+esp_err_t ap_records_check(void);
+
 /**
  * @brief Print all AP records for debugging
  */
@@ -3,285 +3,2177 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "string.h"
+#include <stdlib.h>
+#include <inttypes.h>
 
 static const char *TAG = "BLOB_STORAGE";
 static bool storage_system_initialized = false;
 
+// Serializes handle state between callers and the deferred flush timer
+static SemaphoreHandle_t storage_lock = NULL;
+
+// Deferred handles with uncommitted changes, linked through next_dirty
+static blob_storage_handle_t* dirty_list = NULL;
+static esp_timer_handle_t flush_timer = NULL;
+
+// Given by the flush timer, taken by flush_task, which does the NVS writes
+static SemaphoreHandle_t flush_signal = NULL;
+static TaskHandle_t flush_task_handle = NULL;
+
+// Aggregate of the I/O counters of all handles
+static blob_storage_io_stats_t global_io_stats = {0};
+
+static inline void lock_storage(void)
+{
+    xSemaphoreTakeRecursive(storage_lock, portMAX_DELAY);
+}
+
+static inline void unlock_storage(void)
+{
+    xSemaphoreGiveRecursive(storage_lock);
+}
+
+// Pool of long-lived NVS handles, one per namespace, shared by persistent storage handles
+typedef struct {
+    char namespace[16];
+    nvs_handle_t nvs_handle;
+    uint8_t refs;
+} nvs_pool_entry_t;
+
+static nvs_pool_entry_t nvs_pool[CONFIG_BLOB_STORAGE_NVS_POOL_SIZE] = {0};
+
+static esp_err_t nvs_pool_acquire_locked(const char* namespace, nvs_handle_t* nvs_handle)
+{
+    nvs_pool_entry_t* free_entry = NULL;
+
+    for (int i = 0; i < CONFIG_BLOB_STORAGE_NVS_POOL_SIZE; i++) {
+        if (nvs_pool[i].refs > 0 && strcmp(nvs_pool[i].namespace, namespace) == 0) {
+            nvs_pool[i].refs++;
+            *nvs_handle = nvs_pool[i].nvs_handle;
+            return ESP_OK;
+        }
+        if (nvs_pool[i].refs == 0 && !free_entry) {
+            free_entry = &nvs_pool[i];
+        }
+    }
+
+    if (!free_entry) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = nvs_open(namespace, NVS_READWRITE, &free_entry->nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    strncpy(free_entry->namespace, namespace, sizeof(free_entry->namespace) - 1);
+    free_entry->namespace[sizeof(free_entry->namespace) - 1] = '\0';
+    free_entry->refs = 1;
+    *nvs_handle = free_entry->nvs_handle;
+
+    ESP_LOGD(TAG, "Opened pooled NVS handle for namespace '%s'", namespace);
+    return ESP_OK;
+}
+
+static esp_err_t nvs_pool_acquire(const char* namespace, nvs_handle_t* nvs_handle)
+{
+    lock_storage();
+    esp_err_t err = nvs_pool_acquire_locked(namespace, nvs_handle);
+    unlock_storage();
+    return err;
+}
+
+static void nvs_pool_release(nvs_handle_t nvs_handle)
+{
+    lock_storage();
+    for (int i = 0; i < CONFIG_BLOB_STORAGE_NVS_POOL_SIZE; i++) {
+        if (nvs_pool[i].refs > 0 && nvs_pool[i].nvs_handle == nvs_handle) {
+            if (--nvs_pool[i].refs == 0) {
+                nvs_close(nvs_pool[i].nvs_handle);
+                ESP_LOGD(TAG, "Closed pooled NVS handle for namespace '%s'", nvs_pool[i].namespace);
+            }
+            break;
+        }
+    }
+    unlock_storage();
+}
+
+// Get an NVS handle for a single operation: the bound one if persistent, a fresh one otherwise
+static esp_err_t open_nvs(const blob_storage_handle_t* handle, nvs_open_mode_t mode, nvs_handle_t* nvs_handle)
+{
+    if (handle->persistent) {
+        *nvs_handle = handle->nvs_handle;
+        return ESP_OK;
+    }
+
+    esp_err_t err = nvs_open(handle->namespace, mode, nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
+                 handle->namespace, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void close_nvs(const blob_storage_handle_t* handle, nvs_handle_t nvs_handle)
+{
+    if (!handle->persistent) {
+        nvs_close(nvs_handle);
+    }
+}
+
+static void record_latency(blob_storage_latency_t* latency, uint32_t elapsed_us)
+{
+    latency->count++;
+    latency->total_us += elapsed_us;
+    if (elapsed_us > latency->max_us) {
+        latency->max_us = elapsed_us;
+    }
+}
+
+/*
+ * NVS stores a blob as a chunk header entry followed by its data in 32-byte
+ * entries, plus one blob index entry. Rewriting a blob appends fresh entries
+ * and only marks the old ones erased, so this is what a write costs in flash.
+ */
+#define NVS_ENTRY_SIZE 32
+
+static uint32_t nvs_entries_for_blob(size_t size)
+{
+    return 2 + (uint32_t)((size + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE);
+}
+
+static void account_stats(blob_storage_io_stats_t* stats, blob_storage_io_op_t op, size_t bytes, uint32_t elapsed_us)
+{
+    switch (op) {
+        case BLOB_STORAGE_IO_READ:
+            stats->reads++;
+            stats->bytes_read += bytes;
+            break;
+        case BLOB_STORAGE_IO_WRITE:
+            stats->writes++;
+            stats->bytes_written += bytes;
+            if (bytes) {
+                // Failed writes are accounted with zero bytes and consume nothing
+                stats->flash_entries += nvs_entries_for_blob(bytes);
+                stats->flash_bytes += (uint64_t)nvs_entries_for_blob(bytes) * NVS_ENTRY_SIZE;
+            }
+            break;
+        case BLOB_STORAGE_IO_COMMIT:
+            stats->commits++;
+            break;
+        case BLOB_STORAGE_IO_ERASE:
+            stats->erases++;
+            break;
+        default:
+            return;
+    }
+    record_latency(&stats->latency[op], elapsed_us);
+}
+
+// Account one NVS operation that started at start_us to the handle and the global aggregate
+static void account_io(blob_storage_handle_t* handle, blob_storage_io_op_t op, size_t bytes, int64_t start_us)
+{
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+    lock_storage();
+    account_stats(&handle->io_stats, op, bytes, elapsed_us);
+    account_stats(&global_io_stats, op, bytes, elapsed_us);
+    unlock_storage();
+}
+
+static void account_elided(blob_storage_handle_t* handle)
+{
+    lock_storage();
+    handle->io_stats.elided_writes++;
+    global_io_stats.elided_writes++;
+    unlock_storage();
+}
+
+static uint32_t content_hash(const void* data, size_t size)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)data, size);
+}
+
+// Remember what NVS holds for this handle so unchanged rewrites can be skipped
+static void remember_content(blob_storage_handle_t* handle, const void* data, size_t size)
+{
+    handle->content_hash = content_hash(data, size);
+    handle->content_size = size;
+    handle->content_known = true;
+}
+
+static bool content_unchanged(const blob_storage_handle_t* handle, const void* data, size_t size)
+{
+    // The cache is authoritative when present, compare it exactly
+    if (handle->cache && handle->cache_state == BLOB_STORAGE_CACHE_VALID) {
+        return size == handle->cache_size && memcmp(handle->cache, data, size) == 0;
+    }
+
+    return handle->content_known &&
+           size == handle->content_size &&
+           content_hash(data, size) == handle->content_hash;
+}
+
+// Accounted wrappers around the NVS calls, keyed by physical key
+
+static esp_err_t get_blob(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, const char* key,
+                          void* data, size_t* size)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = nvs_get_blob(nvs_handle, key, data, size);
+    account_io(handle, BLOB_STORAGE_IO_READ, (err == ESP_OK && data) ? *size : 0, start_us);
+    return err;
+}
+
+static esp_err_t set_blob(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, const char* key,
+                          const void* data, size_t size)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = nvs_set_blob(nvs_handle, key, data, size);
+    account_io(handle, BLOB_STORAGE_IO_WRITE, (err == ESP_OK) ? size : 0, start_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing blob to key '%s': %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t erase_blob(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, const char* key)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = nvs_erase_key(nvs_handle, key);
+    account_io(handle, BLOB_STORAGE_IO_ERASE, 0, start_us);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error deleting blob for key '%s': %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t commit_nvs(blob_storage_handle_t* handle, nvs_handle_t nvs_handle)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = nvs_commit(nvs_handle);
+    account_io(handle, BLOB_STORAGE_IO_COMMIT, 0, start_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing to NVS: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+/*
+ * A/B slots: the blob alternates between "<key>.a" and "<key>.b", each holding
+ * a sequence number and a CRC32 in front of the payload. A torn write can only
+ * damage the slot being written, the other one still holds the previous version.
+ */
+
+typedef struct {
+    uint32_t seq;               // Incremented on every write, newest valid slot wins
+    uint32_t crc;               // CRC32 over seq and payload
+} ab_slot_header_t;
+
+#define AB_SLOT_NONE 0xFF
+
+static void ab_slot_key(const blob_storage_handle_t* handle, int slot, char* key)
+{
+    size_t len = strlen(handle->key);
+    memcpy(key, handle->key, len);
+    key[len] = '.';
+    key[len + 1] = (char)('a' + slot);
+    key[len + 2] = '\0';
+}
+
+static uint32_t ab_crc(uint32_t seq, const void* payload, size_t size)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&seq, sizeof(seq));
+    return esp_rom_crc32_le(crc, (const uint8_t*)payload, size);
+}
+
+// Sequence comparison that survives wrap-around
+static bool ab_seq_newer(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+// Read both slots and pick the newest valid one; with data NULL only its payload size is reported.
+// A slot that could not be read leaves the slot state unknown unless the other slot is valid.
+static esp_err_t ab_scan(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, void* data, size_t* size)
+{
+    size_t slot_capacity = sizeof(ab_slot_header_t) + handle->max_size;
+    uint8_t* buf = malloc(slot_capacity);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t result = ESP_ERR_NVS_NOT_FOUND;
+    esp_err_t read_err = ESP_OK;
+    size_t best_size = 0;
+    handle->ab_active = AB_SLOT_NONE;
+    handle->ab_known = false;
+
+    for (int slot = 0; slot < 2; slot++) {
+        char key[16];
+        ab_slot_key(handle, slot, key);
+
+        size_t len = slot_capacity;
+        esp_err_t err = get_blob(handle, nvs_handle, key, buf, &len);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            continue;
+        } else if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+            ESP_LOGW(TAG, "Slot '%s' larger than max_size, ignoring it", key);
+            continue;
+        } else if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Slot '%s' unreadable: %s", key, esp_err_to_name(err));
+            read_err = err;
+            continue;
+        }
+
+        ab_slot_header_t header;
+        if (len < sizeof(header)) {
+            ESP_LOGW(TAG, "Slot '%s' truncated, ignoring it", key);
+            continue;
+        }
+        memcpy(&header, buf, sizeof(header));
+        size_t payload_size = len - sizeof(header);
+        if (ab_crc(header.seq, buf + sizeof(header), payload_size) != header.crc) {
+            ESP_LOGW(TAG, "Slot '%s' failed CRC check, ignoring it", key);
+            continue;
+        }
+
+        if (handle->ab_active != AB_SLOT_NONE && !ab_seq_newer(header.seq, handle->ab_seq)) {
+            continue;
+        }
+
+        handle->ab_active = (uint8_t)slot;
+        handle->ab_seq = header.seq;
+        best_size = payload_size;
+        if (!data) {
+            result = ESP_OK;
+        } else if (payload_size <= *size) {
+            memcpy(data, buf + sizeof(header), payload_size);
+            result = ESP_OK;
+        } else {
+            result = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+    }
+
+    free(buf);
+
+    if (handle->ab_active == AB_SLOT_NONE) {
+        if (read_err != ESP_OK) {
+            // The unreadable slot may hold the newest version
+            return read_err;
+        }
+
+        // Nothing valid in the slots, fall back to a blob written before A/B slots were enabled
+        result = get_blob(handle, nvs_handle, handle->key, data, size);
+        if (result != ESP_OK && result != ESP_ERR_NVS_INVALID_LENGTH && result != ESP_ERR_NVS_NOT_FOUND) {
+            return result;
+        }
+        handle->ab_legacy = (result != ESP_ERR_NVS_NOT_FOUND);
+        handle->ab_known = true;
+        return result;
+    }
+
+    handle->ab_known = true;
+    *size = best_size;
+    return result;
+}
+
+// Read the slot the handle knows to be newest straight into the caller's buffer.
+// Returns ESP_ERR_INVALID_STATE if the slot has to be found by a scan instead.
+static esp_err_t ab_read_active(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, void* data, size_t* size)
+{
+    char key[16];
+    ab_slot_key(handle, handle->ab_active, key);
+
+    ab_slot_header_t header;
+    size_t len = *size;
+    esp_err_t err = get_blob(handle, nvs_handle, key, data, &len);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH && len > *size + sizeof(header)) {
+        *size = len - sizeof(header);
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (err != ESP_OK || len < sizeof(header)) {
+        // Gone, or the payload fits but not with the header in front
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    size_t payload_size = len - sizeof(header);
+    memmove(data, (uint8_t*)data + sizeof(header), payload_size);
+    if (header.seq != handle->ab_seq || ab_crc(header.seq, data, payload_size) != header.crc) {
+        ESP_LOGW(TAG, "Slot '%s' changed or failed CRC check, rescanning", key);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    *size = payload_size;
+    return ESP_OK;
+}
+
+static esp_err_t ab_read(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, void* data, size_t* size)
+{
+    if (handle->ab_known) {
+        if (handle->ab_active != AB_SLOT_NONE) {
+            esp_err_t err = ab_read_active(handle, nvs_handle, data, size);
+            if (err != ESP_ERR_INVALID_STATE) {
+                return err;
+            }
+        } else if (handle->ab_legacy) {
+            return get_blob(handle, nvs_handle, handle->key, data, size);
+        } else {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+    return ab_scan(handle, nvs_handle, data, size);
+}
+
+// Size of the newest slot's payload, from the cached slot state
+static esp_err_t ab_size(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, size_t* size)
+{
+    if (handle->ab_active == AB_SLOT_NONE) {
+        *size = 0;
+        return handle->ab_legacy ? get_blob(handle, nvs_handle, handle->key, NULL, size) : ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    char key[16];
+    size_t len = 0;
+    ab_slot_key(handle, handle->ab_active, key);
+    esp_err_t err = get_blob(handle, nvs_handle, key, NULL, &len);
+    if (err == ESP_OK && len < sizeof(ab_slot_header_t)) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    *size = (err == ESP_OK) ? len - sizeof(ab_slot_header_t) : 0;
+    return err;
+}
+
+static esp_err_t ab_write(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, const void* data, size_t size)
+{
+    esp_err_t err;
+
+    // The target slot and sequence number depend on what is stored, find out once per handle.
+    // Guessing them could overwrite the newest slot with an older sequence number.
+    if (!handle->ab_known) {
+        size_t stored_size;
+        err = ab_scan(handle, nvs_handle, NULL, &stored_size);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Cannot tell the newest slot of key '%s': %s", handle->key, esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    uint8_t* buf = malloc(sizeof(ab_slot_header_t) + size);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int slot = (handle->ab_active == 0) ? 1 : 0;
+    ab_slot_header_t header = {
+        .seq = (handle->ab_active == AB_SLOT_NONE) ? 1 : handle->ab_seq + 1,
+    };
+    header.crc = ab_crc(header.seq, data, size);
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), data, size);
+
+    char key[16];
+    ab_slot_key(handle, slot, key);
+    err = set_blob(handle, nvs_handle, key, buf, sizeof(header) + size);
+    free(buf);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    handle->ab_active = (uint8_t)slot;
+    handle->ab_seq = header.seq;
+
+    if (handle->ab_legacy) {
+        // The slots supersede the old plain blob now
+        err = erase_blob(handle, nvs_handle, handle->key);
+        if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+            handle->ab_legacy = false;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ab_erase(blob_storage_handle_t* handle, nvs_handle_t nvs_handle)
+{
+    esp_err_t result = ESP_ERR_NVS_NOT_FOUND;
+
+    for (int slot = 0; slot < 3; slot++) {
+        char key[16];
+        if (slot < 2) {
+            ab_slot_key(handle, slot, key);
+        } else {
+            strcpy(key, handle->key);
+        }
+
+        esp_err_t err = erase_blob(handle, nvs_handle, key);
+        if (err == ESP_OK) {
+            if (result == ESP_ERR_NVS_NOT_FOUND) {
+                result = ESP_OK;
+            }
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            result = err;
+        }
+    }
+
+    handle->ab_active = AB_SLOT_NONE;
+    handle->ab_legacy = false;
+    handle->ab_known = true;
+    return result;
+}
+
+// Single-lookup blob read: nvs_get_blob reports the required length if the buffer is too small
+static esp_err_t read_nvs(blob_storage_handle_t* handle, void* data, size_t* size)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = open_nvs(handle, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t provided_size = *size;
+    if (handle->flags & BLOB_STORAGE_FLAG_AB_SLOTS) {
+        err = ab_read(handle, nvs_handle, data, size);
+    } else {
+        err = get_blob(handle, nvs_handle, handle->key, data, size);
+    }
+    close_nvs(handle, nvs_handle);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "Blob not found for key '%s'", handle->key);
+        return ESP_ERR_NVS_NOT_FOUND;
+    } else if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        ESP_LOGE(TAG, "Buffer too small: required %zu, provided %zu", *size, provided_size);
+        return ESP_ERR_INVALID_SIZE;
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading blob from key '%s': %s", 
+                 handle->key, esp_err_to_name(err));
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+// Size of the newest valid slot: a size query once the slot state is known, a size-only scan before that
+static esp_err_t ab_stored_size(blob_storage_handle_t* handle, size_t* size)
+{
+    nvs_handle_t nvs_handle;
+
+    lock_storage();
+    esp_err_t err = open_nvs(handle, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        err = handle->ab_known ? ab_size(handle, nvs_handle, size) : ab_scan(handle, nvs_handle, NULL, size);
+        close_nvs(handle, nvs_handle);
+    }
+    unlock_storage();
+    return err;
+}
+
+// Populate the RAM cache from NVS if it does not hold the current state yet
+static esp_err_t fill_cache(blob_storage_handle_t* handle)
+{
+    if (handle->cache_state != BLOB_STORAGE_CACHE_EMPTY) {
+        handle->io_stats.cache_hits++;
+        global_io_stats.cache_hits++;
+        return ESP_OK;
+    }
+
+    size_t size = handle->max_size;
+    esp_err_t err = read_nvs(handle, handle->cache, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        handle->cache_size = 0;
+        handle->cache_state = BLOB_STORAGE_CACHE_ABSENT;
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    handle->cache_size = size;
+    handle->cache_state = BLOB_STORAGE_CACHE_VALID;
+    remember_content(handle, handle->cache, size);
+    return ESP_OK;
+}
+
+// Store the blob in an open NVS session without committing
+static esp_err_t store_blob(blob_storage_handle_t* handle, nvs_handle_t nvs_handle, const void* data, size_t size)
+{
+    if (handle->flags & BLOB_STORAGE_FLAG_AB_SLOTS) {
+        return ab_write(handle, nvs_handle, data, size);
+    }
+    return set_blob(handle, nvs_handle, handle->key, data, size);
+}
+
+// Erase the blob in an open NVS session without committing
+static esp_err_t remove_blob(blob_storage_handle_t* handle, nvs_handle_t nvs_handle)
+{
+    if (handle->flags & BLOB_STORAGE_FLAG_AB_SLOTS) {
+        return ab_erase(handle, nvs_handle);
+    }
+    return erase_blob(handle, nvs_handle, handle->key);
+}
+
+static esp_err_t write_nvs(blob_storage_handle_t* handle, const void* data, size_t size)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    // Open NVS handle
+    err = open_nvs(handle, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Write the blob
+    err = store_blob(handle, nvs_handle, data, size);
+    if (err != ESP_OK) {
+        close_nvs(handle, nvs_handle);
+        return err;
+    }
+
+    // Commit changes
+    err = commit_nvs(handle, nvs_handle);
+    close_nvs(handle, nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGD(TAG, "Wrote %zu bytes to namespace='%s', key='%s'", 
+             size, handle->namespace, handle->key);
+    return ESP_OK;
+}
+
+static esp_err_t erase_nvs(blob_storage_handle_t* handle)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    // Open NVS handle
+    err = open_nvs(handle, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Delete the blob
+    err = remove_blob(handle, nvs_handle);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        close_nvs(handle, nvs_handle);
+        return err;
+    }
+
+    // Commit changes
+    esp_err_t commit_err = commit_nvs(handle, nvs_handle);
+    close_nvs(handle, nvs_handle);
+    if (commit_err != ESP_OK) {
+        return commit_err;
+    }
+
+    return err;
+}
+
+static void mark_dirty(blob_storage_handle_t* handle)
+{
+    if (!handle->dirty) {
+        handle->dirty = true;
+        handle->next_dirty = dirty_list;
+        dirty_list = handle;
+    }
+
+    if (flush_timer && !esp_timer_is_active(flush_timer)) {
+        esp_timer_start_once(flush_timer, (uint64_t)CONFIG_BLOB_STORAGE_COMMIT_WINDOW_MS * 1000);
+    }
+}
+
+static void unlink_dirty(blob_storage_handle_t* handle)
+{
+    for (blob_storage_handle_t** link = &dirty_list; *link; link = &(*link)->next_dirty) {
+        if (*link == handle) {
+            *link = handle->next_dirty;
+            break;
+        }
+    }
+    handle->next_dirty = NULL;
+    handle->dirty = false;
+}
+
+// Commit the staged state of a deferred handle. Caller holds storage_lock.
+static esp_err_t flush_handle(blob_storage_handle_t* handle)
+{
+    if (!handle->dirty) {
+        return ESP_OK;
+    }
+
+    esp_err_t err;
+    if (handle->cache_state == BLOB_STORAGE_CACHE_VALID) {
+        err = write_nvs(handle, handle->cache, handle->cache_size);
+    } else {
+        err = erase_nvs(handle);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    unlink_dirty(handle);
+    return ESP_OK;
+}
+
+static esp_err_t flush_all(void)
+{
+    esp_err_t result = ESP_OK;
+    blob_storage_handle_t* handle = dirty_list;
+
+    while (handle) {
+        blob_storage_handle_t* next = handle->next_dirty;
+        esp_err_t err = flush_handle(handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Deferred commit of key '%s' failed: %s", 
+                     handle->key, esp_err_to_name(err));
+            result = err;
+        }
+        handle = next;
+    }
+
+    // Retry whatever is left in the next window
+    if (dirty_list && flush_timer && !esp_timer_is_active(flush_timer)) {
+        esp_timer_start_once(flush_timer, (uint64_t)CONFIG_BLOB_STORAGE_COMMIT_WINDOW_MS * 1000);
+    }
+
+    return result;
+}
+
+// Runs on the esp_timer task, which must not block on flash writes or on storage_lock
+static void flush_timer_callback(void* arg)
+{
+    (void)arg;
+    xSemaphoreGive(flush_signal);
+}
+
+static void flush_task(void* arg)
+{
+    (void)arg;
+    for (;;) {
+        xSemaphoreTake(flush_signal, portMAX_DELAY);
+        lock_storage();
+        flush_all();
+        unlock_storage();
+    }
+}
+
+static void shutdown_handler(void)
+{
+    blob_storage_flush();
+}
+
 esp_err_t blob_storage_init(void)
 {
-    if (storage_system_initialized) {
-        ESP_LOGD(TAG, "Blob storage already initialized");
+    if (storage_system_initialized) {
+        ESP_LOGD(TAG, "Blob storage already initialized");
+        return ESP_OK;
+    }
+
+    // Note: We assume nvs_flash_init() has already been called by the main application
+    // We don't manage NVS flash initialization here to avoid conflicts
+
+    storage_lock = xSemaphoreCreateRecursiveMutex();
+    if (!storage_lock) {
+        ESP_LOGE(TAG, "Failed to create storage lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Kept across a failed init, the task has no way to stop
+    if (!flush_task_handle) {
+        flush_signal = xSemaphoreCreateBinary();
+        if (!flush_signal ||
+            xTaskCreate(flush_task, "blob_flush", CONFIG_BLOB_STORAGE_FLUSH_TASK_STACK_SIZE, NULL,
+                        CONFIG_BLOB_STORAGE_FLUSH_TASK_PRIORITY, &flush_task_handle) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start flush task");
+            if (flush_signal) {
+                vSemaphoreDelete(flush_signal);
+                flush_signal = NULL;
+            }
+            vSemaphoreDelete(storage_lock);
+            storage_lock = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = flush_timer_callback,
+        .name = "blob_flush",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &flush_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create flush timer: %s", esp_err_to_name(err));
+        vSemaphoreDelete(storage_lock);
+        storage_lock = NULL;
+        return err;
+    }
+
+    // Staged writes must not be lost on esp_restart()
+    err = esp_register_shutdown_handler(shutdown_handler);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to register shutdown flush: %s", esp_err_to_name(err));
+    }
+
+    storage_system_initialized = true;
+    ESP_LOGI(TAG, "Blob storage system initialized");
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_create_handle(blob_storage_handle_t* handle, 
+                                    const char* namespace, 
+                                    const char* key, 
+                                    size_t max_size)
+{
+    return blob_storage_create_handle_ex(handle, namespace, key, max_size, BLOB_STORAGE_FLAG_NONE);
+}
+
+esp_err_t blob_storage_create_handle_ex(blob_storage_handle_t* handle,
+                                       const char* namespace,
+                                       const char* key,
+                                       size_t max_size,
+                                       uint32_t flags)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !namespace || !key) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strlen(namespace) >= sizeof(handle->namespace) || 
+        strlen(key) >= sizeof(handle->key)) {
+        ESP_LOGE(TAG, "Namespace or key too long");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (max_size == 0) {
+        ESP_LOGE(TAG, "Max size cannot be zero");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // A/B slot keys append a two character suffix
+    if ((flags & BLOB_STORAGE_FLAG_AB_SLOTS) && strlen(key) + 2 >= sizeof(handle->key)) {
+        ESP_LOGE(TAG, "Key '%s' too long for A/B slots", key);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Initialize handle
+    strncpy(handle->namespace, namespace, sizeof(handle->namespace) - 1);
+    handle->namespace[sizeof(handle->namespace) - 1] = '\0';
+    
+    strncpy(handle->key, key, sizeof(handle->key) - 1);
+    handle->key[sizeof(handle->key) - 1] = '\0';
+    
+    // Deferred commits stage data in the RAM cache
+    if (flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT) {
+        flags |= BLOB_STORAGE_FLAG_CACHE;
+    }
+
+    handle->max_size = max_size;
+    handle->flags = flags;
+    handle->persistent = false;
+    handle->cache = NULL;
+    handle->cache_size = 0;
+    handle->cache_state = BLOB_STORAGE_CACHE_EMPTY;
+    handle->dirty = false;
+    handle->next_dirty = NULL;
+    handle->content_known = false;
+    handle->ab_seq = 0;
+    handle->ab_active = AB_SLOT_NONE;
+    handle->ab_known = false;
+    handle->ab_legacy = false;
+    memset(&handle->io_stats, 0, sizeof(handle->io_stats));
+
+    if (flags & BLOB_STORAGE_FLAG_CACHE) {
+        handle->cache = malloc(max_size);
+        if (!handle->cache) {
+            ESP_LOGE(TAG, "No memory for %zu byte cache of key '%s'", max_size, handle->key);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (flags & BLOB_STORAGE_FLAG_PERSISTENT) {
+        esp_err_t err = nvs_pool_acquire(handle->namespace, &handle->nvs_handle);
+        if (err == ESP_OK) {
+            handle->persistent = true;
+        } else if (err == ESP_ERR_NO_MEM) {
+            ESP_LOGW(TAG, "NVS handle pool full, key '%s' will open NVS per operation", handle->key);
+        } else {
+            ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
+                     handle->namespace, esp_err_to_name(err));
+            free(handle->cache);
+            handle->cache = NULL;
+            return err;
+        }
+    }
+
+    handle->initialized = true;
+
+    ESP_LOGD(TAG, "Created storage handle: namespace='%s', key='%s', max_size=%zu", 
+             handle->namespace, handle->key, handle->max_size);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_close_handle(blob_storage_handle_t* handle)
+{
+    if (!handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+    esp_err_t err = flush_handle(handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Discarding staged data of key '%s': %s", handle->key, esp_err_to_name(err));
+        unlink_dirty(handle);
+    }
+    unlock_storage();
+
+    if (handle->persistent) {
+        nvs_pool_release(handle->nvs_handle);
+        handle->persistent = false;
+    }
+
+    free(handle->cache);
+    handle->cache = NULL;
+    handle->cache_state = BLOB_STORAGE_CACHE_EMPTY;
+    handle->initialized = false;
+
+    ESP_LOGD(TAG, "Closed storage handle: namespace='%s', key='%s'", 
+             handle->namespace, handle->key);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_write(blob_storage_handle_t* handle, const void* data, size_t size)
+{
+    return blob_storage_write_ex(handle, data, size, NULL);
+}
+
+esp_err_t blob_storage_write_ex(blob_storage_handle_t* handle, const void* data, size_t size, bool* elided)
+{
+    if (elided) {
+        *elided = false;
+    }
+
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!data || size == 0) {
+        ESP_LOGE(TAG, "Invalid data or size");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (size > handle->max_size) {
+        ESP_LOGE(TAG, "Data size %zu exceeds maximum %zu", size, handle->max_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    lock_storage();
+
+    if ((handle->flags & BLOB_STORAGE_FLAG_ELIDE_UNCHANGED) && content_unchanged(handle, data, size)) {
+        unlock_storage();
+        account_elided(handle);
+        if (elided) {
+            *elided = true;
+        }
+        ESP_LOGD(TAG, "Skipped unchanged write of %zu bytes to key '%s'", size, handle->key);
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (!(handle->flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT)) {
+        err = write_nvs(handle, data, size);
+    }
+
+    if (err != ESP_OK) {
+        blob_storage_invalidate(handle);
+        handle->content_known = false;
+        unlock_storage();
+        return err;
+    }
+
+    remember_content(handle, data, size);
+
+    if (handle->cache) {
+        // data may be a read view of the cache itself
+        memmove(handle->cache, data, size);
+        handle->cache_size = size;
+        handle->cache_state = BLOB_STORAGE_CACHE_VALID;
+
+        if (handle->flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT) {
+            mark_dirty(handle);
+            ESP_LOGD(TAG, "Staged %zu bytes for namespace='%s', key='%s'", 
+                     size, handle->namespace, handle->key);
+        }
+    }
+
+    unlock_storage();
+    return err;
+}
+
+esp_err_t blob_storage_read(blob_storage_handle_t* handle, void* data, size_t* size)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!data || !size || *size == 0) {
+        ESP_LOGE(TAG, "Invalid data buffer or size");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err;
+
+    if (!handle->cache) {
+        lock_storage();
+        err = read_nvs(handle, data, size);
+        if (err != ESP_OK) {
+            unlock_storage();
+            return err;
+        }
+        remember_content(handle, data, *size);
+        unlock_storage();
+
+        ESP_LOGD(TAG, "Read %zu bytes from namespace='%s', key='%s'", 
+                 *size, handle->namespace, handle->key);
+        return ESP_OK;
+    }
+
+    lock_storage();
+
+    err = fill_cache(handle);
+    if (err != ESP_OK) {
+        unlock_storage();
+        return err;
+    }
+
+    if (handle->cache_state == BLOB_STORAGE_CACHE_ABSENT) {
+        unlock_storage();
+        ESP_LOGD(TAG, "Blob not found for key '%s'", handle->key);
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    // Check if buffer is large enough
+    if (*size < handle->cache_size) {
+        ESP_LOGE(TAG, "Buffer too small: required %zu, provided %zu", handle->cache_size, *size);
+        *size = handle->cache_size;  // Tell caller how much space is needed
+        unlock_storage();
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(data, handle->cache, handle->cache_size);
+    *size = handle->cache_size;
+    unlock_storage();
+
+    ESP_LOGD(TAG, "Read %zu bytes from cache of namespace='%s', key='%s'", 
+             *size, handle->namespace, handle->key);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_read_view(blob_storage_handle_t* handle, const void** data, size_t* size)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !handle->initialized || !data || !size) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!handle->cache) {
+        ESP_LOGE(TAG, "Read view requires a cached handle, key '%s'", handle->key);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    lock_storage();
+
+    esp_err_t err = fill_cache(handle);
+    if (err == ESP_OK && handle->cache_state == BLOB_STORAGE_CACHE_ABSENT) {
+        ESP_LOGD(TAG, "Blob not found for key '%s'", handle->key);
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (err == ESP_OK) {
+        *data = handle->cache;
+        *size = handle->cache_size;
+    }
+
+    unlock_storage();
+    return err;
+}
+
+esp_err_t blob_storage_invalidate(blob_storage_handle_t* handle)
+{
+    if (!handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+
+    // Staged data only lives in the cache, commit it before dropping it
+    esp_err_t err = flush_handle(handle);
+    if (err != ESP_OK) {
+        unlock_storage();
+        return err;
+    }
+
+    handle->cache_state = BLOB_STORAGE_CACHE_EMPTY;
+    handle->cache_size = 0;
+    handle->content_known = false;
+    handle->ab_known = false;
+    unlock_storage();
+
+    ESP_LOGD(TAG, "Invalidated cache for namespace='%s', key='%s'", 
+             handle->namespace, handle->key);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_exists(blob_storage_handle_t* handle, bool* exists, size_t* size)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !handle->initialized || !exists) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err;
+
+    if (handle->cache) {
+        lock_storage();
+        err = fill_cache(handle);
+        if (err == ESP_OK) {
+            *exists = (handle->cache_state == BLOB_STORAGE_CACHE_VALID);
+            if (size) *size = *exists ? handle->cache_size : 0;
+        }
+        unlock_storage();
+
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error checking blob existence for key '%s': %s", 
+                     handle->key, esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    size_t blob_size = 0;
+
+    if (handle->flags & BLOB_STORAGE_FLAG_AB_SLOTS) {
+        err = ab_stored_size(handle, &blob_size);
+    } else {
+        nvs_handle_t nvs_handle;
+
+        // Open NVS handle
+        err = open_nvs(handle, NVS_READONLY, &nvs_handle);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        // Check if blob exists by trying to get its size
+        err = get_blob(handle, nvs_handle, handle->key, NULL, &blob_size);
+        close_nvs(handle, nvs_handle);
+    }
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        *exists = false;
+        if (size) *size = 0;
+        ESP_LOGD(TAG, "Blob does not exist for key '%s'", handle->key);
+        return ESP_OK;
+    } else if (err == ESP_OK) {
+        *exists = true;
+        if (size) *size = blob_size;
+        ESP_LOGD(TAG, "Blob exists for key '%s', size=%zu", handle->key, blob_size);
         return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error checking blob existence for key '%s': %s", 
+                 handle->key, esp_err_to_name(err));
+        return err;
     }
+}
 
-    // Note: We assume nvs_flash_init() has already been called by the main application
-    // We don't manage NVS flash initialization here to avoid conflicts
-    
-    storage_system_initialized = true;
-    ESP_LOGI(TAG, "Blob storage system initialized");
+esp_err_t blob_storage_delete(blob_storage_handle_t* handle)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+
+    esp_err_t err;
+    if (handle->flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT) {
+        err = fill_cache(handle);
+        if (err == ESP_OK) {
+            err = (handle->cache_state == BLOB_STORAGE_CACHE_ABSENT) ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+            handle->cache_size = 0;
+            handle->cache_state = BLOB_STORAGE_CACHE_ABSENT;
+            handle->content_known = false;
+            mark_dirty(handle);
+        }
+    } else {
+        err = erase_nvs(handle);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            blob_storage_invalidate(handle);
+        } else {
+            handle->content_known = false;
+            if (handle->cache) {
+                handle->cache_size = 0;
+                handle->cache_state = BLOB_STORAGE_CACHE_ABSENT;
+            }
+        }
+    }
+
+    unlock_storage();
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "Blob not found for deletion, key '%s'", handle->key);
+        return ESP_ERR_NVS_NOT_FOUND;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGD(TAG, "Deleted blob for namespace='%s', key='%s'", 
+             handle->namespace, handle->key);
     return ESP_OK;
 }
 
-esp_err_t blob_storage_create_handle(blob_storage_handle_t* handle, 
-                                    const char* namespace, 
-                                    const char* key, 
-                                    size_t max_size)
+esp_err_t blob_storage_batch_begin(blob_storage_batch_t* batch, blob_storage_batch_op_t* ops, size_t max_ops)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!batch || !ops || max_ops == 0) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    batch->ops = ops;
+    batch->max_ops = max_ops;
+    batch->count = 0;
+    return ESP_OK;
+}
+
+static esp_err_t batch_add_op(blob_storage_batch_t* batch, blob_storage_handle_t* handle,
+                              const void* data, size_t size)
+{
+    if (!batch || !batch->ops || !handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (batch->count > 0 && strcmp(batch->ops[0].handle->namespace, handle->namespace) != 0) {
+        ESP_LOGE(TAG, "Key '%s' is not in batch namespace '%s'", handle->key, batch->ops[0].handle->namespace);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (batch->count == batch->max_ops) {
+        ESP_LOGE(TAG, "Batch full (%zu operations)", batch->max_ops);
+        return ESP_ERR_NO_MEM;
+    }
+
+    blob_storage_batch_op_t* op = &batch->ops[batch->count++];
+    op->handle = handle;
+    op->data = data;
+    op->size = size;
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_batch_add(blob_storage_batch_t* batch, blob_storage_handle_t* handle,
+                                 const void* data, size_t size)
+{
+    if (!data || size == 0) {
+        ESP_LOGE(TAG, "Invalid data or size");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (handle && size > handle->max_size) {
+        ESP_LOGE(TAG, "Data size %zu exceeds maximum %zu", size, handle->max_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return batch_add_op(batch, handle, data, size);
+}
+
+esp_err_t blob_storage_batch_add_delete(blob_storage_batch_t* batch, blob_storage_handle_t* handle)
+{
+    return batch_add_op(batch, handle, NULL, 0);
+}
+
+esp_err_t blob_storage_batch_commit(blob_storage_batch_t* batch)
 {
     if (!storage_system_initialized) {
         ESP_LOGE(TAG, "Blob storage not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!handle || !namespace || !key) {
+    if (!batch || !batch->ops) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (batch->count == 0) {
+        return ESP_OK;
+    }
+
+    lock_storage();
+
+    // One session for the whole batch, opened through the first handle
+    blob_storage_handle_t* first = batch->ops[0].handle;
+    nvs_handle_t nvs_handle;
+    esp_err_t err = open_nvs(first, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        unlock_storage();
+        return err;
+    }
+
+    size_t applied = 0;
+    size_t changed = 0;
+    for (; applied < batch->count; applied++) {
+        blob_storage_batch_op_t* op = &batch->ops[applied];
+        blob_storage_handle_t* handle = op->handle;
+
+        if (handle->flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT) {
+            // Deferred handles keep staging, their data goes out with the next deferred commit
+            err = op->data ? blob_storage_write(handle, op->data, op->size) : blob_storage_delete(handle);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+            if (err != ESP_OK) {
+                break;
+            }
+            continue;
+        }
+
+        if (op->data) {
+            if ((handle->flags & BLOB_STORAGE_FLAG_ELIDE_UNCHANGED) && content_unchanged(handle, op->data, op->size)) {
+                account_elided(handle);
+                continue;
+            }
+            err = store_blob(handle, nvs_handle, op->data, op->size);
+        } else {
+            err = remove_blob(handle, nvs_handle);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+        }
+
+        if (err != ESP_OK) {
+            break;
+        }
+        changed++;
+    }
+
+    // Commit what was written even after a failure, so a prefix of the batch is what hits flash
+    esp_err_t commit_err = ESP_OK;
+    if (changed > 0) {
+        commit_err = commit_nvs(first, nvs_handle);
+    }
+    close_nvs(first, nvs_handle);
+
+    // Bring caches and staged state in line with what was written; operations after a failure are untouched
+    size_t settled = (commit_err != ESP_OK) ? 0 : applied;
+    size_t touched = (applied < batch->count) ? applied + 1 : applied;
+    for (size_t i = 0; i < touched; i++) {
+        blob_storage_batch_op_t* op = &batch->ops[i];
+        blob_storage_handle_t* handle = op->handle;
+
+        if (handle->flags & BLOB_STORAGE_FLAG_DEFERRED_COMMIT) {
+            continue;   // Already up to date through blob_storage_write/delete
+        }
+
+        if (i >= settled) {
+            // Unknown what reached flash, reload on next access
+            blob_storage_invalidate(handle);
+            handle->content_known = false;
+            continue;
+        }
+
+        if (op->data) {
+            remember_content(handle, op->data, op->size);
+            if (handle->cache) {
+                memmove(handle->cache, op->data, op->size);
+                handle->cache_size = op->size;
+                handle->cache_state = BLOB_STORAGE_CACHE_VALID;
+            }
+        } else {
+            handle->content_known = false;
+            if (handle->cache) {
+                handle->cache_size = 0;
+                handle->cache_state = BLOB_STORAGE_CACHE_ABSENT;
+            }
+        }
+    }
+
+    unlock_storage();
+
+    if (err == ESP_OK) {
+        err = commit_err;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Batch of %zu operations in namespace '%s' failed after %zu: %s",
+                 batch->count, first->namespace, applied, esp_err_to_name(err));
+    } else {
+        ESP_LOGD(TAG, "Committed batch of %zu operations (%zu changed) in namespace '%s'",
+                 batch->count, changed, first->namespace);
+    }
+
+    batch->count = 0;
+    return err;
+}
+
+/*
+ * Packed container image: a 4 byte header (magic, version, entry count), then
+ * per entry the name length, the data size (little endian), the name and the data
+ */
+#define PACK_MAGIC 0xB5
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 4
+#define PACK_ENTRY_HEADER_SIZE 3
+#define PACK_NAME_MAX_LEN 15
+
+static uint32_t pack_hash(const char* name, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t pack_entry_size(const uint8_t* entry)
+{
+    return PACK_ENTRY_HEADER_SIZE + entry[0] + (entry[1] | ((size_t)entry[2] << 8));
+}
+
+static void pack_table_insert(blob_storage_pack_t* pack, size_t offset)
+{
+    const uint8_t* entry = &pack->image[offset];
+    uint32_t bucket = pack_hash((const char*)&entry[PACK_ENTRY_HEADER_SIZE], entry[0]) & pack->table_mask;
+    while (pack->table[bucket]) {
+        bucket = (bucket + 1) & pack->table_mask;
+    }
+    pack->table[bucket] = (uint16_t)(offset + 1);
+}
+
+// Bucket of the entry called name, or -1
+static int pack_find(const blob_storage_pack_t* pack, const char* name)
+{
+    size_t len = strlen(name);
+    uint32_t bucket = pack_hash(name, len) & pack->table_mask;
+
+    while (pack->table[bucket]) {
+        const uint8_t* entry = &pack->image[pack->table[bucket] - 1];
+        if (entry[0] == len && memcmp(&entry[PACK_ENTRY_HEADER_SIZE], name, len) == 0) {
+            return (int)bucket;
+        }
+        bucket = (bucket + 1) & pack->table_mask;
+    }
+    return -1;
+}
+
+// Validate the image and rebuild the lookup table from it
+static bool pack_index(blob_storage_pack_t* pack)
+{
+    memset(pack->table, 0, ((size_t)pack->table_mask + 1) * sizeof(uint16_t));
+    pack->count = 0;
+
+    if (pack->image_size < PACK_HEADER_SIZE || pack->image[0] != PACK_MAGIC || pack->image[1] != PACK_VERSION) {
+        return false;
+    }
+
+    uint16_t count = pack->image[2] | ((uint16_t)pack->image[3] << 8);
+    if (count > pack->max_entries) {
+        return false;
+    }
+
+    size_t offset = PACK_HEADER_SIZE;
+    for (uint16_t i = 0; i < count; i++) {
+        if (offset + PACK_ENTRY_HEADER_SIZE > pack->image_size ||
+            pack->image[offset] == 0 || pack->image[offset] > PACK_NAME_MAX_LEN ||
+            offset + pack_entry_size(&pack->image[offset]) > pack->image_size) {
+            return false;
+        }
+        pack_table_insert(pack, offset);
+        offset += pack_entry_size(&pack->image[offset]);
+    }
+
+    pack->count = count;
+    return offset == pack->image_size;
+}
+
+static void pack_reset(blob_storage_pack_t* pack)
+{
+    pack->image[0] = PACK_MAGIC;
+    pack->image[1] = PACK_VERSION;
+    pack->image[2] = 0;
+    pack->image[3] = 0;
+    pack->image_size = PACK_HEADER_SIZE;
+    pack_index(pack);
+}
+
+static esp_err_t pack_load(blob_storage_pack_t* pack)
+{
+    size_t size = pack->storage.max_size;
+    esp_err_t err = blob_storage_read(&pack->storage, pack->image, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        pack_reset(pack);
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    pack->image_size = size;
+    if (!pack_index(pack)) {
+        ESP_LOGW(TAG, "Invalid packed container '%s', starting empty", pack->storage.key);
+        pack_reset(pack);
+    }
+    return ESP_OK;
+}
+
+// Write the image; on failure RAM is reloaded so it keeps matching flash
+static esp_err_t pack_store(blob_storage_pack_t* pack)
+{
+    pack->image[2] = (uint8_t)pack->count;
+    pack->image[3] = (uint8_t)(pack->count >> 8);
+
+    esp_err_t err = blob_storage_write(&pack->storage, pack->image, pack->image_size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store packed container '%s': %s", pack->storage.key, esp_err_to_name(err));
+        if (pack_load(pack) != ESP_OK) {
+            pack_reset(pack);
+        }
+    }
+    return err;
+}
+
+// Drop the entry in bucket from the image, later entries move down
+static void pack_unlink(blob_storage_pack_t* pack, int bucket)
+{
+    size_t offset = pack->table[bucket] - 1;
+    size_t entry_size = pack_entry_size(&pack->image[offset]);
+
+    memmove(&pack->image[offset], &pack->image[offset + entry_size], pack->image_size - offset - entry_size);
+    pack->image_size -= entry_size;
+
+    // Offsets moved, rebuild the table; count is restored from the image by pack_index
+    pack->count--;
+    pack->image[2] = (uint8_t)pack->count;
+    pack->image[3] = (uint8_t)(pack->count >> 8);
+    pack_index(pack);
+}
+
+esp_err_t blob_storage_pack_open(blob_storage_pack_t* pack, const char* namespace, const char* key,
+                                 size_t max_size, uint16_t max_entries, uint32_t flags)
+{
+    if (!pack || max_entries == 0 || max_size < PACK_HEADER_SIZE || max_size > UINT16_MAX) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(pack, 0, sizeof(*pack));
+
+    esp_err_t err = blob_storage_create_handle_ex(&pack->storage, namespace, key, max_size, flags);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // At most half full, so probe sequences stay short
+    size_t buckets = 1;
+    while (buckets < 2 * (size_t)max_entries) {
+        buckets <<= 1;
+    }
+
+    pack->image = malloc(max_size);
+    pack->table = malloc(buckets * sizeof(uint16_t));
+    pack->table_mask = (uint16_t)(buckets - 1);
+    pack->max_entries = max_entries;
+    if (!pack->image || !pack->table) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        err = pack_load(pack);
+    }
+
+    if (err != ESP_OK) {
+        free(pack->image);
+        free(pack->table);
+        blob_storage_close_handle(&pack->storage);
+        return err;
+    }
+
+    pack->initialized = true;
+    ESP_LOGD(TAG, "Opened packed container '%s' with %u entries", key, pack->count);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_pack_close(blob_storage_pack_t* pack)
+{
+    if (!pack || !pack->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized pack");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = blob_storage_close_handle(&pack->storage);
+    free(pack->image);
+    free(pack->table);
+    pack->image = NULL;
+    pack->table = NULL;
+    pack->initialized = false;
+    return err;
+}
+
+esp_err_t blob_storage_pack_get(blob_storage_pack_t* pack, const char* name, void* data, size_t* size)
+{
+    if (!pack || !pack->initialized || !name || !data || !size) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+
+    int bucket = pack_find(pack, name);
+    if (bucket < 0) {
+        unlock_storage();
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    const uint8_t* entry = &pack->image[pack->table[bucket] - 1];
+    size_t data_size = entry[1] | ((size_t)entry[2] << 8);
+    if (data_size > *size) {
+        unlock_storage();
+        *size = data_size;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(data, &entry[PACK_ENTRY_HEADER_SIZE + entry[0]], data_size);
+    *size = data_size;
+    unlock_storage();
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_pack_set(blob_storage_pack_t* pack, const char* name, const void* data, size_t size)
+{
+    if (!pack || !pack->initialized || !name || !data || size > UINT16_MAX) {
         ESP_LOGE(TAG, "Invalid parameters");
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (strlen(namespace) >= sizeof(handle->namespace) || 
-        strlen(key) >= sizeof(handle->key)) {
-        ESP_LOGE(TAG, "Namespace or key too long");
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > PACK_NAME_MAX_LEN) {
+        ESP_LOGE(TAG, "Invalid pack entry name '%s'", name);
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (max_size == 0) {
-        ESP_LOGE(TAG, "Max size cannot be zero");
-        return ESP_ERR_INVALID_ARG;
+    lock_storage();
+
+    int bucket = pack_find(pack, name);
+    if (bucket >= 0) {
+        uint8_t* entry = &pack->image[pack->table[bucket] - 1];
+        size_t data_size = entry[1] | ((size_t)entry[2] << 8);
+        if (data_size == size) {
+            // Same size, overwrite in place
+            memcpy(&entry[PACK_ENTRY_HEADER_SIZE + name_len], data, size);
+            esp_err_t err = pack_store(pack);
+            unlock_storage();
+            return err;
+        }
+
+        size_t entry_size = PACK_ENTRY_HEADER_SIZE + name_len + size;
+        if (pack->image_size - pack_entry_size(entry) + entry_size > pack->storage.max_size) {
+            unlock_storage();
+            return ESP_ERR_NO_MEM;
+        }
+        pack_unlink(pack, bucket);
     }
 
-    // Initialize handle
-    strncpy(handle->namespace, namespace, sizeof(handle->namespace) - 1);
-    handle->namespace[sizeof(handle->namespace) - 1] = '\0';
-    
-    strncpy(handle->key, key, sizeof(handle->key) - 1);
-    handle->key[sizeof(handle->key) - 1] = '\0';
-    
-    handle->max_size = max_size;
-    handle->initialized = true;
+    size_t entry_size = PACK_ENTRY_HEADER_SIZE + name_len + size;
+    if (pack->count == pack->max_entries || pack->image_size + entry_size > pack->storage.max_size) {
+        unlock_storage();
+        ESP_LOGE(TAG, "Packed container '%s' full", pack->storage.key);
+        return ESP_ERR_NO_MEM;
+    }
 
-    ESP_LOGD(TAG, "Created storage handle: namespace='%s', key='%s', max_size=%zu", 
-             handle->namespace, handle->key, handle->max_size);
-    return ESP_OK;
+    // Append the entry
+    size_t offset = pack->image_size;
+    uint8_t* entry = &pack->image[offset];
+    entry[0] = (uint8_t)name_len;
+    entry[1] = (uint8_t)size;
+    entry[2] = (uint8_t)(size >> 8);
+    memcpy(&entry[PACK_ENTRY_HEADER_SIZE], name, name_len);
+    memcpy(&entry[PACK_ENTRY_HEADER_SIZE + name_len], data, size);
+    pack->image_size += entry_size;
+    pack->count++;
+    pack_table_insert(pack, offset);
+
+    esp_err_t err = pack_store(pack);
+    unlock_storage();
+    return err;
 }
 
-esp_err_t blob_storage_write(const blob_storage_handle_t* handle, const void* data, size_t size)
+esp_err_t blob_storage_pack_remove(blob_storage_pack_t* pack, const char* name)
 {
-    if (!storage_system_initialized) {
-        ESP_LOGE(TAG, "Blob storage not initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    if (!handle || !handle->initialized) {
-        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+    if (!pack || !pack->initialized || !name) {
+        ESP_LOGE(TAG, "Invalid parameters");
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (!data || size == 0) {
-        ESP_LOGE(TAG, "Invalid data or size");
-        return ESP_ERR_INVALID_ARG;
-    }
+    lock_storage();
 
-    if (size > handle->max_size) {
-        ESP_LOGE(TAG, "Data size %zu exceeds maximum %zu", size, handle->max_size);
-        return ESP_ERR_INVALID_SIZE;
+    int bucket = pack_find(pack, name);
+    if (bucket < 0) {
+        unlock_storage();
+        return ESP_ERR_NVS_NOT_FOUND;
     }
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+    pack_unlink(pack, bucket);
+    esp_err_t err = pack_store(pack);
+    unlock_storage();
+    return err;
+}
 
-    // Open NVS handle
-    err = nvs_open(handle->namespace, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
-                 handle->namespace, esp_err_to_name(err));
+/*
+ * Streams: chunks under "<key>.NN" (hex), then a manifest under the key itself.
+ * The manifest is written last, so it only ever describes chunks that exist.
+ */
+#define STREAM_MAGIC 0x5C
+#define STREAM_VERSION 1
+#define STREAM_MAX_CHUNKS 255
+#define STREAM_MIN_CHUNK_SIZE 16
+#define STREAM_MAX_CHUNK_SIZE 4000
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t chunk_size;
+    uint16_t chunk_count;
+    uint32_t total_size;
+    uint32_t crc;
+} stream_manifest_t;
+
+static void stream_chunk_key(const blob_storage_handle_t* handle, uint16_t index, char* key)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strlen(handle->key);
+    memcpy(key, handle->key, len);
+    key[len] = '.';
+    key[len + 1] = hex[(index >> 4) & 0xF];
+    key[len + 2] = hex[index & 0xF];
+    key[len + 3] = '\0';
+}
+
+static esp_err_t stream_read_manifest(blob_storage_handle_t* handle, nvs_handle_t nvs_handle,
+                                      stream_manifest_t* manifest)
+{
+    size_t size = sizeof(*manifest);
+    esp_err_t err = get_blob(handle, nvs_handle, handle->key, manifest, &size);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        return ESP_ERR_INVALID_STATE;   // A plain blob, not a stream
+    } else if (err != ESP_OK) {
         return err;
     }
 
-    // Write the blob
-    err = nvs_set_blob(nvs_handle, handle->key, data, size);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error writing blob to key '%s': %s", 
-                 handle->key, esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
+    if (size != sizeof(*manifest) || manifest->magic != STREAM_MAGIC || manifest->version != STREAM_VERSION ||
+        manifest->chunk_size < STREAM_MIN_CHUNK_SIZE || manifest->chunk_size > STREAM_MAX_CHUNK_SIZE ||
+        manifest->chunk_count > STREAM_MAX_CHUNKS ||
+        manifest->total_size > (uint32_t)manifest->chunk_count * manifest->chunk_size) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t stream_flush_chunk(blob_storage_stream_t* stream)
+{
+    if (stream->chunk_index == STREAM_MAX_CHUNKS) {
+        ESP_LOGE(TAG, "Stream '%s' exceeds %d chunks", stream->handle->key, STREAM_MAX_CHUNKS);
+        return ESP_ERR_NO_MEM;
     }
 
-    // Commit changes
-    err = nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
+    char key[16];
+    stream_chunk_key(stream->handle, stream->chunk_index, key);
 
+    lock_storage();
+    esp_err_t err = set_blob(stream->handle, stream->nvs_handle, key, stream->chunk, stream->chunk_fill);
+    unlock_storage();
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error committing blob to NVS: %s", esp_err_to_name(err));
         return err;
     }
 
-    ESP_LOGD(TAG, "Wrote %zu bytes to namespace='%s', key='%s'", 
-             size, handle->namespace, handle->key);
+    stream->chunk_index++;
+    stream->chunk_fill = 0;
     return ESP_OK;
 }
 
-esp_err_t blob_storage_read(const blob_storage_handle_t* handle, void* data, size_t* size)
+static void stream_release(blob_storage_stream_t* stream)
+{
+    close_nvs(stream->handle, stream->nvs_handle);
+    free(stream->chunk);
+    stream->chunk = NULL;
+    stream->active = false;
+}
+
+static esp_err_t stream_begin(blob_storage_stream_t* stream, blob_storage_handle_t* handle, nvs_open_mode_t mode)
 {
     if (!storage_system_initialized) {
         ESP_LOGE(TAG, "Blob storage not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 
-    if (!handle || !handle->initialized) {
-        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+    if (!stream || !handle || !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid parameters");
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (!data || !size || *size == 0) {
-        ESP_LOGE(TAG, "Invalid data buffer or size");
+    if (handle->flags & (BLOB_STORAGE_FLAG_CACHE | BLOB_STORAGE_FLAG_DEFERRED_COMMIT | BLOB_STORAGE_FLAG_AB_SLOTS)) {
+        ESP_LOGE(TAG, "Key '%s' cannot hold a stream with its flags", handle->key);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (strlen(handle->key) + 3 >= sizeof(handle->key)) {
+        ESP_LOGE(TAG, "Key '%s' too long for a stream", handle->key);
         return ESP_ERR_INVALID_ARG;
     }
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+    memset(stream, 0, sizeof(*stream));
+    stream->handle = handle;
+    return open_nvs(handle, mode, &stream->nvs_handle);
+}
 
-    // Open NVS handle
-    err = nvs_open(handle->namespace, NVS_READONLY, &nvs_handle);
+esp_err_t blob_storage_stream_write_begin(blob_storage_stream_t* stream, blob_storage_handle_t* handle,
+                                          size_t chunk_size)
+{
+    if (chunk_size < STREAM_MIN_CHUNK_SIZE || chunk_size > STREAM_MAX_CHUNK_SIZE) {
+        ESP_LOGE(TAG, "Invalid stream chunk size %zu", chunk_size);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = stream_begin(stream, handle, NVS_READWRITE);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
-                 handle->namespace, esp_err_to_name(err));
         return err;
     }
 
-    // Get the required size first
-    size_t required_size = 0;
-    err = nvs_get_blob(nvs_handle, handle->key, NULL, &required_size);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGD(TAG, "Blob not found for key '%s'", handle->key);
-        nvs_close(nvs_handle);
-        return ESP_ERR_NVS_NOT_FOUND;
-    } else if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting blob size for key '%s': %s", 
-                 handle->key, esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
+    stream->chunk = malloc(chunk_size);
+    if (!stream->chunk) {
+        close_nvs(handle, stream->nvs_handle);
+        return ESP_ERR_NO_MEM;
     }
 
-    // Check if buffer is large enough
-    if (*size < required_size) {
-        ESP_LOGE(TAG, "Buffer too small: required %zu, provided %zu", required_size, *size);
-        nvs_close(nvs_handle);
-        *size = required_size;  // Tell caller how much space is needed
+    // Remember how many chunks the current stream has, the surplus is erased at the end
+    stream_manifest_t manifest;
+    lock_storage();
+    if (stream_read_manifest(handle, stream->nvs_handle, &manifest) == ESP_OK) {
+        stream->chunk_count = manifest.chunk_count;
+    }
+    unlock_storage();
+
+    stream->chunk_size = (uint16_t)chunk_size;
+    stream->writing = true;
+    stream->active = true;
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_stream_write(blob_storage_stream_t* stream, const void* data, size_t size)
+{
+    if (!stream || !stream->active || !stream->writing || (!data && size > 0)) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if ((uint64_t)stream->total_size + size > UINT32_MAX) {
         return ESP_ERR_INVALID_SIZE;
     }
 
-    // Read the blob
-    err = nvs_get_blob(nvs_handle, handle->key, data, size);
-    nvs_close(nvs_handle);
+    const uint8_t* src = data;
+    while (size > 0) {
+        size_t part = stream->chunk_size - stream->chunk_fill;
+        if (part > size) {
+            part = size;
+        }
 
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error reading blob from key '%s': %s", 
-                 handle->key, esp_err_to_name(err));
-        return err;
+        memcpy(&stream->chunk[stream->chunk_fill], src, part);
+        stream->crc = esp_rom_crc32_le(stream->crc, src, part);
+        stream->chunk_fill += part;
+        stream->total_size += part;
+        src += part;
+        size -= part;
+
+        if (stream->chunk_fill == stream->chunk_size) {
+            esp_err_t err = stream_flush_chunk(stream);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
     }
 
-    ESP_LOGD(TAG, "Read %zu bytes from namespace='%s', key='%s'", 
-             *size, handle->namespace, handle->key);
     return ESP_OK;
 }
 
-esp_err_t blob_storage_exists(const blob_storage_handle_t* handle, bool* exists, size_t* size)
+esp_err_t blob_storage_stream_write_end(blob_storage_stream_t* stream)
 {
-    if (!storage_system_initialized) {
-        ESP_LOGE(TAG, "Blob storage not initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    if (!handle || !handle->initialized || !exists) {
+    if (!stream || !stream->active || !stream->writing) {
         ESP_LOGE(TAG, "Invalid parameters");
         return ESP_ERR_INVALID_ARG;
     }
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+    blob_storage_handle_t* handle = stream->handle;
+    esp_err_t err = ESP_OK;
+    if (stream->chunk_fill > 0) {
+        err = stream_flush_chunk(stream);
+    }
 
-    // Open NVS handle
-    err = nvs_open(handle->namespace, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        stream_manifest_t manifest = {
+            .magic = STREAM_MAGIC,
+            .version = STREAM_VERSION,
+            .chunk_size = stream->chunk_size,
+            .chunk_count = stream->chunk_index,
+            .total_size = stream->total_size,
+            .crc = stream->crc,
+        };
+
+        lock_storage();
+        err = set_blob(handle, stream->nvs_handle, handle->key, &manifest, sizeof(manifest));
+
+        // Chunks of a longer previous stream are no longer referenced
+        for (uint16_t index = stream->chunk_index; err == ESP_OK && index < stream->chunk_count; index++) {
+            char key[16];
+            stream_chunk_key(handle, index, key);
+            erase_blob(handle, stream->nvs_handle, key);
+        }
+
+        if (err == ESP_OK) {
+            err = commit_nvs(handle, stream->nvs_handle);
+        }
+        handle->content_known = false;
+        unlock_storage();
+    }
+
+    if (err == ESP_OK) {
+        ESP_LOGD(TAG, "Wrote stream of %" PRIu32 " bytes in %u chunks to key '%s'",
+                 stream->total_size, stream->chunk_index, handle->key);
+    } else {
+        ESP_LOGE(TAG, "Error writing stream to key '%s': %s", handle->key, esp_err_to_name(err));
+    }
+
+    stream_release(stream);
+    return err;
+}
+
+esp_err_t blob_storage_stream_read_begin(blob_storage_stream_t* stream, blob_storage_handle_t* handle,
+                                         size_t* total_size)
+{
+    esp_err_t err = stream_begin(stream, handle, NVS_READONLY);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
-                 handle->namespace, esp_err_to_name(err));
         return err;
     }
 
-    // Check if blob exists by trying to get its size
-    size_t blob_size = 0;
-    err = nvs_get_blob(nvs_handle, handle->key, NULL, &blob_size);
-    nvs_close(nvs_handle);
+    stream_manifest_t manifest;
+    lock_storage();
+    err = stream_read_manifest(handle, stream->nvs_handle, &manifest);
+    unlock_storage();
 
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        *exists = false;
-        if (size) *size = 0;
-        ESP_LOGD(TAG, "Blob does not exist for key '%s'", handle->key);
-        return ESP_OK;
-    } else if (err == ESP_OK) {
-        *exists = true;
-        if (size) *size = blob_size;
-        ESP_LOGD(TAG, "Blob exists for key '%s', size=%zu", handle->key, blob_size);
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Error checking blob existence for key '%s': %s", 
-                 handle->key, esp_err_to_name(err));
+    if (err == ESP_OK) {
+        stream->chunk = malloc(manifest.chunk_size);
+        if (!stream->chunk) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "Key '%s' does not hold a valid stream", handle->key);
+        }
+        close_nvs(handle, stream->nvs_handle);
         return err;
     }
+
+    stream->chunk_size = manifest.chunk_size;
+    stream->chunk_count = manifest.chunk_count;
+    stream->total_size = manifest.total_size;
+    stream->expected_crc = manifest.crc;
+    stream->active = true;
+
+    if (total_size) {
+        *total_size = manifest.total_size;
+    }
+    return ESP_OK;
 }
 
-esp_err_t blob_storage_delete(const blob_storage_handle_t* handle)
+esp_err_t blob_storage_stream_read(blob_storage_stream_t* stream, void* data, size_t size, size_t* read)
 {
-    if (!storage_system_initialized) {
-        ESP_LOGE(TAG, "Blob storage not initialized");
-        return ESP_ERR_INVALID_STATE;
+    if (!stream || !stream->active || stream->writing || !data || !read) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (!handle || !handle->initialized) {
-        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+    *read = 0;
+    uint8_t* dst = data;
+
+    while (size > 0 && stream->position < stream->total_size) {
+        if (stream->chunk_fill == stream->chunk_len) {
+            // Current chunk consumed, load the next one
+            if (stream->chunk_index == stream->chunk_count) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+
+            char key[16];
+            stream_chunk_key(stream->handle, stream->chunk_index, key);
+            size_t len = stream->chunk_size;
+
+            lock_storage();
+            esp_err_t err = get_blob(stream->handle, stream->nvs_handle, key, stream->chunk, &len);
+            unlock_storage();
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Error reading stream chunk '%s': %s", key, esp_err_to_name(err));
+                return (err == ESP_ERR_NVS_INVALID_LENGTH) ? ESP_ERR_INVALID_SIZE : err;
+            }
+
+            stream->chunk_index++;
+            stream->chunk_len = (uint16_t)len;
+            stream->chunk_fill = 0;
+        }
+
+        size_t part = stream->chunk_len - stream->chunk_fill;
+        if (part > size) {
+            part = size;
+        }
+        if (part > stream->total_size - stream->position) {
+            part = stream->total_size - stream->position;
+        }
+
+        memcpy(dst, &stream->chunk[stream->chunk_fill], part);
+        stream->crc = esp_rom_crc32_le(stream->crc, dst, part);
+        stream->chunk_fill += part;
+        stream->position += part;
+        dst += part;
+        size -= part;
+        *read += part;
+    }
+
+    if (*read > 0 && stream->position == stream->total_size && stream->crc != stream->expected_crc) {
+        ESP_LOGE(TAG, "Stream '%s' failed CRC check", stream->handle->key);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_stream_close(blob_storage_stream_t* stream)
+{
+    if (!stream || !stream->active) {
+        ESP_LOGE(TAG, "Invalid or closed stream");
         return ESP_ERR_INVALID_ARG;
     }
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+    if (stream->writing) {
+        ESP_LOGW(TAG, "Abandoned stream write to key '%s' after %u chunks", stream->handle->key, stream->chunk_index);
+    }
 
-    // Open NVS handle
-    err = nvs_open(handle->namespace, NVS_READWRITE, &nvs_handle);
+    stream_release(stream);
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_stream_delete(blob_storage_handle_t* handle)
+{
+    blob_storage_stream_t stream;
+    esp_err_t err = stream_begin(&stream, handle, NVS_READWRITE);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle for namespace '%s': %s", 
-                 handle->namespace, esp_err_to_name(err));
         return err;
     }
 
-    // Delete the blob
-    err = nvs_erase_key(nvs_handle, handle->key);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "Error deleting blob for key '%s': %s", 
-                 handle->key, esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
+    stream_manifest_t manifest;
+    lock_storage();
+    err = stream_read_manifest(handle, stream.nvs_handle, &manifest);
+    uint16_t listed = (err == ESP_OK) ? manifest.chunk_count : 0;
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+        // Manifest first: the stream is gone even if erasing its chunks is cut short
+        err = erase_blob(handle, stream.nvs_handle, handle->key);
     }
 
-    // Commit changes
-    esp_err_t commit_err = nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
+    // The listed chunks, then those an interrupted longer write left behind them
+    for (uint16_t index = 0; err == ESP_OK && index < STREAM_MAX_CHUNKS; index++) {
+        char key[16];
+        stream_chunk_key(handle, index, key);
+        esp_err_t erase_err = erase_blob(handle, stream.nvs_handle, key);
+        if (erase_err == ESP_ERR_NVS_NOT_FOUND && index >= listed) {
+            break;
+        } else if (erase_err != ESP_OK && erase_err != ESP_ERR_NVS_NOT_FOUND) {
+            err = erase_err;
+        }
+    }
 
-    if (commit_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error committing deletion to NVS: %s", esp_err_to_name(commit_err));
-        return commit_err;
+    if (err == ESP_OK) {
+        err = commit_nvs(handle, stream.nvs_handle);
     }
+    handle->content_known = false;
+    unlock_storage();
+    close_nvs(handle, stream.nvs_handle);
 
     if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGD(TAG, "Blob not found for deletion, key '%s'", handle->key);
-        return ESP_ERR_NVS_NOT_FOUND;
+        ESP_LOGD(TAG, "Stream not found for deletion, key '%s'", handle->key);
+    } else if (err == ESP_OK) {
+        ESP_LOGD(TAG, "Deleted stream of %u chunks from key '%s'", listed, handle->key);
+    } else {
+        ESP_LOGE(TAG, "Error deleting stream from key '%s': %s", handle->key, esp_err_to_name(err));
     }
+    return err;
+}
 
-    ESP_LOGD(TAG, "Deleted blob for namespace='%s', key='%s'", 
-             handle->namespace, handle->key);
-    return ESP_OK;
+esp_err_t blob_storage_flush(void)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    lock_storage();
+    if (flush_timer && esp_timer_is_active(flush_timer)) {
+        esp_timer_stop(flush_timer);
+    }
+    esp_err_t err = flush_all();
+    unlock_storage();
+
+    return err;
 }
 
-esp_err_t blob_storage_get_stats(const blob_storage_handle_t* handle, size_t* used_size, size_t* max_size)
+esp_err_t blob_storage_get_stats(blob_storage_handle_t* handle, size_t* used_size, size_t* max_size)
 {
     if (!storage_system_initialized) {
         ESP_LOGE(TAG, "Blob storage not initialized");
@@ -314,7 +2206,76 @@ esp_err_t blob_storage_get_stats(const blob_storage_handle_t* handle, size_t* us
     return ESP_OK;
 }
 
+esp_err_t blob_storage_get_io_stats(const blob_storage_handle_t* handle, blob_storage_io_stats_t* stats)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ((handle && !handle->initialized) || !stats) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+    memcpy(stats, handle ? &handle->io_stats : &global_io_stats, sizeof(*stats));
+    unlock_storage();
+
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_reset_io_stats(blob_storage_handle_t* handle)
+{
+    if (!storage_system_initialized) {
+        ESP_LOGE(TAG, "Blob storage not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (handle && !handle->initialized) {
+        ESP_LOGE(TAG, "Invalid or uninitialized handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    lock_storage();
+    memset(handle ? &handle->io_stats : &global_io_stats, 0, sizeof(blob_storage_io_stats_t));
+    unlock_storage();
+
+    return ESP_OK;
+}
+
+esp_err_t blob_storage_log_io_stats(const blob_storage_handle_t* handle)
+{
+    static const char* const op_names[BLOB_STORAGE_IO_OP_MAX] = { "read", "write", "commit", "erase" };
+
+    blob_storage_io_stats_t stats;
+    esp_err_t err = blob_storage_get_io_stats(handle, &stats);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const char* name = handle ? handle->key : "all";
+    ESP_LOGI(TAG, "I/O stats '%s': reads=%" PRIu32 " writes=%" PRIu32 " commits=%" PRIu32
+             " erases=%" PRIu32 " elided=%" PRIu32 " cache_hits=%" PRIu32,
+             name, stats.reads, stats.writes, stats.commits, stats.erases,
+             stats.elided_writes, stats.cache_hits);
+    ESP_LOGI(TAG, "I/O stats '%s': bytes read=%" PRIu64 " written=%" PRIu64
+             ", flash entries=%" PRIu32 " (%" PRIu64 " bytes)",
+             name, stats.bytes_read, stats.bytes_written, stats.flash_entries, stats.flash_bytes);
+
+    for (int op = 0; op < BLOB_STORAGE_IO_OP_MAX; op++) {
+        const blob_storage_latency_t* latency = &stats.latency[op];
+        if (latency->count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "I/O stats '%s': %-6s n=%" PRIu32 " avg=%" PRIu64 "us max=%" PRIu32 "us",
+                 name, op_names[op], latency->count, latency->total_us / latency->count, latency->max_us);
+    }
+
+    return ESP_OK;
+}
+
 bool blob_storage_is_initialized(void)
 {
     return storage_system_initialized;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "esp_err.h"
+#include "nvs.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -10,13 +11,99 @@ extern "C" {
 #endif
 
 /**
- * @brief Storage handle for managing different blob types
+ * @brief Version of this API, for callers that build against both
+ * @note Version 2 breaks source compatibility with version 1:
+ *       blob_storage_write(), blob_storage_read(), blob_storage_exists(),
+ *       blob_storage_delete() and blob_storage_get_stats() take a non-const
+ *       handle. Every access may update the handle's RAM cache, A/B slot and
+ *       content state and its I/O counters, so callers holding a
+ *       const blob_storage_handle_t* need a mutable one. Handles created with
+ *       blob_storage_create_handle() are otherwise used as before.
+ */
+#define BLOB_STORAGE_API_VERSION 2
+
+/**
+ * @brief Optional behaviour flags for a storage handle
+ */
+typedef enum {
+    BLOB_STORAGE_FLAG_NONE       = 0,
+    BLOB_STORAGE_FLAG_PERSISTENT = (1 << 0),   ///< Bind a pooled NVS handle for the lifetime of the storage handle
+    BLOB_STORAGE_FLAG_CACHE      = (1 << 1),   ///< Keep a RAM copy of the blob and serve reads from it
+    BLOB_STORAGE_FLAG_DEFERRED_COMMIT = (1 << 2), ///< Stage writes in RAM and commit them once per window (implies CACHE)
+    BLOB_STORAGE_FLAG_ELIDE_UNCHANGED = (1 << 3), ///< Skip writes whose content matches what is already stored
+    BLOB_STORAGE_FLAG_AB_SLOTS   = (1 << 4),   ///< Alternate between two CRC-checked slots so a torn write keeps the previous version (key max 13 chars)
+} blob_storage_flags_t;
+
+/**
+ * @brief State of a handle's RAM cache
+ */
+typedef enum {
+    BLOB_STORAGE_CACHE_EMPTY = 0,   ///< Nothing cached, next access goes to NVS
+    BLOB_STORAGE_CACHE_VALID,       ///< Cache holds the stored blob
+    BLOB_STORAGE_CACHE_ABSENT,      ///< Blob is known not to exist in NVS
+} blob_storage_cache_state_t;
+
+/**
+ * @brief NVS operation types tracked by the I/O statistics
+ */
+typedef enum {
+    BLOB_STORAGE_IO_READ = 0,   ///< nvs_get_blob (reads and existence checks)
+    BLOB_STORAGE_IO_WRITE,      ///< nvs_set_blob
+    BLOB_STORAGE_IO_COMMIT,     ///< nvs_commit
+    BLOB_STORAGE_IO_ERASE,      ///< nvs_erase_key
+    BLOB_STORAGE_IO_OP_MAX,
+} blob_storage_io_op_t;
+
+/**
+ * @brief Latency accumulator for one operation type
  */
 typedef struct {
+    uint32_t count;             ///< Number of operations measured
+    uint64_t total_us;          ///< Cumulative latency in microseconds
+    uint32_t max_us;            ///< Worst single operation in microseconds
+} blob_storage_latency_t;
+
+/**
+ * @brief Flash I/O counters, kept per handle and as a global aggregate
+ */
+typedef struct {
+    uint32_t reads;             ///< NVS blob reads and lookups
+    uint32_t writes;            ///< NVS blob writes
+    uint32_t commits;           ///< NVS commits
+    uint32_t erases;            ///< NVS key erases
+    uint32_t elided_writes;     ///< Writes skipped because content was unchanged
+    uint32_t cache_hits;        ///< Accesses served from the RAM cache
+    uint64_t bytes_read;        ///< Bytes read from NVS
+    uint64_t bytes_written;     ///< Bytes written to NVS
+    uint32_t flash_entries;     ///< Estimated 32-byte NVS entries consumed by writes, including blob headers
+    uint64_t flash_bytes;       ///< Estimated flash bytes consumed by writes (flash_entries * 32)
+    blob_storage_latency_t latency[BLOB_STORAGE_IO_OP_MAX]; ///< Latency per blob_storage_io_op_t
+} blob_storage_io_stats_t;
+
+/**
+ * @brief Storage handle for managing different blob types
+ */
+typedef struct blob_storage_handle {
     char namespace[16];         ///< NVS namespace
     char key[16];              ///< NVS key
     size_t max_size;           ///< Maximum allowed blob size
     bool initialized;          ///< Handle initialization status
+    uint32_t flags;            ///< Combination of blob_storage_flags_t
+    bool persistent;           ///< nvs_handle is a pooled, long-lived handle
+    nvs_handle_t nvs_handle;   ///< Bound NVS handle (valid only if persistent)
+    uint8_t* cache;            ///< RAM copy of the blob, max_size bytes (BLOB_STORAGE_FLAG_CACHE only)
+    size_t cache_size;         ///< Size of the cached blob
+    blob_storage_cache_state_t cache_state; ///< What the cache currently holds
+    bool dirty;                ///< Cache holds changes not yet committed (deferred handles only)
+    struct blob_storage_handle* next_dirty; ///< Next handle waiting for a deferred commit
+    uint32_t content_hash;     ///< CRC32 of the last content read from or written to NVS
+    size_t content_size;       ///< Size of that content
+    bool content_known;        ///< content_hash/content_size are valid
+    uint32_t ab_seq;           ///< Sequence number of the newest valid A/B slot
+    uint8_t ab_active;         ///< Index of the newest valid A/B slot, 0xFF if none
+    bool ab_known;             ///< ab_seq/ab_active reflect what is in NVS, reads go straight to the active slot
+    bool ab_legacy;            ///< A plain blob from before A/B slots is still stored under the key
+    blob_storage_io_stats_t io_stats; ///< Flash I/O counters of this handle
 } blob_storage_handle_t;
 
 /**
@@ -39,48 +126,370 @@ esp_err_t blob_storage_create_handle(blob_storage_handle_t* handle,
                                     const char* key, 
                                     size_t max_size);
 
+/**
+ * @brief Create a storage handle with optional behaviour flags
+ * @note With BLOB_STORAGE_FLAG_PERSISTENT the handle shares a pooled NVS handle
+ *       with other handles of the same namespace instead of opening and closing
+ *       NVS on every operation. If the pool is full the handle falls back to
+ *       per-operation opens. With BLOB_STORAGE_FLAG_CACHE a max_size buffer is
+ *       allocated and reads after the first one are served from RAM. With
+ *       BLOB_STORAGE_FLAG_DEFERRED_COMMIT writes and deletes only update the
+ *       cache and are committed later by the blob_flush task or
+ *       blob_storage_flush(). Release the handle with blob_storage_close_handle(),
+ *       which commits anything still staged.
+ * @param handle Pointer to handle structure to initialize
+ * @param namespace NVS namespace (max 15 chars)
+ * @param key NVS key (max 15 chars)
+ * @param max_size Maximum allowed blob size
+ * @param flags Combination of blob_storage_flags_t
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_create_handle_ex(blob_storage_handle_t* handle,
+                                       const char* namespace,
+                                       const char* key,
+                                       size_t max_size,
+                                       uint32_t flags);
+
+/**
+ * @brief Release a storage handle and any pooled NVS handle bound to it
+ * @param handle Storage handle
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_close_handle(blob_storage_handle_t* handle);
+
 /**
  * @brief Write blob data to NVS
+ * @note Non-const handle since BLOB_STORAGE_API_VERSION 2
  * @param handle Storage handle
  * @param data Pointer to data to write
  * @param size Size of data in bytes
  * @return ESP_OK on success, error code otherwise
  */
-esp_err_t blob_storage_write(const blob_storage_handle_t* handle, const void* data, size_t size);
+esp_err_t blob_storage_write(blob_storage_handle_t* handle, const void* data, size_t size);
+
+/**
+ * @brief Write blob data to NVS and report whether the write was skipped
+ * @note With BLOB_STORAGE_FLAG_ELIDE_UNCHANGED the data is compared against the
+ *       cached blob, or against a CRC32 of the last content this handle read
+ *       or wrote, and identical content is not written again.
+ * @param handle Storage handle
+ * @param data Pointer to data to write
+ * @param size Size of data in bytes
+ * @param elided Set to true if the write was skipped because nothing changed (can be NULL)
+ * @return ESP_OK on success (including skipped writes), error code otherwise
+ */
+esp_err_t blob_storage_write_ex(blob_storage_handle_t* handle, const void* data, size_t size, bool* elided);
 
 /**
  * @brief Read blob data from NVS
+ * @note Non-const handle since BLOB_STORAGE_API_VERSION 2
  * @param handle Storage handle
  * @param data Pointer to buffer to store data
  * @param size Pointer to size variable (input: buffer size, output: actual data size)
  * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if no data, other error codes on failure
  */
-esp_err_t blob_storage_read(const blob_storage_handle_t* handle, void* data, size_t* size);
+esp_err_t blob_storage_read(blob_storage_handle_t* handle, void* data, size_t* size);
+
+/**
+ * @brief Get a read-only view of the cached blob without copying it
+ * @note The view stays valid until the next write, delete, invalidate or close on the handle
+ * @param handle Storage handle created with BLOB_STORAGE_FLAG_CACHE
+ * @param data Pointer to store the address of the cached data
+ * @param size Pointer to store the blob size
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if no data,
+ *         ESP_ERR_NOT_SUPPORTED if the handle has no cache, other error codes on failure
+ */
+esp_err_t blob_storage_read_view(blob_storage_handle_t* handle, const void** data, size_t* size);
+
+/**
+ * @brief Drop the RAM cache so the next access reads NVS again
+ * @note Also forgets which A/B slot is newest, for keys another handle has written
+ * @param handle Storage handle
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_invalidate(blob_storage_handle_t* handle);
 
 /**
  * @brief Check if blob exists in storage
+ * @note Non-const handle since BLOB_STORAGE_API_VERSION 2
  * @param handle Storage handle
  * @param exists Pointer to store existence flag
  * @param size Pointer to store blob size (can be NULL)
  * @return ESP_OK on success, error code otherwise
  */
-esp_err_t blob_storage_exists(const blob_storage_handle_t* handle, bool* exists, size_t* size);
+esp_err_t blob_storage_exists(blob_storage_handle_t* handle, bool* exists, size_t* size);
 
 /**
  * @brief Delete blob from storage
+ * @note Non-const handle since BLOB_STORAGE_API_VERSION 2
  * @param handle Storage handle
  * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if no data, other error codes on failure
  */
-esp_err_t blob_storage_delete(const blob_storage_handle_t* handle);
+esp_err_t blob_storage_delete(blob_storage_handle_t* handle);
+
+/**
+ * @brief Commit all staged writes and deletes of deferred handles now
+ * @note Deferred handles are also flushed automatically by the blob_flush
+ *       task once per CONFIG_BLOB_STORAGE_COMMIT_WINDOW_MS and from
+ *       esp_restart(). Call this
+ *       before esp_deep_sleep_start(), staged data lives only in RAM.
+ * @return ESP_OK on success, error of the last failed commit otherwise
+ */
+esp_err_t blob_storage_flush(void);
+
+/**
+ * @brief One operation of a blob storage batch
+ */
+typedef struct {
+    blob_storage_handle_t* handle;  ///< Target handle
+    const void* data;               ///< Data to write, NULL to delete the blob
+    size_t size;                    ///< Size of data
+} blob_storage_batch_op_t;
+
+/**
+ * @brief Writes and deletes across handles of one namespace, applied in one NVS session
+ */
+typedef struct {
+    blob_storage_batch_op_t* ops;   ///< Caller provided operation array
+    size_t max_ops;                 ///< Capacity of ops
+    size_t count;                   ///< Operations added so far
+} blob_storage_batch_t;
+
+/**
+ * @brief Start a batch
+ * @param batch Batch to initialize
+ * @param ops Array holding the operations until commit
+ * @param max_ops Number of entries in ops
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_batch_begin(blob_storage_batch_t* batch, blob_storage_batch_op_t* ops, size_t max_ops);
+
+/**
+ * @brief Add a write to a batch
+ * @note data is not copied and must stay valid until blob_storage_batch_commit()
+ * @param batch Batch started with blob_storage_batch_begin()
+ * @param handle Storage handle, in the same namespace as the rest of the batch
+ * @param data Data to write
+ * @param size Size of data in bytes
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the batch is full, error code otherwise
+ */
+esp_err_t blob_storage_batch_add(blob_storage_batch_t* batch, blob_storage_handle_t* handle,
+                                 const void* data, size_t size);
+
+/**
+ * @brief Add a delete to a batch
+ * @param batch Batch started with blob_storage_batch_begin()
+ * @param handle Storage handle, in the same namespace as the rest of the batch
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the batch is full, error code otherwise
+ */
+esp_err_t blob_storage_batch_add_delete(blob_storage_batch_t* batch, blob_storage_handle_t* handle);
+
+/**
+ * @brief Apply a batch with a single NVS open and a single commit
+ * @note Operations are applied in the order they were added and stop at the
+ *       first failure. NVS applies every key on its own, so a power loss can
+ *       leave a prefix of the batch written: add records before the index that
+ *       refers to them. Operations on deferred handles are staged as usual and
+ *       go out with the next deferred commit. The batch is empty again afterwards.
+ * @param batch Batch to commit
+ * @return ESP_OK on success, error code of the first failed operation otherwise
+ */
+esp_err_t blob_storage_batch_commit(blob_storage_batch_t* batch);
+
+/**
+ * @brief Packed container: many small logical blobs stored in one physical blob
+ *
+ * Every logical blob costs a 3 byte entry header plus its name instead of the
+ * NVS blob overhead of at least three 32-byte entries. The whole container
+ * is kept in RAM and an open addressing table over the entry names gives
+ * O(1) lookups without touching flash. Every change rewrites the container,
+ * so combine it with BLOB_STORAGE_FLAG_DEFERRED_COMMIT for bursts of changes.
+ */
+typedef struct {
+    blob_storage_handle_t storage;  ///< Physical blob holding the container
+    uint8_t* image;                 ///< Container image: header followed by the entries
+    size_t image_size;              ///< Bytes of image in use
+    uint16_t* table;                ///< Entry offset + 1 per bucket, 0 for an empty bucket
+    uint16_t table_mask;            ///< Bucket count - 1, bucket count is a power of two
+    uint16_t max_entries;           ///< Maximum number of logical blobs
+    uint16_t count;                 ///< Logical blobs currently stored
+    bool initialized;               ///< Pack open
+} blob_storage_pack_t;
+
+/**
+ * @brief Open a packed container and load it into RAM
+ * @param pack Pack to initialize
+ * @param namespace NVS namespace of the physical blob
+ * @param key NVS key of the physical blob
+ * @param max_size Maximum size of the container in bytes (at most 65535)
+ * @param max_entries Maximum number of logical blobs
+ * @param flags Flags of the physical blob, see blob_storage_flags_t
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_pack_open(blob_storage_pack_t* pack, const char* namespace, const char* key,
+                                 size_t max_size, uint16_t max_entries, uint32_t flags);
+
+/**
+ * @brief Close a packed container and free its RAM
+ * @param pack Pack to close
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_pack_close(blob_storage_pack_t* pack);
+
+/**
+ * @brief Read a logical blob from a packed container
+ * @param pack Open pack
+ * @param name Name of the logical blob (max 15 characters)
+ * @param data Buffer to store the data
+ * @param size Input: buffer size, Output: actual data size (required size on ESP_ERR_INVALID_SIZE)
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if absent, error code otherwise
+ */
+esp_err_t blob_storage_pack_get(blob_storage_pack_t* pack, const char* name, void* data, size_t* size);
+
+/**
+ * @brief Write a logical blob into a packed container and store the container
+ * @param pack Open pack
+ * @param name Name of the logical blob (max 15 characters)
+ * @param data Data to write
+ * @param size Size of data in bytes (at most 65535)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the container is full, error code otherwise
+ */
+esp_err_t blob_storage_pack_set(blob_storage_pack_t* pack, const char* name, const void* data, size_t size);
+
+/**
+ * @brief Remove a logical blob from a packed container and store the container
+ * @param pack Open pack
+ * @param name Name of the logical blob
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if absent, error code otherwise
+ */
+esp_err_t blob_storage_pack_remove(blob_storage_pack_t* pack, const char* name);
+
+/**
+ * @brief Chunked stream over one logical blob, for data too large for one buffer
+ *
+ * A stream is stored as up to 255 chunks under "<key>.00" to "<key>.fe" plus a
+ * manifest under the handle's key with the chunk size, the total size and a
+ * CRC32 over the whole stream. Only one chunk is held in RAM. The handle's
+ * max_size does not limit the stream. Delete it with
+ * blob_storage_stream_delete(); blob_storage_delete() removes only the
+ * manifest and leaves the chunks behind.
+ */
+typedef struct {
+    blob_storage_handle_t* handle;  ///< Handle owning the stream
+    nvs_handle_t nvs_handle;        ///< NVS session of the stream
+    uint8_t* chunk;                 ///< One chunk of buffered data
+    uint16_t chunk_size;            ///< Chunk size in bytes
+    uint16_t chunk_fill;            ///< Write: bytes buffered, read: bytes of the current chunk consumed
+    uint16_t chunk_len;             ///< Read: bytes in the current chunk
+    uint16_t chunk_index;           ///< Next chunk to write or read
+    uint16_t chunk_count;           ///< Read: chunks in the stream, write: chunks of the stream being replaced
+    uint32_t total_size;            ///< Write: bytes written so far, read: size of the stream
+    uint32_t position;              ///< Read: bytes delivered so far
+    uint32_t crc;                   ///< Running CRC32
+    uint32_t expected_crc;          ///< Read: CRC32 from the manifest
+    bool writing;                   ///< Stream was opened for writing
+    bool active;                    ///< Stream is open
+} blob_storage_stream_t;
+
+/**
+ * @brief Start writing a stream, replacing the handle's blob
+ * @note The handle must not use the cache, deferred commit or A/B slot flags
+ *       and its key must be at most 12 characters. Until
+ *       blob_storage_stream_write_end() returns, an interrupted write leaves a
+ *       stream that fails its CRC check.
+ * @param stream Stream to initialize
+ * @param handle Storage handle
+ * @param chunk_size Chunk size in bytes (16 to 4000)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_stream_write_begin(blob_storage_stream_t* stream, blob_storage_handle_t* handle,
+                                          size_t chunk_size);
+
+/**
+ * @brief Append data to a stream, full chunks go to NVS right away
+ * @param stream Stream opened for writing
+ * @param data Data to append
+ * @param size Size of data in bytes
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the stream exceeds 255 chunks, error code otherwise
+ */
+esp_err_t blob_storage_stream_write(blob_storage_stream_t* stream, const void* data, size_t size);
+
+/**
+ * @brief Write the last chunk and the manifest, commit, and close the stream
+ * @param stream Stream opened for writing
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_stream_write_end(blob_storage_stream_t* stream);
+
+/**
+ * @brief Start reading a stream
+ * @param stream Stream to initialize
+ * @param handle Storage handle
+ * @param total_size Pointer to store the size of the stream (can be NULL)
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if no stream is stored, error code otherwise
+ */
+esp_err_t blob_storage_stream_read_begin(blob_storage_stream_t* stream, blob_storage_handle_t* handle,
+                                         size_t* total_size);
+
+/**
+ * @brief Read the next part of a stream
+ * @param stream Stream opened for reading
+ * @param data Buffer to store the data
+ * @param size Size of the buffer
+ * @param read Pointer to store the number of bytes read, 0 at the end of the stream
+ * @return ESP_OK on success, ESP_ERR_INVALID_CRC when the last byte was read and the
+ *         stream does not match its CRC, error code otherwise
+ */
+esp_err_t blob_storage_stream_read(blob_storage_stream_t* stream, void* data, size_t size, size_t* read);
+
+/**
+ * @brief Close a stream and free its buffer
+ * @note Closing a write stream without blob_storage_stream_write_end() abandons it
+ * @param stream Stream to close
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_stream_close(blob_storage_stream_t* stream);
+
+/**
+ * @brief Delete a stream: its manifest, then every chunk it lists
+ * @note A key holding a plain blob or a damaged manifest is erased too, with
+ *       the chunks found from "<key>.00" on
+ * @param handle Handle owning the stream
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND if no stream is stored, error code otherwise
+ */
+esp_err_t blob_storage_stream_delete(blob_storage_handle_t* handle);
 
 /**
  * @brief Get statistics for a storage handle
+ * @note Non-const handle since BLOB_STORAGE_API_VERSION 2
  * @param handle Storage handle
  * @param used_size Size of stored data (0 if no data)
  * @param max_size Maximum allowed size
  * @return ESP_OK on success, error code otherwise
  */
-esp_err_t blob_storage_get_stats(const blob_storage_handle_t* handle, size_t* used_size, size_t* max_size);
+esp_err_t blob_storage_get_stats(blob_storage_handle_t* handle, size_t* used_size, size_t* max_size);
+
+/**
+ * @brief Get a snapshot of the flash I/O counters
+ * @param handle Storage handle, or NULL for the aggregate over all handles
+ * @param stats Pointer to store the snapshot
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_get_io_stats(const blob_storage_handle_t* handle, blob_storage_io_stats_t* stats);
+
+/**
+ * @brief Reset the flash I/O counters
+ * @param handle Storage handle, or NULL for the aggregate over all handles
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_reset_io_stats(blob_storage_handle_t* handle);
+
+/**
+ * @brief Log the flash I/O counters with average and worst-case latencies
+ * @param handle Storage handle, or NULL for the aggregate over all handles
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t blob_storage_log_io_stats(const blob_storage_handle_t* handle);
 
 /**
  * @brief Check if storage system is initialized
@@ -0,0 +1,224 @@
+/* bench_ap_eviction.c - eviction policy replayed on roaming traces
+ *
+ * Usage: bench_ap_eviction [connects per trace]
+ *
+ * Replays traces of connects that a device carried between home, office,
+ * cafes, transit and hotels would make. A connect to a stored network is a
+ * hit and counts as a use; a connect to a network that is not stored is a
+ * miss and adds it, evicting a record once CONFIG_MAX_AP_COUNT are stored.
+ * Each trace runs through ap_records and through reference versions of the
+ * use_count eviction that ap_records_add did before the aging policy (8 bit
+ * counts that wrap, smallest one evicted) and of plain LRU. Reports the hit
+ * rate over reconnects (the first connect to a network can never hit), the
+ * misses on the home network and the evictions.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "host_test.h"
+#include <string.h>
+
+#define SIM_NETWORKS 256
+#define SIM_HOME 0
+#define SIM_OFFICE 1
+#define SIM_NEW_OFFICE 2
+
+typedef enum {
+    TRACE_HOME = 0,         // Home most of the time, a few friends, now and then somewhere new
+    TRACE_OFFICE,           // Home and office in blocks, cafes around the office
+    TRACE_COMMUTE,          // Every day the same transit hotspots, more of them than fit
+    TRACE_TRAVEL,           // Home and office for a long time, a trip through many hotels, back home
+    TRACE_JOB_CHANGE,       // A long time at one office, then another one for good
+    TRACE_COUNT,
+} sim_trace_t;
+
+static const char* const trace_names[] = {"home", "office", "commute", "travel", "job change"};
+
+typedef enum {
+    POLICY_AGING = 0,       // ap_records as it is
+    POLICY_USE_COUNT,       // Smallest 8 bit use count evicted, the first one among equals
+    POLICY_LRU,
+    POLICY_COUNT,
+} sim_policy_t;
+
+static const char* const policy_names[] = {"aging", "use count", "lru"};
+
+typedef struct {
+    int network;
+    uint32_t stamp;         // use_count for POLICY_USE_COUNT, last use for POLICY_LRU
+} sim_entry_t;
+
+typedef struct {
+    sim_entry_t entries[CONFIG_MAX_AP_COUNT];
+    int count;
+    uint32_t clock;
+} sim_list_t;
+
+typedef struct {
+    uint32_t reconnects;
+    uint32_t hits;
+    uint32_t home_misses;
+    uint32_t evictions;
+} sim_result_t;
+
+// Next network of a trace; i runs from 0 to connects
+static int trace_next(sim_trace_t trace, int i, int connects, uint32_t* rand_state)
+{
+    uint32_t r = host_rand(rand_state) % 100;
+    int day = i / 20;
+    int step = i % 20;
+
+    switch (trace) {
+    case TRACE_HOME:
+        if (r < 70) {
+            return SIM_HOME;
+        } else if (r < 90) {
+            return 10 + (int)(host_rand(rand_state) % 3);
+        }
+        return 100 + (int)(host_rand(rand_state) % 50);
+    case TRACE_OFFICE:
+        if (r < 10) {
+            return 20 + (int)(host_rand(rand_state) % (CONFIG_MAX_AP_COUNT + 2));
+        }
+        return (step < 8) ? SIM_HOME : SIM_OFFICE;
+    case TRACE_COMMUTE: {
+        int stops = CONFIG_MAX_AP_COUNT + 1;
+        if (step < 4) {
+            return SIM_HOME;
+        } else if (step < 8) {
+            return 40 + (step - 4 + day) % stops;       // Two stops a trip, a different pair every day
+        } else if (step < 16) {
+            return SIM_OFFICE;
+        }
+        return 40 + (step - 16 + day) % stops;
+    }
+    case TRACE_TRAVEL:
+        if (i >= connects * 6 / 10 && i < connects * 8 / 10) {
+            // A hotel every few days, the hotel and the airport connects in between
+            int stay = (i - connects * 6 / 10) / 40;
+            return (r < 15) ? 60 + (int)(host_rand(rand_state) % 4) : 70 + stay % 150;
+        }
+        if (r < 5) {
+            return 20 + (int)(host_rand(rand_state) % 8);
+        }
+        return (step < 12) ? SIM_HOME : SIM_OFFICE;
+    case TRACE_JOB_CHANGE: {
+        int office = (i < connects / 2) ? SIM_OFFICE : SIM_NEW_OFFICE;
+        if (r < 10) {
+            return 20 + (int)(host_rand(rand_state) % (CONFIG_MAX_AP_COUNT + 2));
+        }
+        return (step < 10) ? SIM_HOME : office;
+    }
+    default:
+        return SIM_HOME;
+    }
+}
+
+static void network_ssid(int network, char* ssid)
+{
+    sprintf(ssid, "trace-%03d", network);
+}
+
+// One connect through ap_records: find it, count the use, or add it
+static bool connect_aging(int network, bool* evicted)
+{
+    char ssid[33];
+    ap_info_t info;
+    int index;
+
+    network_ssid(network, ssid);
+    esp_err_t ret = ap_records_find_by_ssid(ssid, &info, &index);
+    if (ret == ESP_OK) {
+        TEST_ASSERT_OK(ap_records_increment_use_count(ssid));
+        return true;
+    }
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ret);
+    *evicted = ap_records_get_count() == CONFIG_MAX_AP_COUNT;
+    TEST_ASSERT_OK(ap_records_add(ssid, "pw-trace", NULL));
+    return false;
+}
+
+// One connect through a reference policy
+static bool connect_reference(sim_list_t* list, sim_policy_t policy, int network, bool* evicted)
+{
+    list->clock++;
+    for (int i = 0; i < list->count; i++) {
+        sim_entry_t* entry = &list->entries[i];
+        if (entry->network == network) {
+            entry->stamp = (policy == POLICY_USE_COUNT) ? (uint8_t)(entry->stamp + 1) : list->clock;
+            return true;
+        }
+    }
+
+    int victim = list->count;
+    *evicted = list->count == CONFIG_MAX_AP_COUNT;
+    if (*evicted) {
+        victim = 0;
+        for (int i = 1; i < list->count; i++) {
+            if (list->entries[i].stamp < list->entries[victim].stamp) {
+                victim = i;
+            }
+        }
+    } else {
+        list->count++;
+    }
+    list->entries[victim].network = network;
+    list->entries[victim].stamp = (policy == POLICY_USE_COUNT) ? 1 : list->clock;
+    return false;
+}
+
+static void replay(sim_trace_t trace, sim_policy_t policy, int connects, sim_result_t* result)
+{
+    static bool seen[SIM_NETWORKS];
+    sim_list_t list = {0};
+    uint32_t rand_state = 0x7ace0000u + (uint32_t)trace;
+
+    memset(seen, 0, sizeof(seen));
+    memset(result, 0, sizeof(*result));
+    if (policy == POLICY_AGING) {
+        TEST_ASSERT_OK(ap_records_clear_all());
+        TEST_ASSERT_OK(ap_records_save());
+    }
+
+    for (int i = 0; i < connects; i++) {
+        int network = trace_next(trace, i, connects, &rand_state);
+        bool evicted = false;
+        bool hit = (policy == POLICY_AGING) ? connect_aging(network, &evicted)
+                                            : connect_reference(&list, policy, network, &evicted);
+
+        TEST_ASSERT(network >= 0 && network < SIM_NETWORKS);
+        TEST_ASSERT(!hit || seen[network]);
+        if (seen[network]) {
+            result->reconnects++;
+            result->hits += hit ? 1 : 0;
+            result->home_misses += (!hit && network == SIM_HOME) ? 1 : 0;
+        }
+        result->evictions += evicted ? 1 : 0;
+        seen[network] = true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int connects = argc > 1 ? atoi(argv[1]) : 20000;
+
+    TEST_ASSERT(connects > 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    printf("CONFIG_MAX_AP_COUNT %d, CONFIG_AP_RECORDS_AGING_PERIOD %d, %d connects per trace\n",
+           CONFIG_MAX_AP_COUNT, CONFIG_AP_RECORDS_AGING_PERIOD, connects);
+    printf("%-12s %-10s %10s %8s %12s %10s\n", "trace", "policy", "reconnects", "hit %", "home misses", "evictions");
+    for (int trace = 0; trace < TRACE_COUNT; trace++) {
+        for (int policy = 0; policy < POLICY_COUNT; policy++) {
+            sim_result_t result;
+            replay(trace, policy, connects, &result);
+            printf("%-12s %-10s %10u %8.2f %12u %10u\n", trace_names[trace], policy_names[policy],
+                   (unsigned)result.reconnects,
+                   result.reconnects ? 100.0 * result.hits / result.reconnects : 0.0,
+                   (unsigned)result.home_misses, (unsigned)result.evictions);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+/* bench_ap_format.c - flash size and load time of the AP record format against a raw struct dump
+ *
+ * Usage: bench_ap_format [iterations]
+ *
+ * Stores records with SSID and password lengths typical of home and office
+ * networks in the compact per-record format, then stores the same records as
+ * the raw dump of the ap_info_t array that was saved before the format
+ * change: 105 bytes per record and the count, whatever the string lengths.
+ * Reports the flash taken (live 32-byte NVS entries, headers included), the
+ * payload bytes, and per load the host time and the NVS calls made. Host times
+ * only rank the two against each other; the flash columns carry over to the
+ * device.
+ */
+#include "ap_record.h"
+#include "blob_storage.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <inttypes.h>
+#include <string.h>
+
+// ap_info_t as it was stored before the compact format
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t password[65];
+    uint8_t bssid[6];
+    uint8_t use_count;
+} bench_raw_info_t;
+
+typedef struct {
+    bench_raw_info_t ap_list[CONFIG_MAX_AP_COUNT];
+    uint8_t available_records;
+} bench_raw_record_t;
+
+static bench_raw_record_t raw;
+
+static uint32_t live_entries(void)
+{
+    uint32_t live;
+    uint32_t erased;
+    nvs_host_get_usage(&live, &erased);
+    return live;
+}
+
+static uint32_t nvs_calls(const nvs_host_stats_t* nvs)
+{
+    return nvs->opens + nvs->gets + nvs->sets + nvs->erases + nvs->commits;
+}
+
+// Same records every run: SSIDs of 6 to 20 characters, passwords of 8 to 20; a later generation changes each password
+static void make_record(int i, int generation, uint32_t* rand_state, char* ssid, char* password)
+{
+    int ssid_len = 6 + (int)(host_rand(rand_state) % 15);
+    int password_len = 8 + (int)(host_rand(rand_state) % 13);
+    int prefix = snprintf(ssid, 33, "net%03d-", i);
+
+    for (int c = prefix; c < ssid_len; c++) {
+        ssid[c] = (char)('a' + host_rand(rand_state) % 26);
+    }
+    ssid[ssid_len > prefix ? ssid_len : prefix] = '\0';
+    for (int c = 0; c < password_len; c++) {
+        password[c] = (char)('A' + host_rand(rand_state) % 58);
+    }
+    password[password_len] = '\0';
+    if (generation) {
+        password[0] = (password[0] == 'x') ? 'y' : 'x';
+    }
+}
+
+static void fill(int count, int generation)
+{
+    uint32_t rand_state = 0xf0a7u;
+
+    TEST_ASSERT_OK(ap_records_clear_all());
+    memset(&raw, 0, sizeof(raw));
+    for (int i = 0; i < count; i++) {
+        char ssid[33];
+        char password[65];
+        uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x10, 0, (uint8_t)i};
+
+        make_record(i, generation, &rand_state, ssid, password);
+        TEST_ASSERT_OK(ap_records_add(ssid, password, bssid));
+        strcpy((char*)raw.ap_list[i].ssid, ssid);
+        strcpy((char*)raw.ap_list[i].password, password);
+        memcpy(raw.ap_list[i].bssid, bssid, 6);
+        raw.ap_list[i].use_count = 1;
+    }
+    raw.available_records = (uint8_t)count;
+    TEST_ASSERT_OK(ap_records_save());
+}
+
+// Bytes stored under a key, in both A/B slots when it has them
+static uint64_t stored_size(const char* key)
+{
+    static const char* const suffixes[] = {"", ".a", ".b"};
+    uint8_t buf[256];
+    char slot_key[16];
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        size_t size = sizeof(buf);
+        snprintf(slot_key, sizeof(slot_key), "%s%s", key, suffixes[i]);
+        if (nvs_host_peek("ap_storage", slot_key, buf, &size) == ESP_OK) {
+            total += size;
+        }
+    }
+    return total;
+}
+
+static void print_row(const char* format, int count, uint32_t entries, uint64_t payload,
+                      uint64_t elapsed_ns, const nvs_host_stats_t* nvs, int iterations)
+{
+    printf("%-18s %8d %12" PRIu32 " %12" PRIu64 " %10.0f %10.2f\n", format, count,
+           entries * NVS_HOST_ENTRY_SIZE, payload, (double)elapsed_ns / iterations,
+           (double)nvs_calls(nvs) / iterations);
+}
+
+// Drop the records and wipe the flash under the open handles
+static void erase_flash(void)
+{
+    TEST_ASSERT_OK(ap_records_clear_all());
+    TEST_ASSERT_OK(ap_records_save());
+    nvs_host_reset(NVS_HOST_DEFAULT_PAGES);
+}
+
+// Flash taken and load time of the records last saved
+static void measure_compact(const char* format, int count, int iterations)
+{
+    nvs_host_stats_t nvs;
+    uint32_t entries = live_entries();
+
+    // Payload: the index and the records as stored, A/B slot headers included
+    char key[16];
+    uint64_t payload = stored_size("ap_index");
+    TEST_ASSERT(payload > 0);
+    for (int slot = 0; slot < CONFIG_MAX_AP_COUNT; slot++) {
+        snprintf(key, sizeof(key), "ap_rec%u", (unsigned)slot);
+        payload += stored_size(key);
+    }
+
+    nvs_host_reset_stats();
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        TEST_ASSERT_OK(ap_records_load());
+    }
+    uint64_t elapsed = host_now_ns() - start;
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(ap_records_get_count() == count);
+    print_row(format, count, entries, payload, elapsed, &nvs, iterations);
+}
+
+// With A/B slots a record keeps its previous version once it has been rewritten, so measure both states
+static void bench_compact(int count, int iterations)
+{
+    erase_flash();
+    fill(count, 0);
+    measure_compact("compact", count, iterations);
+    fill(count, 1);
+    measure_compact("compact, rewritten", count, iterations);
+}
+
+static void bench_raw(int count, int iterations)
+{
+    blob_storage_handle_t handle;
+    nvs_host_stats_t nvs;
+    static bench_raw_record_t loaded;
+
+    fill(count, 0);
+    erase_flash();
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, "bench_raw", "ap_records", sizeof(raw),
+                                                 BLOB_STORAGE_FLAG_NONE));
+    TEST_ASSERT_OK(blob_storage_write(&handle, &raw, sizeof(raw)));
+    uint32_t entries = live_entries();
+
+    nvs_host_reset_stats();
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        size_t size = sizeof(loaded);
+        TEST_ASSERT_OK(blob_storage_read(&handle, &loaded, &size));
+        TEST_ASSERT(size == sizeof(raw) && loaded.available_records == count);
+    }
+    uint64_t elapsed = host_now_ns() - start;
+    nvs_host_get_stats(&nvs);
+    print_row("raw", count, entries, sizeof(raw), elapsed, &nvs, iterations);
+
+    TEST_ASSERT_OK(blob_storage_delete(&handle));
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    const int counts[] = {1, CONFIG_MAX_AP_COUNT / 2, CONFIG_MAX_AP_COUNT};
+
+    TEST_ASSERT(iterations > 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    printf("CONFIG_MAX_AP_COUNT %d, %d loads each, every row on erased flash; flash includes the namespace\n"
+           "entry and, for compact, the index\n", CONFIG_MAX_AP_COUNT, iterations);
+    printf("%-18s %8s %12s %12s %10s %10s\n", "format", "records", "flash B", "payload B", "load ns", "nvs/load");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench_compact(counts[i], iterations);
+        bench_raw(counts[i], iterations);
+    }
+    return 0;
+}
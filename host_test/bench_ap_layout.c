@@ -0,0 +1,273 @@
+/* bench_ap_layout.c - RAM and lookup time of the hot/cold record layout against the ap_info_t array
+ *
+ * Usage: bench_ap_layout <ap_record library> [iterations]
+ *
+ * RAM: sums the static data of the given ap_record library, as nm reports
+ * it, by part: the hot per-record tables that matching and ranking read, the
+ * record cache holding SSIDs and passwords, the connection statistics and the
+ * rest (usage log, storage handles, flags). Saves allocate their staging
+ * buffer on the heap, it is not counted. The old layout kept everything in one
+ * ap_info_t array of 105 bytes per record.
+ *
+ * Time: stores CONFIG_MAX_AP_COUNT records and matches a scan of
+ * BENCH_SCAN_COUNT networks, a few of them stored, the way the connect path
+ * did before (a find_by_ssid per scanned network over the array, copying the
+ * record on a hit) and with ap_records_match_scan(); then finds records by
+ * BSSID and misses SSIDs both ways. Host times only rank the two against each
+ * other.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+#define BENCH_SCAN_COUNT 20
+#define BENCH_SCAN_STORED 3         // Scanned networks that are stored
+
+// ap_info_t and ap_record_t as they were before the hot/cold split
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t password[65];
+    uint8_t bssid[6];
+    uint8_t use_count;
+} bench_old_info_t;
+
+typedef struct {
+    bench_old_info_t ap_list[CONFIG_MAX_AP_COUNT];
+    uint8_t available_records;
+} bench_old_record_t;
+
+static bench_old_record_t old_records;
+static wifi_ap_record_t scan[BENCH_SCAN_COUNT];
+static uint8_t stored_bssids[CONFIG_MAX_AP_COUNT][6];
+
+typedef enum {
+    RAM_HOT = 0,
+    RAM_CACHE,
+    RAM_STATS,
+    RAM_OTHER,
+    RAM_PART_COUNT,
+} ram_part_t;
+
+static const char* const ram_part_names[] = {"hot tables", "record cache", "connection stats", "other"};
+
+static ram_part_t ram_part_of(const char* symbol)
+{
+    static const char* const hot[] = {
+        "record_meta", "record_state", "record_order", "record_count", "free_slots", "free_slot_count",
+        "ssid_lookup", "bssid_lookup", "rank_head", "rank_tail", "use_clock",
+    };
+
+    for (size_t i = 0; i < sizeof(hot) / sizeof(hot[0]); i++) {
+        if (strcmp(symbol, hot[i]) == 0) {
+            return RAM_HOT;
+        }
+    }
+    if (strcmp(symbol, "record_cache") == 0 || strcmp(symbol, "cache_clock") == 0) {
+        return RAM_CACHE;
+    }
+    if (strcmp(symbol, "record_stats") == 0) {
+        return RAM_STATS;
+    }
+    return RAM_OTHER;
+}
+
+// Static data of the library by part, from the sizes nm reports for its data and bss symbols
+static void measure_ram(const char* library, size_t* parts)
+{
+    char command[512];
+    char line[256];
+
+    snprintf(command, sizeof(command), "%s -S --defined-only '%s'", BENCH_NM, library);
+    FILE* nm = popen(command, "r");
+    TEST_ASSERT(nm != NULL);
+    memset(parts, 0, RAM_PART_COUNT * sizeof(parts[0]));
+    while (fgets(line, sizeof(line), nm)) {
+        unsigned long long address;
+        unsigned long long size;
+        char type;
+        char symbol[128];
+        if (sscanf(line, "%llx %llx %c %127s", &address, &size, &type, symbol) != 4) {
+            continue;
+        }
+        if (type == 'b' || type == 'B' || type == 'd' || type == 'D') {
+            parts[ram_part_of(symbol)] += (size_t)size;
+        }
+    }
+    TEST_ASSERT(pclose(nm) == 0);
+    TEST_ASSERT(parts[RAM_HOT] > 0 && parts[RAM_CACHE] > 0);
+}
+
+static void make_bssid(int i, uint8_t* bssid)
+{
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x19, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(bssid, mac, 6);
+}
+
+// Store the records in both layouts and build a scan that sees a few of them
+static void fill(void)
+{
+    TEST_ASSERT_OK(ap_records_clear_all());
+    memset(&old_records, 0, sizeof(old_records));
+    for (int i = 0; i < CONFIG_MAX_AP_COUNT; i++) {
+        bench_old_info_t* old = &old_records.ap_list[i];
+        char ssid[33];
+        char password[65];
+
+        snprintf(ssid, sizeof(ssid), "layout-network-%03d", i);
+        snprintf(password, sizeof(password), "layout-password-%03d", i);
+        make_bssid(i, stored_bssids[i]);
+        TEST_ASSERT_OK(ap_records_add(ssid, password, stored_bssids[i]));
+        strcpy((char*)old->ssid, ssid);
+        strcpy((char*)old->password, password);
+        memcpy(old->bssid, stored_bssids[i], 6);
+        old->use_count = 1;
+    }
+    old_records.available_records = CONFIG_MAX_AP_COUNT;
+    TEST_ASSERT_OK(ap_records_save());
+
+    for (int s = 0; s < BENCH_SCAN_COUNT; s++) {
+        wifi_ap_record_t* ap = &scan[s];
+        int stored = (s * CONFIG_MAX_AP_COUNT) / BENCH_SCAN_STORED;
+        memset(ap, 0, sizeof(*ap));
+        if (s < BENCH_SCAN_STORED && stored < CONFIG_MAX_AP_COUNT) {
+            snprintf((char*)ap->ssid, sizeof(ap->ssid), "layout-network-%03d", stored);
+            memcpy(ap->bssid, stored_bssids[stored], 6);
+        } else {
+            snprintf((char*)ap->ssid, sizeof(ap->ssid), "neighbour-%03d", s);
+            make_bssid(0x100 + s, ap->bssid);
+        }
+        ap->rssi = (int8_t)(-40 - s);
+        ap->primary = 1 + s % 11;
+        ap->authmode = WIFI_AUTH_WPA2_PSK;
+    }
+}
+
+static int old_find_by_ssid(const char* ssid, bench_old_info_t* info)
+{
+    for (int i = 0; i < old_records.available_records; i++) {
+        if (strcmp((char*)old_records.ap_list[i].ssid, ssid) == 0) {
+            memcpy(info, &old_records.ap_list[i], sizeof(*info));
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int old_find_by_bssid(const uint8_t* bssid, bench_old_info_t* info)
+{
+    for (int i = 0; i < old_records.available_records; i++) {
+        if (memcmp(old_records.ap_list[i].bssid, bssid, 6) == 0) {
+            memcpy(info, &old_records.ap_list[i], sizeof(*info));
+            return i;
+        }
+    }
+    return -1;
+}
+
+typedef enum {
+    BENCH_MATCH_SCAN = 0,
+    BENCH_FIND_BSSID,
+    BENCH_SSID_MISS,
+    BENCH_LOOKUP_COUNT,
+} bench_lookup_t;
+
+static const char* const bench_lookup_names[] = {"match scan", "find_by_bssid", "ssid miss"};
+
+static uint64_t time_old(bench_lookup_t lookup, int iterations)
+{
+    bench_old_info_t info;
+    volatile int sink = 0;
+
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        switch (lookup) {
+        case BENCH_MATCH_SCAN:
+            for (int s = 0; s < BENCH_SCAN_COUNT; s++) {
+                sink += old_find_by_ssid((const char*)scan[s].ssid, &info);
+            }
+            break;
+        case BENCH_FIND_BSSID:
+            sink += old_find_by_bssid(stored_bssids[(i * 7) % CONFIG_MAX_AP_COUNT], &info);
+            break;
+        case BENCH_SSID_MISS:
+            sink += old_find_by_ssid((const char*)scan[BENCH_SCAN_COUNT - 1].ssid, &info);
+            break;
+        default:
+            break;
+        }
+    }
+    return host_now_ns() - start;
+}
+
+static uint64_t time_new(bench_lookup_t lookup, int iterations)
+{
+    ap_records_candidate_t candidates[BENCH_SCAN_COUNT];
+    int index;
+
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        int count = BENCH_SCAN_COUNT;
+        switch (lookup) {
+        case BENCH_MATCH_SCAN:
+            TEST_ASSERT_OK(ap_records_match_scan(scan, BENCH_SCAN_COUNT, candidates, &count));
+            break;
+        case BENCH_FIND_BSSID:
+            TEST_ASSERT_OK(ap_records_find_by_bssid(stored_bssids[(i * 7) % CONFIG_MAX_AP_COUNT], NULL, &index));
+            break;
+        case BENCH_SSID_MISS:
+            TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND,
+                            ap_records_find_by_ssid((const char*)scan[BENCH_SCAN_COUNT - 1].ssid, NULL, &index));
+            break;
+        default:
+            break;
+        }
+    }
+    return host_now_ns() - start;
+}
+
+int main(int argc, char** argv)
+{
+    TEST_ASSERT(argc > 1);
+    const char* library = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+    size_t parts[RAM_PART_COUNT];
+    size_t total = 0;
+
+    TEST_ASSERT(iterations > 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    measure_ram(library, parts);
+    printf("CONFIG_MAX_AP_COUNT %d, CONFIG_AP_RECORDS_CACHE_SIZE %d\n", CONFIG_MAX_AP_COUNT,
+           CONFIG_AP_RECORDS_CACHE_SIZE);
+    printf("%-18s %10s %12s\n", "RAM", "bytes", "per record");
+    for (int part = 0; part < RAM_PART_COUNT; part++) {
+        printf("%-18s %10zu %12.1f\n", ram_part_names[part], parts[part], (double)parts[part] / CONFIG_MAX_AP_COUNT);
+        total += parts[part];
+    }
+    printf("%-18s %10zu %12.1f\n", "total", total, (double)total / CONFIG_MAX_AP_COUNT);
+    printf("%-18s %10zu %12.1f\n", "ap_info_t array", sizeof(old_records),
+           (double)sizeof(old_records) / CONFIG_MAX_AP_COUNT);
+
+    fill();
+    printf("\n%d lookups each, match scan over %d networks with %d stored\n", iterations, BENCH_SCAN_COUNT,
+           BENCH_SCAN_STORED);
+    printf("%-18s %10s %10s %10s\n", "lookup", "array ns", "split ns", "split nvs");
+    for (int lookup = 0; lookup < BENCH_LOOKUP_COUNT; lookup++) {
+        uint64_t old_ns = time_old(lookup, iterations);
+
+        nvs_host_stats_t nvs;
+        nvs_host_reset_stats();
+        uint64_t new_ns = time_new(lookup, iterations);
+        nvs_host_get_stats(&nvs);
+
+        uint32_t nvs_calls = nvs.opens + nvs.gets + nvs.sets + nvs.erases + nvs.commits;
+        printf("%-18s %10.1f %10.1f %10.3f\n", bench_lookup_names[lookup], (double)old_ns / iterations,
+               (double)new_ns / iterations, (double)nvs_calls / iterations);
+    }
+    return 0;
+}
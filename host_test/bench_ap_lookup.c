@@ -0,0 +1,184 @@
+/* bench_ap_lookup.c - hash lookups against the linear scan they replaced
+ *
+ * Usage: bench_ap_lookup [iterations]
+ *
+ * Stores 1 to CONFIG_MAX_AP_COUNT records and looks them up by SSID and by
+ * BSSID through ap_records_find_by_ssid() and ap_records_find_by_bssid(), and
+ * through the strcmp/memcmp scan over an ap_info_t array that the lookups did
+ * before the hash index. SSID misses are the common case: a scan reports
+ * mostly networks that were never stored. Reports per lookup the host time of
+ * both and the NVS calls of the hash lookup, which confirms a hash match
+ * against the stored SSID and may have to read the record when it is not
+ * cached. Host times only rank the two against each other.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+#define BENCH_QUERIES 64
+
+// ap_info_t as it was before the hash index, searched the way it was
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t password[65];
+    uint8_t bssid[6];
+    uint8_t use_count;
+} bench_linear_info_t;
+
+static bench_linear_info_t linear_list[CONFIG_MAX_AP_COUNT];
+static int linear_count = 0;
+
+static char hit_ssids[BENCH_QUERIES][33];
+static char miss_ssids[BENCH_QUERIES][33];
+static uint8_t hit_bssids[BENCH_QUERIES][6];
+
+static int linear_find_by_ssid(const char* ssid, bench_linear_info_t* info)
+{
+    for (int i = 0; i < linear_count; i++) {
+        if (strcmp((char*)linear_list[i].ssid, ssid) == 0) {
+            memcpy(info, &linear_list[i], sizeof(*info));
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int linear_find_by_bssid(const uint8_t* bssid, bench_linear_info_t* info)
+{
+    for (int i = 0; i < linear_count; i++) {
+        if (memcmp(linear_list[i].bssid, bssid, 6) == 0) {
+            memcpy(info, &linear_list[i], sizeof(*info));
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void make_bssid(int i, uint8_t* bssid)
+{
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x3c, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(bssid, mac, 6);
+}
+
+// Store count records in both layouts; the queries cycle over them
+static void fill(int count)
+{
+    TEST_ASSERT_OK(ap_records_clear_all());
+    memset(linear_list, 0, sizeof(linear_list));
+    for (int i = 0; i < count; i++) {
+        char ssid[33];
+        char password[65];
+        uint8_t bssid[6];
+
+        snprintf(ssid, sizeof(ssid), "lookup-network-%03d", i);
+        snprintf(password, sizeof(password), "lookup-password-%03d", i);
+        make_bssid(i, bssid);
+        TEST_ASSERT_OK(ap_records_add(ssid, password, bssid));
+        strcpy((char*)linear_list[i].ssid, ssid);
+        strcpy((char*)linear_list[i].password, password);
+        memcpy(linear_list[i].bssid, bssid, 6);
+        linear_list[i].use_count = 1;
+    }
+    linear_count = count;
+    TEST_ASSERT_OK(ap_records_save());
+
+    for (int q = 0; q < BENCH_QUERIES; q++) {
+        int i = (q * 7) % count;
+        snprintf(hit_ssids[q], sizeof(hit_ssids[q]), "lookup-network-%03d", i);
+        snprintf(miss_ssids[q], sizeof(miss_ssids[q]), "scanned-only-%03d", q);
+        make_bssid(i, hit_bssids[q]);
+    }
+}
+
+typedef enum {
+    BENCH_SSID_HIT = 0,
+    BENCH_SSID_MISS,
+    BENCH_BSSID_HIT,
+} bench_lookup_t;
+
+static const char* const bench_lookup_names[] = {"ssid hit", "ssid miss", "bssid hit"};
+
+static uint64_t time_linear(bench_lookup_t lookup, int iterations)
+{
+    bench_linear_info_t info;
+    volatile int sink = 0;
+
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        int q = i % BENCH_QUERIES;
+        switch (lookup) {
+        case BENCH_SSID_HIT:
+            sink += linear_find_by_ssid(hit_ssids[q], &info);
+            break;
+        case BENCH_SSID_MISS:
+            sink += linear_find_by_ssid(miss_ssids[q], &info);
+            break;
+        case BENCH_BSSID_HIT:
+            sink += linear_find_by_bssid(hit_bssids[q], &info);
+            break;
+        }
+    }
+    return host_now_ns() - start;
+}
+
+static uint64_t time_hash(bench_lookup_t lookup, int iterations)
+{
+    ap_info_t info;
+    int index;
+
+    uint64_t start = host_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        int q = i % BENCH_QUERIES;
+        switch (lookup) {
+        case BENCH_SSID_HIT:
+            TEST_ASSERT_OK(ap_records_find_by_ssid(hit_ssids[q], &info, &index));
+            break;
+        case BENCH_SSID_MISS:
+            TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_find_by_ssid(miss_ssids[q], &info, &index));
+            break;
+        case BENCH_BSSID_HIT:
+            TEST_ASSERT_OK(ap_records_find_by_bssid(hit_bssids[q], &info, &index));
+            break;
+        }
+    }
+    return host_now_ns() - start;
+}
+
+static void bench(int count, int iterations)
+{
+    fill(count);
+    for (int lookup = BENCH_SSID_HIT; lookup <= BENCH_BSSID_HIT; lookup++) {
+        uint64_t linear_ns = time_linear(lookup, iterations);
+
+        nvs_host_stats_t nvs;
+        nvs_host_reset_stats();
+        uint64_t hash_ns = time_hash(lookup, iterations);
+        nvs_host_get_stats(&nvs);
+
+        uint32_t nvs_calls = nvs.opens + nvs.gets + nvs.sets + nvs.erases + nvs.commits;
+        printf("%8d %-10s %10.1f %10.1f %10.3f\n", count, bench_lookup_names[lookup],
+               (double)linear_ns / iterations, (double)hash_ns / iterations,
+               (double)nvs_calls / iterations);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    TEST_ASSERT(iterations > 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    printf("CONFIG_MAX_AP_COUNT %d, CONFIG_AP_RECORDS_CACHE_SIZE %d, %d lookups each\n",
+           CONFIG_MAX_AP_COUNT, CONFIG_AP_RECORDS_CACHE_SIZE, iterations);
+    printf("%8s %-10s %10s %10s %10s\n", "records", "lookup", "linear ns", "hash ns", "hash nvs");
+    for (int count = 1; count <= CONFIG_MAX_AP_COUNT; count *= 2) {
+        bench(count, iterations);
+    }
+    return 0;
+}
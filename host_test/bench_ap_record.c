@@ -0,0 +1,125 @@
+/* bench_ap_record.c - cost of the ap_records operations on the NVS stand-in
+ *
+ * Usage: bench_ap_record [iterations]
+ *
+ * Reports per operation the host time, the NVS calls made and the flash
+ * bytes programmed and sectors erased by the stand-in, with
+ * CONFIG_MAX_AP_COUNT records stored. Host times only rank the operations
+ * against each other; the flash columns carry over to the device.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+typedef struct {
+    uint64_t start_ns;
+    nvs_host_stats_t start;
+} bench_mark_t;
+
+static void bench_begin(bench_mark_t* mark)
+{
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    nvs_host_get_stats(&mark->start);
+    mark->start_ns = host_now_ns();
+}
+
+static void bench_end(const bench_mark_t* mark, const char* name, int iterations)
+{
+    uint64_t elapsed = host_now_ns() - mark->start_ns;
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    nvs_host_stats_t end;
+    nvs_host_get_stats(&end);
+
+    uint32_t calls = (end.opens - mark->start.opens) + (end.gets - mark->start.gets) +
+                     (end.sets - mark->start.sets) + (end.erases - mark->start.erases) +
+                     (end.commits - mark->start.commits);
+    uint32_t entries = end.entries_written - mark->start.entries_written;
+    uint32_t page_erases = end.page_erases - mark->start.page_erases;
+    printf("%-28s %10.0f %10.2f %12.1f %12.4f\n", name, (double)elapsed / iterations,
+           (double)calls / iterations, (double)entries * NVS_HOST_ENTRY_SIZE / iterations,
+           (double)page_erases / iterations);
+}
+
+static void fill_records(void)
+{
+    TEST_ASSERT_OK(ap_records_clear_all());
+    for (int i = 0; i < CONFIG_MAX_AP_COUNT; i++) {
+        char ssid[33];
+        char password[65];
+        uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0, (uint8_t)(i >> 8), (uint8_t)i};
+        snprintf(ssid, sizeof(ssid), "bench-network-%03d", i);
+        snprintf(password, sizeof(password), "bench-password-%03d", i);
+        TEST_ASSERT_OK(ap_records_add(ssid, password, bssid));
+    }
+    TEST_ASSERT_OK(ap_records_save());
+}
+
+// Connects spread over the given number of records; every CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES of them fold the log
+static void bench_use_count(const char* name, int spread, int iterations)
+{
+    bench_mark_t mark;
+    char ssid[33];
+
+    bench_begin(&mark);
+    for (int i = 0; i < iterations; i++) {
+        snprintf(ssid, sizeof(ssid), "bench-network-%03d", (i * 7) % spread);
+        TEST_ASSERT_OK(ap_records_increment_use_count(ssid));
+    }
+    bench_end(&mark, name, iterations);
+}
+
+static void bench_find(int iterations)
+{
+    bench_mark_t mark;
+    char ssid[33];
+    ap_info_t info;
+    int index;
+
+    bench_begin(&mark);
+    for (int i = 0; i < iterations; i++) {
+        snprintf(ssid, sizeof(ssid), "bench-network-%03d", (i * 7) % CONFIG_MAX_AP_COUNT);
+        TEST_ASSERT_OK(ap_records_find_by_ssid(ssid, NULL, &index));
+    }
+    bench_end(&mark, "find_by_ssid (index only)", iterations);
+
+    bench_begin(&mark);
+    for (int i = 0; i < iterations; i++) {
+        snprintf(ssid, sizeof(ssid), "bench-network-%03d", (i * 7) % CONFIG_MAX_AP_COUNT);
+        TEST_ASSERT_OK(ap_records_find_by_ssid(ssid, &info, &index));
+    }
+    bench_end(&mark, "find_by_ssid (record)", iterations);
+}
+
+static void bench_load(int iterations)
+{
+    bench_mark_t mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < iterations; i++) {
+        TEST_ASSERT_OK(ap_records_load());
+    }
+    bench_end(&mark, "load", iterations);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+    TEST_ASSERT(iterations > 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+    fill_records();
+
+    printf("CONFIG_MAX_AP_COUNT %d, CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES %d, %d iterations per operation\n",
+           CONFIG_MAX_AP_COUNT, CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES, iterations);
+    printf("%-28s %10s %10s %12s %12s\n", "op", "ns/op", "nvs/op", "flash B/op", "erases/op");
+    bench_use_count("increment_use_count (1 AP)", 1, iterations);
+    bench_use_count("increment_use_count (all)", CONFIG_MAX_AP_COUNT, iterations);
+    bench_find(iterations);
+    bench_load(iterations < 200 ? iterations : 200);
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* bench_blob_storage.c - latency and flash cost of the blob_storage operations
+ *
+ * Usage: bench_blob_storage [iterations]
+ *
+ * For each blob size, times write, read, exists and get_stats on a plain
+ * handle, and reports per operation the host time, the NVS calls made and the
+ * flash bytes programmed and sectors erased by the stand-in. Then writes N
+ * blobs of one namespace as N separate blob_storage_write() calls and as one
+ * batch, and reports the same per round of N writes. Last, stores N small
+ * blobs under N keys and as one packed container, and reports the flash they
+ * occupy and the cost of updating and reading one of them. Host times only
+ * rank the operations against each other; the flash columns carry over to
+ * the device.
+ */
+#include "blob_storage.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+#define BENCH_NAMESPACE "bench"
+#define BENCH_MAX_SIZE 4000
+#define BENCH_BATCH_SIZE 64         // Blob size of the batch rounds
+#define BENCH_BATCH_MAX 8           // Most blobs per batch round
+#define BENCH_PACK_SIZE 16          // Blob size of the pack rounds
+#define BENCH_PACK_MAX 64           // Most blobs per pack round
+
+typedef enum {
+    BENCH_WRITE = 0,
+    BENCH_READ,
+    BENCH_EXISTS,
+    BENCH_STATS,
+} bench_op_t;
+
+static const char* const bench_op_names[] = {"write", "read", "exists", "stats"};
+
+static uint8_t bench_data[BENCH_MAX_SIZE];
+static uint8_t bench_out[BENCH_MAX_SIZE];
+
+static void run_op(blob_storage_handle_t* handle, bench_op_t op, size_t size, int i)
+{
+    size_t out_size = sizeof(bench_out);
+    size_t max_size;
+    bool exists;
+
+    switch (op) {
+    case BENCH_WRITE:
+        bench_data[0] = (uint8_t)i;     // Defeat unchanged-write elision
+        TEST_ASSERT_OK(blob_storage_write(handle, bench_data, size));
+        break;
+    case BENCH_READ:
+        TEST_ASSERT_OK(blob_storage_read(handle, bench_out, &out_size));
+        break;
+    case BENCH_EXISTS:
+        TEST_ASSERT_OK(blob_storage_exists(handle, &exists, &out_size));
+        break;
+    case BENCH_STATS:
+        TEST_ASSERT_OK(blob_storage_get_stats(handle, &out_size, &max_size));
+        break;
+    }
+}
+
+static void bench(const char* label, uint32_t flags, size_t size, int iterations)
+{
+    for (int op = BENCH_WRITE; op <= BENCH_STATS; op++) {
+        nvs_host_reset(NVS_HOST_DEFAULT_PAGES);
+        blob_storage_handle_t handle;
+        TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, BENCH_NAMESPACE, "blob", BENCH_MAX_SIZE, flags));
+        TEST_ASSERT_OK(blob_storage_write(&handle, bench_data, size));
+        nvs_host_reset_stats();
+
+        uint64_t start = host_now_ns();
+        for (int i = 0; i < iterations; i++) {
+            run_op(&handle, op, size, i + 1);
+        }
+        uint64_t elapsed = host_now_ns() - start;
+
+        nvs_host_stats_t nvs;
+        nvs_host_get_stats(&nvs);
+        uint32_t nvs_calls = nvs.opens + nvs.gets + nvs.sets + nvs.erases + nvs.commits;
+        printf("%-10s %6zu %-7s %10.0f %10.2f %12.1f %12.3f\n", label, size, bench_op_names[op],
+               (double)elapsed / iterations,
+               (double)nvs_calls / iterations,
+               (double)nvs.entries_written * NVS_HOST_ENTRY_SIZE / iterations,
+               (double)nvs.page_erases / iterations);
+        TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+    }
+}
+
+// N writes to N blobs per round, either one call each or one batch
+static void bench_batch(const char* label, uint32_t flags, int blobs, bool batched, int iterations)
+{
+    blob_storage_handle_t handles[BENCH_BATCH_MAX];
+    blob_storage_batch_op_t ops[BENCH_BATCH_MAX];
+    blob_storage_batch_t batch;
+    char key[16];
+
+    nvs_host_reset(NVS_HOST_DEFAULT_PAGES);
+    for (int b = 0; b < blobs; b++) {
+        snprintf(key, sizeof(key), "blob%d", b);
+        TEST_ASSERT_OK(blob_storage_create_handle_ex(&handles[b], BENCH_NAMESPACE, key, BENCH_MAX_SIZE, flags));
+        TEST_ASSERT_OK(blob_storage_write(&handles[b], bench_data, BENCH_BATCH_SIZE));
+    }
+    nvs_host_reset_stats();
+
+    uint64_t start = host_now_ns();
+    for (int i = 1; i <= iterations; i++) {
+        bench_data[0] = (uint8_t)i;     // Defeat unchanged-write elision
+        if (batched) {
+            TEST_ASSERT_OK(blob_storage_batch_begin(&batch, ops, BENCH_BATCH_MAX));
+            for (int b = 0; b < blobs; b++) {
+                TEST_ASSERT_OK(blob_storage_batch_add(&batch, &handles[b], bench_data, BENCH_BATCH_SIZE));
+            }
+            TEST_ASSERT_OK(blob_storage_batch_commit(&batch));
+        } else {
+            for (int b = 0; b < blobs; b++) {
+                TEST_ASSERT_OK(blob_storage_write(&handles[b], bench_data, BENCH_BATCH_SIZE));
+            }
+        }
+    }
+    uint64_t elapsed = host_now_ns() - start;
+
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    uint32_t nvs_calls = nvs.opens + nvs.gets + nvs.sets + nvs.erases + nvs.commits;
+    printf("%-10s %6d %-9s %10.0f %10.2f %10.2f %12.1f %12.3f\n", label, blobs, batched ? "batch" : "separate",
+           (double)elapsed / iterations,
+           (double)nvs_calls / iterations,
+           (double)nvs.commits / iterations,
+           (double)nvs.entries_written * NVS_HOST_ENTRY_SIZE / iterations,
+           (double)nvs.page_erases / iterations);
+    for (int b = 0; b < blobs; b++) {
+        TEST_ASSERT_OK(blob_storage_close_handle(&handles[b]));
+    }
+}
+
+// N small blobs under N keys or in one pack: flash held, then one update and one read per iteration
+static void bench_pack(int blobs, bool packed, int iterations)
+{
+    static blob_storage_handle_t handles[BENCH_PACK_MAX];
+    blob_storage_pack_t pack;
+    char key[16];
+    size_t pack_size = 4 + blobs * (3 + 6 + BENCH_PACK_SIZE);     // Header, then per entry header, name, data
+
+    nvs_host_reset(NVS_HOST_DEFAULT_PAGES);
+    if (packed) {
+        TEST_ASSERT_OK(blob_storage_pack_open(&pack, BENCH_NAMESPACE, "pack", pack_size, (uint16_t)blobs,
+                                              BLOB_STORAGE_FLAG_PERSISTENT));
+    }
+    for (int b = 0; b < blobs; b++) {
+        snprintf(key, sizeof(key), "blob%02d", b);
+        if (packed) {
+            TEST_ASSERT_OK(blob_storage_pack_set(&pack, key, bench_data, BENCH_PACK_SIZE));
+        } else {
+            TEST_ASSERT_OK(blob_storage_create_handle_ex(&handles[b], BENCH_NAMESPACE, key, BENCH_PACK_SIZE,
+                                                         BLOB_STORAGE_FLAG_PERSISTENT));
+            TEST_ASSERT_OK(blob_storage_write(&handles[b], bench_data, BENCH_PACK_SIZE));
+        }
+    }
+    uint32_t live_entries;
+    uint32_t erased_entries;
+    nvs_host_get_usage(&live_entries, &erased_entries);
+
+    nvs_host_reset_stats();
+    uint64_t start = host_now_ns();
+    for (int i = 1; i <= iterations; i++) {
+        int b = i % blobs;
+        bench_data[0] = (uint8_t)i;     // Defeat unchanged-write elision
+        if (packed) {
+            snprintf(key, sizeof(key), "blob%02d", b);
+            TEST_ASSERT_OK(blob_storage_pack_set(&pack, key, bench_data, BENCH_PACK_SIZE));
+        } else {
+            TEST_ASSERT_OK(blob_storage_write(&handles[b], bench_data, BENCH_PACK_SIZE));
+        }
+    }
+    uint64_t update_ns = host_now_ns() - start;
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+
+    start = host_now_ns();
+    for (int i = 1; i <= iterations; i++) {
+        int b = i % blobs;
+        size_t out_size = sizeof(bench_out);
+        if (packed) {
+            snprintf(key, sizeof(key), "blob%02d", b);
+            TEST_ASSERT_OK(blob_storage_pack_get(&pack, key, bench_out, &out_size));
+        } else {
+            TEST_ASSERT_OK(blob_storage_read(&handles[b], bench_out, &out_size));
+        }
+    }
+    uint64_t read_ns = host_now_ns() - start;
+
+    printf("%-9s %6d %10u %10.0f %12.1f %12.3f %10.0f\n", packed ? "pack" : "separate", blobs,
+           (unsigned)(live_entries * NVS_HOST_ENTRY_SIZE),
+           (double)update_ns / iterations,
+           (double)nvs.entries_written * NVS_HOST_ENTRY_SIZE / iterations,
+           (double)nvs.page_erases / iterations,
+           (double)read_ns / iterations);
+    if (packed) {
+        TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+    } else {
+        for (int b = 0; b < blobs; b++) {
+            TEST_ASSERT_OK(blob_storage_close_handle(&handles[b]));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    static const size_t sizes[] = {16, 64, 256, 1024, BENCH_MAX_SIZE};
+
+    TEST_ASSERT(iterations > 0);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_OK(blob_storage_init());
+    for (size_t i = 0; i < sizeof(bench_data); i++) {
+        bench_data[i] = (uint8_t)(i * 13);
+    }
+
+    printf("%d iterations per operation\n", iterations);
+    printf("%-10s %6s %-7s %10s %10s %12s %12s\n", "handle", "size", "op", "ns/op", "nvs/op", "flash B/op", "erases/op");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench("plain", BLOB_STORAGE_FLAG_NONE, sizes[i], iterations);
+        bench("pooled", BLOB_STORAGE_FLAG_PERSISTENT, sizes[i], iterations);
+        bench("ab", BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS, sizes[i], iterations);
+    }
+
+    static const int batch_blobs[] = {2, 4, BENCH_BATCH_MAX};
+    printf("\n%d rounds of N writes of %d bytes, costs per round\n", iterations, BENCH_BATCH_SIZE);
+    printf("%-10s %6s %-9s %10s %10s %10s %12s %12s\n", "handle", "N", "writes", "ns/round", "nvs/round",
+           "commits", "flash B", "erases");
+    for (size_t i = 0; i < sizeof(batch_blobs) / sizeof(batch_blobs[0]); i++) {
+        bench_batch("plain", BLOB_STORAGE_FLAG_NONE, batch_blobs[i], false, iterations);
+        bench_batch("plain", BLOB_STORAGE_FLAG_NONE, batch_blobs[i], true, iterations);
+        bench_batch("pooled", BLOB_STORAGE_FLAG_PERSISTENT, batch_blobs[i], false, iterations);
+        bench_batch("pooled", BLOB_STORAGE_FLAG_PERSISTENT, batch_blobs[i], true, iterations);
+    }
+
+    static const int pack_blobs[] = {4, 16, BENCH_PACK_MAX};
+    printf("\nN blobs of %d bytes, %d updates and reads of one of them\n", BENCH_PACK_SIZE, iterations);
+    printf("%-9s %6s %10s %10s %12s %12s %10s\n", "storage", "N", "flash B", "ns/update", "flash B/upd",
+           "erases/upd", "ns/read");
+    for (size_t i = 0; i < sizeof(pack_blobs) / sizeof(pack_blobs[0]); i++) {
+        bench_pack(pack_blobs[i], false, iterations);
+        bench_pack(pack_blobs[i], true, iterations);
+    }
+    return 0;
+}
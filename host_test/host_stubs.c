@@ -0,0 +1,586 @@
+/* host_stubs.c - ESP-IDF and FreeRTOS services used by the component, on pthreads */
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+esp_log_level_t esp_log_host_level = ESP_LOG_WARN;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    (void)tag;
+    esp_log_host_level = level;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH: return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_READ_ONLY: return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_NAME: return "ESP_ERR_NVS_INVALID_NAME";
+    case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_KEY_TOO_LONG: return "ESP_ERR_NVS_KEY_TOO_LONG";
+    case ESP_ERR_NVS_INVALID_STATE: return "ESP_ERR_NVS_INVALID_STATE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_VALUE_TOO_LONG: return "ESP_ERR_NVS_VALUE_TOO_LONG";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    pthread_once(&crc_table_once, init_crc_table);
+
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/* Shutdown handlers */
+
+#define HOST_SHUTDOWN_HANDLERS 8
+static shutdown_handler_t shutdown_handlers[HOST_SHUTDOWN_HANDLERS];
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle)
+{
+    for (int i = 0; i < HOST_SHUTDOWN_HANDLERS; i++) {
+        if (shutdown_handlers[i] == handle) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (!shutdown_handlers[i]) {
+            shutdown_handlers[i] = handle;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void esp_restart(void)
+{
+    for (int i = HOST_SHUTDOWN_HANDLERS - 1; i >= 0; i--) {
+        if (shutdown_handlers[i]) {
+            shutdown_handlers[i]();
+        }
+    }
+}
+
+/* Time */
+
+static struct timespec deadline_after_us(uint64_t us)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (time_t)(us / 1000000);
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static void init_cond(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Wait on cond until woken or ticks pass; false on timeout
+static bool wait_ticks(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t ticks, const struct timespec* deadline)
+{
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* One-shot timers, each served by its own thread */
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool armed;
+    struct timespec deadline;
+};
+
+static void* timer_thread(void* arg)
+{
+    struct esp_timer* timer = arg;
+
+    pthread_mutex_lock(&timer->mutex);
+    for (;;) {
+        if (!timer->armed) {
+            pthread_cond_wait(&timer->cond, &timer->mutex);
+            continue;
+        }
+        if (pthread_cond_timedwait(&timer->cond, &timer->mutex, &timer->deadline) == ETIMEDOUT && timer->armed) {
+            timer->armed = false;
+            pthread_mutex_unlock(&timer->mutex);
+            timer->args.callback(timer->args.arg);
+            pthread_mutex_lock(&timer->mutex);
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct esp_timer* timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->args = *create_args;
+    pthread_mutex_init(&timer->mutex, NULL);
+    init_cond(&timer->cond);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, timer_thread, timer) != 0) {
+        free(timer);
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(thread);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    pthread_mutex_lock(&timer->mutex);
+    if (timer->armed) {
+        pthread_mutex_unlock(&timer->mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = true;
+    timer->deadline = deadline_after_us(timeout_us);
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timer->mutex);
+    esp_err_t err = timer->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->mutex);
+    return err;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timer->mutex);
+    bool armed = timer->armed;
+    pthread_mutex_unlock(&timer->mutex);
+    return armed;
+}
+
+/* Tasks */
+
+typedef struct {
+    TaskFunction_t task;
+    void* arg;
+} host_task_start_t;
+
+static void* task_thread(void* arg)
+{
+    host_task_start_t start = *(host_task_start_t*)arg;
+    free(arg);
+    start.task(start.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* created_task)
+{
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+
+    host_task_start_t* start = malloc(sizeof(*start));
+    if (!start) {
+        return pdFAIL;
+    }
+    start->task = task;
+    start->arg = arg;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_thread, start) != 0) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task) {
+        *created_task = (TaskHandle_t)(uintptr_t)thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)pdTICKS_TO_MS(ticks) * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / (1000000 / configTICK_RATE_HZ));
+}
+
+// Same value xTaskCreate() hands out for the task's thread
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)(uintptr_t)pthread_self();
+}
+
+/* Semaphores */
+
+typedef enum {
+    HOST_SEM_BINARY,
+    HOST_SEM_MUTEX,
+    HOST_SEM_RECURSIVE,
+} host_sem_type_t;
+
+struct host_semaphore {
+    host_sem_type_t type;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int count;                  // Binary and mutex: 1 if it can be taken
+    pthread_t owner;            // Recursive: holder while depth > 0
+    int depth;
+};
+
+static SemaphoreHandle_t create_semaphore(host_sem_type_t type, int count)
+{
+    SemaphoreHandle_t sem = calloc(1, sizeof(*sem));
+    if (!sem) {
+        return NULL;
+    }
+    sem->type = type;
+    sem->count = count;
+    pthread_mutex_init(&sem->mutex, NULL);
+    init_cond(&sem->cond);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return create_semaphore(HOST_SEM_RECURSIVE, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return create_semaphore(HOST_SEM_MUTEX, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return create_semaphore(HOST_SEM_BINARY, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_destroy(&semaphore->mutex);
+    pthread_cond_destroy(&semaphore->cond);
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after_us((uint64_t)pdTICKS_TO_MS(ticks) * 1000);
+    BaseType_t taken = pdTRUE;
+
+    pthread_mutex_lock(&semaphore->mutex);
+    while (semaphore->count == 0) {
+        if (ticks == 0 || !wait_ticks(&semaphore->cond, &semaphore->mutex, ticks, &deadline)) {
+            taken = semaphore->count > 0;
+            break;
+        }
+    }
+    if (taken) {
+        semaphore->count = 0;
+    }
+    pthread_mutex_unlock(&semaphore->mutex);
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_lock(&semaphore->mutex);
+    BaseType_t given = semaphore->count == 0;
+    semaphore->count = 1;
+    pthread_cond_signal(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+    return given;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after_us((uint64_t)pdTICKS_TO_MS(ticks) * 1000);
+    pthread_t self = pthread_self();
+
+    pthread_mutex_lock(&semaphore->mutex);
+    while (semaphore->depth > 0 && !pthread_equal(semaphore->owner, self)) {
+        if (ticks == 0 || !wait_ticks(&semaphore->cond, &semaphore->mutex, ticks, &deadline)) {
+            if (semaphore->depth > 0 && !pthread_equal(semaphore->owner, self)) {
+                pthread_mutex_unlock(&semaphore->mutex);
+                return pdFALSE;
+            }
+        }
+    }
+    semaphore->owner = self;
+    semaphore->depth++;
+    pthread_mutex_unlock(&semaphore->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_lock(&semaphore->mutex);
+    if (semaphore->depth == 0 || !pthread_equal(semaphore->owner, pthread_self())) {
+        pthread_mutex_unlock(&semaphore->mutex);
+        return pdFALSE;
+    }
+    if (--semaphore->depth == 0) {
+        pthread_cond_signal(&semaphore->cond);
+    }
+    pthread_mutex_unlock(&semaphore->mutex);
+    return pdTRUE;
+}
+
+/* Queues */
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(*queue) + length * item_size);
+    if (!queue) {
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->mutex, NULL);
+    init_cond(&queue->not_empty);
+    init_cond(&queue->not_full);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after_us((uint64_t)pdTICKS_TO_MS(ticks) * 1000);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (ticks == 0 || (!wait_ticks(&queue->not_full, &queue->mutex, ticks, &deadline) &&
+                           queue->count == queue->length)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after_us((uint64_t)pdTICKS_TO_MS(ticks) * 1000);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (ticks == 0 || (!wait_ticks(&queue->not_empty, &queue->mutex, ticks, &deadline) &&
+                           queue->count == 0)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return spaces;
+}
+
+/* Partitions: a single data partition in RAM */
+
+#define HOST_PARTITION_SECTOR 4096
+
+static esp_partition_t host_partition;
+static uint8_t* host_partition_data = NULL;
+static int host_partition_mappings = 0;
+
+void esp_partition_host_set(const char* label, const void* image, size_t size)
+{
+    if (host_partition_mappings > 0) {
+        fprintf(stderr, "esp_partition_host_set: partition '%s' still mapped\n", host_partition.label);
+        abort();
+    }
+    free(host_partition_data);
+    host_partition_data = NULL;
+    memset(&host_partition, 0, sizeof(host_partition));
+    if (!label) {
+        return;
+    }
+
+    size_t partition_size = (size + HOST_PARTITION_SECTOR - 1) / HOST_PARTITION_SECTOR * HOST_PARTITION_SECTOR;
+    if (partition_size == 0) {
+        partition_size = HOST_PARTITION_SECTOR;
+    }
+    host_partition_data = malloc(partition_size);
+    if (!host_partition_data) {
+        abort();
+    }
+    memset(host_partition_data, 0xFF, partition_size);
+    if (size > 0) {
+        memcpy(host_partition_data, image, size);
+    }
+    host_partition.type = ESP_PARTITION_TYPE_DATA;
+    host_partition.subtype = (esp_partition_subtype_t)0x40;
+    host_partition.size = (uint32_t)partition_size;
+    host_partition.erase_size = HOST_PARTITION_SECTOR;
+    strncpy(host_partition.label, label, sizeof(host_partition.label) - 1);
+}
+
+int esp_partition_host_mapped(void)
+{
+    return host_partition_mappings;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label)
+{
+    if (!host_partition_data || (type != ESP_PARTITION_TYPE_ANY && type != host_partition.type) ||
+        (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != host_partition.subtype) ||
+        (label && strcmp(label, host_partition.label) != 0)) {
+        return NULL;
+    }
+    return &host_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (partition != &host_partition || !host_partition_data || !dst) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, host_partition_data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle)
+{
+    (void)memory;
+    if (partition != &host_partition || !host_partition_data || !out_ptr || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_ptr = host_partition_data + offset;
+    *out_handle = (esp_partition_mmap_handle_t)++host_partition_mappings;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+    if (handle == 0 || host_partition_mappings == 0) {
+        fprintf(stderr, "esp_partition_munmap: handle %u not mapped\n", (unsigned)handle);
+        abort();
+    }
+    host_partition_mappings--;
+}
@@ -0,0 +1,49 @@
+/* host_test.h - assertions and timing shared by the host tests and benchmarks */
+#pragma once
+
+#include "esp_err.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_ASSERT(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_ESP(expected, expr) do { \
+        esp_err_t test_err_ = (expr); \
+        if (test_err_ != (expected)) { \
+            fprintf(stderr, "%s:%d: %s returned %s, expected %s\n", __FILE__, __LINE__, #expr, \
+                    esp_err_to_name(test_err_), esp_err_to_name(expected)); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_OK(expr) TEST_ASSERT_ESP(ESP_OK, expr)
+
+#define RUN_TEST(fn) do { \
+        printf("%-48s", #fn); \
+        fflush(stdout); \
+        fn(); \
+        printf(" ok\n"); \
+    } while (0)
+
+static inline uint64_t host_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Deterministic xorshift32, so runs are reproducible from their seed
+static inline uint32_t host_rand(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
@@ -0,0 +1,648 @@
+/* nvs_host.c - in-memory NVS stand-in for host builds
+ *
+ * Blobs live in a list in RAM. Their flash footprint is modelled the way NVS
+ * lays them out: a blob is one or more chunks, each a header entry plus its
+ * data in 32-byte entries, that never cross a page, followed by a one entry
+ * blob index. Rewriting or erasing a blob only marks its entries erased. When
+ * no page is left, garbage collection moves the live entries of the page with
+ * the most erased ones into the spare page and erases that sector.
+ */
+#include "nvs_host.h"
+#include "nvs_flash.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NVS_HOST_NAME_MAX_LEN 15
+#define NVS_HOST_MAX_NAMESPACES 32
+#define NVS_HOST_MAX_HANDLES 64
+#define NVS_HOST_NAMESPACE_ITEM 0xFF    // Namespace of the items registering namespaces
+
+typedef enum {
+    PAGE_FREE = 0,
+    PAGE_ACTIVE,
+    PAGE_FULL,
+} page_state_t;
+
+typedef struct {
+    page_state_t state;
+    uint16_t used;              // Entries written since the page was erased
+    uint16_t erased;            // Of those, entries no longer live
+} page_t;
+
+typedef struct {
+    uint16_t page;
+    uint16_t count;
+} span_t;
+
+typedef struct item {
+    struct item* next;
+    uint8_t ns;
+    char key[NVS_HOST_NAME_MAX_LEN + 1];
+    uint8_t* data;
+    size_t size;
+    span_t* spans;              // Where its entries are on flash
+    int span_count;
+} item_t;
+
+typedef struct {
+    bool used;
+    bool writable;
+    uint8_t ns;
+} handle_t;
+
+static pthread_mutex_t nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
+static int page_count = 0;
+static int active_page = 0;
+static page_t pages[NVS_HOST_MAX_PAGES];
+static item_t* items = NULL;
+static char namespaces[NVS_HOST_MAX_NAMESPACES][NVS_HOST_NAME_MAX_LEN + 1];
+static int namespace_count = 0;
+static handle_t handles[NVS_HOST_MAX_HANDLES];
+static nvs_host_stats_t stats;
+
+// Power loss injection
+static bool fault_armed = false;
+static uint32_t fault_writes_left = 0;
+static nvs_host_fault_t fault_mode = NVS_HOST_FAULT_LOST;
+static size_t fault_torn_bytes = 0;
+static bool powered_off = false;
+
+// Read error injection
+static uint32_t failing_reads = 0;
+static esp_err_t failing_read_err = ESP_FAIL;
+
+static void free_item(item_t* item)
+{
+    free(item->data);
+    free(item->spans);
+    free(item);
+}
+
+static void format(int count)
+{
+    while (items) {
+        item_t* next = items->next;
+        free_item(items);
+        items = next;
+    }
+    memset(pages, 0, sizeof(pages));
+    memset(handles, 0, sizeof(handles));
+    memset(namespaces, 0, sizeof(namespaces));
+    namespace_count = 0;
+    page_count = (count < 2) ? 2 : (count > NVS_HOST_MAX_PAGES) ? NVS_HOST_MAX_PAGES : count;
+    active_page = 0;
+    pages[0].state = PAGE_ACTIVE;
+    initialized = true;
+}
+
+static int free_page_count(void)
+{
+    int count = 0;
+    for (int p = 0; p < page_count; p++) {
+        count += pages[p].state == PAGE_FREE;
+    }
+    return count;
+}
+
+static int take_free_page(void)
+{
+    for (int p = 0; p < page_count; p++) {
+        if (pages[p].state == PAGE_FREE) {
+            pages[p].state = PAGE_ACTIVE;
+            return p;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Move the live entries of the full page with the most erased entries into
+ * the spare page, which becomes the active page, and erase it. False if no
+ * page has anything to reclaim.
+ */
+static bool collect_garbage(void)
+{
+    int victim = -1;
+    for (int p = 0; p < page_count; p++) {
+        if (pages[p].state == PAGE_FULL && pages[p].erased > 0 &&
+            (victim < 0 || pages[p].erased > pages[victim].erased)) {
+            victim = p;
+        }
+    }
+    if (victim < 0) {
+        return false;
+    }
+
+    int target = take_free_page();
+    for (item_t* item = items; item; item = item->next) {
+        for (int s = 0; s < item->span_count; s++) {
+            span_t* span = &item->spans[s];
+            if (span->page == victim) {
+                span->page = (uint16_t)target;
+                pages[target].used += span->count;
+                stats.entries_written += span->count;
+                stats.entries_relocated += span->count;
+            }
+        }
+    }
+
+    pages[victim] = (page_t){ .state = PAGE_FREE };
+    stats.page_erases++;
+    active_page = target;
+    return true;
+}
+
+// Make room for need entries in the active page, moving on to a new page as NVS does
+static esp_err_t ensure_room(uint16_t need)
+{
+    while (NVS_HOST_PAGE_ENTRIES - pages[active_page].used < need) {
+        pages[active_page].state = PAGE_FULL;
+        // One page always stays free as the target of garbage collection
+        if (free_page_count() > 1) {
+            active_page = take_free_page();
+        } else if (!collect_garbage()) {
+            pages[active_page].state = PAGE_ACTIVE;
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+    }
+    return ESP_OK;
+}
+
+static void release_spans(item_t* item)
+{
+    for (int s = 0; s < item->span_count; s++) {
+        pages[item->spans[s].page].erased += item->spans[s].count;
+    }
+    free(item->spans);
+    item->spans = NULL;
+    item->span_count = 0;
+}
+
+static esp_err_t add_span(item_t* item, uint16_t count)
+{
+    span_t* spans = realloc(item->spans, (item->span_count + 1) * sizeof(span_t));
+    if (!spans) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->spans = spans;
+    item->spans[item->span_count++] = (span_t){ .page = (uint16_t)active_page, .count = count };
+    pages[active_page].used += count;
+    stats.entries_written += count;
+    return ESP_OK;
+}
+
+// Allocate the entries of a blob of size bytes: chunks of header + data, then the blob index
+static esp_err_t place_blob(item_t* item, size_t size)
+{
+    size_t data_entries = (size + NVS_HOST_ENTRY_SIZE - 1) / NVS_HOST_ENTRY_SIZE;
+    esp_err_t err = ESP_OK;
+
+    do {
+        err = ensure_room(2);
+        if (err != ESP_OK) {
+            break;
+        }
+        size_t room = NVS_HOST_PAGE_ENTRIES - pages[active_page].used - 1;
+        size_t chunk = (data_entries < room) ? data_entries : room;
+        err = add_span(item, (uint16_t)(chunk + 1));
+        data_entries -= chunk;
+    } while (err == ESP_OK && data_entries > 0);
+
+    if (err == ESP_OK) {
+        err = ensure_room(1);
+    }
+    if (err == ESP_OK) {
+        err = add_span(item, 1);
+    }
+    if (err != ESP_OK) {
+        release_spans(item);
+    }
+    return err;
+}
+
+static item_t* find_item(uint8_t ns, const char* key, item_t*** link_out)
+{
+    for (item_t** link = &items; *link; link = &(*link)->next) {
+        if ((*link)->ns == ns && strcmp((*link)->key, key) == 0) {
+            if (link_out) {
+                *link_out = link;
+            }
+            return *link;
+        }
+    }
+    return NULL;
+}
+
+static int find_namespace(const char* name)
+{
+    for (int i = 0; i < namespace_count; i++) {
+        if (strcmp(namespaces[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool valid_name(const char* name)
+{
+    return name && name[0] != '\0' && strlen(name) <= NVS_HOST_NAME_MAX_LEN;
+}
+
+// Validate a handle and the power state; caller holds nvs_mutex
+static esp_err_t check_handle(nvs_handle_t handle, bool write)
+{
+    if (powered_off) {
+        return ESP_FAIL;
+    }
+    if (handle == 0 || handle > NVS_HOST_MAX_HANDLES || !handles[handle - 1].used) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (write && !handles[handle - 1].writable) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    if (!initialized) {
+        format(NVS_HOST_DEFAULT_PAGES);
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    format(page_count ? page_count : NVS_HOST_DEFAULT_PAGES);
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+void nvs_host_reset(int count)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    // Handles in use by long-lived blob storage handles stay valid across the wipe
+    handle_t kept[NVS_HOST_MAX_HANDLES];
+    char kept_namespaces[NVS_HOST_MAX_NAMESPACES][NVS_HOST_NAME_MAX_LEN + 1];
+    int kept_namespace_count = namespace_count;
+    memcpy(kept, handles, sizeof(kept));
+    memcpy(kept_namespaces, namespaces, sizeof(kept_namespaces));
+
+    format(count);
+
+    memcpy(handles, kept, sizeof(handles));
+    memcpy(namespaces, kept_namespaces, sizeof(namespaces));
+    namespace_count = kept_namespace_count;
+    memset(&stats, 0, sizeof(stats));
+    fault_armed = false;
+    powered_off = false;
+    failing_reads = 0;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+void nvs_host_get_stats(nvs_host_stats_t* out)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+void nvs_host_reset_stats(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+void nvs_host_get_usage(uint32_t* live_entries, uint32_t* erased_entries)
+{
+    uint32_t used = 0;
+    uint32_t erased = 0;
+
+    pthread_mutex_lock(&nvs_mutex);
+    for (int p = 0; p < page_count; p++) {
+        used += pages[p].used;
+        erased += pages[p].erased;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+
+    *live_entries = used - erased;
+    *erased_entries = erased;
+}
+
+int nvs_host_open_handles(void)
+{
+    int open = 0;
+
+    pthread_mutex_lock(&nvs_mutex);
+    for (int i = 0; i < NVS_HOST_MAX_HANDLES; i++) {
+        open += handles[i].used;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return open;
+}
+
+void nvs_host_inject_power_loss(uint32_t writes_before, nvs_host_fault_t fault, size_t torn_bytes)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    fault_armed = true;
+    fault_writes_left = writes_before;
+    fault_mode = fault;
+    fault_torn_bytes = torn_bytes;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+bool nvs_host_powered_off(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    bool off = powered_off;
+    pthread_mutex_unlock(&nvs_mutex);
+    return off;
+}
+
+void nvs_host_power_cycle(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    fault_armed = false;
+    powered_off = false;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+void nvs_host_fail_reads(uint32_t count, esp_err_t err)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    failing_reads = count;
+    failing_read_err = err;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+esp_err_t nvs_host_peek(const char* namespace_name, const char* key, void* out_value, size_t* length)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    int ns = find_namespace(namespace_name);
+    item_t* item = (ns >= 0) ? find_item((uint8_t)ns, key, NULL) : NULL;
+    esp_err_t err = ESP_OK;
+    if (!item) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value && *length < item->size) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (out_value) {
+        memcpy(out_value, item->data, item->size);
+    }
+    if (item) {
+        *length = item->size;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return err;
+}
+
+esp_err_t nvs_host_corrupt(const char* namespace_name, const char* key, size_t offset)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    int ns = find_namespace(namespace_name);
+    item_t* item = (ns >= 0) ? find_item((uint8_t)ns, key, NULL) : NULL;
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (item && offset < item->size) {
+        item->data[offset] ^= 0xFF;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return err;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    if (!valid_name(namespace_name) || !out_handle) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = ESP_OK;
+    if (!initialized) {
+        err = ESP_ERR_NVS_NOT_INITIALIZED;
+    } else if (powered_off) {
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&nvs_mutex);
+        return err;
+    }
+    stats.opens++;
+
+    int ns = find_namespace(namespace_name);
+    if (ns < 0) {
+        if (open_mode == NVS_READONLY) {
+            pthread_mutex_unlock(&nvs_mutex);
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if (namespace_count == NVS_HOST_MAX_NAMESPACES) {
+            pthread_mutex_unlock(&nvs_mutex);
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+
+        // A namespace is registered with a one entry item
+        item_t* item = calloc(1, sizeof(item_t));
+        if (!item) {
+            pthread_mutex_unlock(&nvs_mutex);
+            return ESP_ERR_NO_MEM;
+        }
+        item->ns = NVS_HOST_NAMESPACE_ITEM;
+        strcpy(item->key, namespace_name);
+        err = ensure_room(1);
+        if (err == ESP_OK) {
+            err = add_span(item, 1);
+        }
+        if (err != ESP_OK) {
+            free_item(item);
+            pthread_mutex_unlock(&nvs_mutex);
+            return err;
+        }
+        item->next = items;
+        items = item;
+        ns = namespace_count++;
+        strcpy(namespaces[ns], namespace_name);
+    }
+
+    for (int i = 0; i < NVS_HOST_MAX_HANDLES; i++) {
+        if (!handles[i].used) {
+            handles[i] = (handle_t){ .used = true, .writable = open_mode == NVS_READWRITE, .ns = (uint8_t)ns };
+            *out_handle = (nvs_handle_t)(i + 1);
+            pthread_mutex_unlock(&nvs_mutex);
+            return ESP_OK;
+        }
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    if (handle > 0 && handle <= NVS_HOST_MAX_HANDLES) {
+        handles[handle - 1].used = false;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    if (!valid_name(key) || !length) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = check_handle(handle, false);
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&nvs_mutex);
+        return err;
+    }
+    stats.gets++;
+
+    item_t* item = find_item(handles[handle - 1].ns, key, NULL);
+    if (failing_reads > 0) {
+        failing_reads--;
+        err = failing_read_err;
+    } else if (!item) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (!out_value) {
+        *length = item->size;
+    } else if (*length < item->size) {
+        *length = item->size;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, item->data, item->size);
+        *length = item->size;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    if (!valid_name(key)) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (!value && length > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = check_handle(handle, true);
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&nvs_mutex);
+        return err;
+    }
+    stats.sets++;
+
+    uint8_t ns = handles[handle - 1].ns;
+    item_t* old = find_item(ns, key, NULL);
+
+    bool torn = false;
+    if (fault_armed) {
+        if (fault_writes_left == 0) {
+            fault_armed = false;
+            powered_off = true;
+            if (fault_mode == NVS_HOST_FAULT_LOST) {
+                pthread_mutex_unlock(&nvs_mutex);
+                return ESP_FAIL;
+            }
+            torn = true;
+        } else {
+            fault_writes_left--;
+        }
+    }
+
+    item_t* item = calloc(1, sizeof(item_t));
+    uint8_t* data = malloc(length ? length : 1);
+    if (!item || !data) {
+        free(item);
+        free(data);
+        pthread_mutex_unlock(&nvs_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    item->ns = ns;
+    strcpy(item->key, key);
+    item->size = length;
+    item->data = data;
+
+    if (torn) {
+        // A prefix of the new data, the rest is whatever the sectors held before
+        size_t prefix = (fault_torn_bytes < length) ? fault_torn_bytes : length;
+        memcpy(data, value, prefix);
+        for (size_t i = prefix; i < length; i++) {
+            data[i] = (old && i < old->size) ? old->data[i] : 0xFF;
+        }
+    } else if (length) {
+        memcpy(data, value, length);
+    }
+
+    // The new version is written before the old one is marked erased
+    err = place_blob(item, length);
+    if (err != ESP_OK) {
+        free_item(item);
+        pthread_mutex_unlock(&nvs_mutex);
+        return err;
+    }
+
+    item_t** link;
+    if (find_item(ns, key, &link)) {
+        item_t* replaced = *link;
+        item->next = replaced->next;
+        *link = item;
+        release_spans(replaced);
+        free_item(replaced);
+    } else {
+        item->next = items;
+        items = item;
+    }
+
+    stats.bytes_written += length;
+    pthread_mutex_unlock(&nvs_mutex);
+    return torn ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    if (!valid_name(key)) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = check_handle(handle, true);
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&nvs_mutex);
+        return err;
+    }
+    stats.erases++;
+
+    item_t** link;
+    item_t* item = find_item(handles[handle - 1].ns, key, &link);
+    if (!item) {
+        pthread_mutex_unlock(&nvs_mutex);
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *link = item->next;
+    release_spans(item);
+    free_item(item);
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = check_handle(handle, true);
+    if (err == ESP_OK) {
+        // NVS writes go to flash as they are made, like the IDF implementation
+        stats.commits++;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return err;
+}
@@ -0,0 +1,105 @@
+/* nvs_host.h - in-memory NVS stand-in for host builds */
+#pragma once
+
+#include "nvs.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NVS_HOST_PAGE_SIZE 4096         ///< Flash sector holding one NVS page
+#define NVS_HOST_PAGE_ENTRIES 126       ///< 32-byte entries per page after the page header and entry bitmap
+#define NVS_HOST_ENTRY_SIZE 32
+#define NVS_HOST_DEFAULT_PAGES 6        ///< The 0x6000 byte "nvs" partition of the default partition table
+#define NVS_HOST_MAX_PAGES 64
+
+/**
+ * @brief What the stand-in did to flash, see nvs_host_get_stats()
+ */
+typedef struct {
+    uint32_t opens;             ///< nvs_open calls
+    uint32_t gets;              ///< nvs_get_blob calls
+    uint32_t sets;              ///< nvs_set_blob calls
+    uint32_t erases;            ///< nvs_erase_key calls
+    uint32_t commits;           ///< nvs_commit calls
+    uint32_t entries_written;   ///< 32-byte entries programmed, including relocation by garbage collection
+    uint32_t entries_relocated; ///< Of those, entries moved by garbage collection
+    uint64_t bytes_written;     ///< Payload bytes passed to nvs_set_blob
+    uint32_t page_erases;       ///< Flash sectors erased by garbage collection
+} nvs_host_stats_t;
+
+/**
+ * @brief How an injected power loss hits the interrupted nvs_set_blob()
+ */
+typedef enum {
+    NVS_HOST_FAULT_LOST = 0,    ///< Nothing of the write reaches flash
+    NVS_HOST_FAULT_TORN,        ///< The key holds the new length, but only a prefix of the new data
+} nvs_host_fault_t;
+
+/**
+ * @brief Wipe the stand-in and format it with the given number of pages
+ * @note Blob storage handles stay bound to their NVS handles, which remain valid
+ */
+void nvs_host_reset(int pages);
+
+/**
+ * @brief Get the counters since the last nvs_host_reset_stats()
+ */
+void nvs_host_get_stats(nvs_host_stats_t* stats);
+
+void nvs_host_reset_stats(void);
+
+/**
+ * @brief Entries holding live data, and entries written but erased and not collected yet
+ */
+void nvs_host_get_usage(uint32_t* live_entries, uint32_t* erased_entries);
+
+/**
+ * @brief NVS handles opened and not closed yet
+ */
+int nvs_host_open_handles(void);
+
+/**
+ * @brief Cut the power during a later nvs_set_blob()
+ * @note The next writes_before calls succeed, the one after is interrupted as
+ *       described by fault and fails. Every NVS call after that fails with
+ *       ESP_FAIL until nvs_host_power_cycle().
+ * @param writes_before nvs_set_blob() calls that still complete
+ * @param fault What the interrupted write leaves behind
+ * @param torn_bytes Bytes of new data that reach flash for NVS_HOST_FAULT_TORN
+ */
+void nvs_host_inject_power_loss(uint32_t writes_before, nvs_host_fault_t fault, size_t torn_bytes);
+
+/**
+ * @brief Whether an injected power loss has happened and not been cleared
+ */
+bool nvs_host_powered_off(void);
+
+/**
+ * @brief Restore power; flash keeps what was written up to the power loss
+ */
+void nvs_host_power_cycle(void);
+
+/**
+ * @brief Fail the next nvs_get_blob() calls, as a transient read error would
+ * @param count nvs_get_blob() calls that fail, flash is left as it is
+ * @param err Error they return
+ */
+void nvs_host_fail_reads(uint32_t count, esp_err_t err);
+
+/**
+ * @brief Read a stored blob without going through a handle or the counters
+ * @return ESP_OK, ESP_ERR_NVS_NOT_FOUND, or ESP_ERR_NVS_INVALID_LENGTH with *length set to the size
+ */
+esp_err_t nvs_host_peek(const char* namespace_name, const char* key, void* out_value, size_t* length);
+
+/**
+ * @brief Flip the bits of one byte of a stored blob, as a flash bit error would
+ * @return ESP_OK, or ESP_ERR_NVS_NOT_FOUND if there is no such blob or byte
+ */
+esp_err_t nvs_host_corrupt(const char* namespace_name, const char* key, size_t offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,2 @@
+/* esp_eap_client.h - host build stand-in, nothing of it is used */
+#pragma once
@@ -0,0 +1,28 @@
+/* esp_netif.h - host build stand-in
+ *
+ * Declarations only: smartconfig.c, the one user, is compiled but not linked on the host.
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_netif_obj esp_netif_t;
+
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP = 0,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_create_default_wifi_sta(void);
+
+#ifdef __cplusplus
+}
+#endif
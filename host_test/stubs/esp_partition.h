@@ -0,0 +1,72 @@
+/* esp_partition.h - host build stand-in
+ *
+ * One data partition held in RAM stands in for flash, see esp_partition_host_set().
+ * Mapping it hands out a pointer into that RAM, like the flash cache on target.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+    ESP_PARTITION_TYPE_ANY = 0xff,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef enum {
+    ESP_PARTITION_MMAP_DATA,
+    ESP_PARTITION_MMAP_INST,
+} esp_partition_mmap_memory_t;
+
+typedef uint32_t esp_partition_mmap_handle_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+    bool encrypted;
+    bool readonly;
+} esp_partition_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+/**
+ * @brief Host build only: flash a data partition with the given contents
+ * @note The partition is the image rounded up to 4 KB sectors, the rest reads
+ *       as erased flash (0xFF). Replaces the previous partition, which must not
+ *       be mapped any more.
+ * @param label Partition label, NULL to remove the partition
+ * @param image Contents written from offset 0
+ * @param size Size of the contents
+ */
+void esp_partition_host_set(const char* label, const void* image, size_t size);
+
+/**
+ * @brief Host build only: mappings of the partition not unmapped yet
+ */
+int esp_partition_host_mapped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+/* esp_rom_crc.h - host build stand-in */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief CRC32 as computed by the ROM: zlib compatible, so crc of one call
+ *        can be passed as the start value of the next
+ */
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+/* esp_system.h - host build stand-in */
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+
+/**
+ * @brief Run the registered shutdown handlers like esp_restart() would, without exiting
+ */
+void esp_restart(void);
+
+#ifdef __cplusplus
+}
+#endif
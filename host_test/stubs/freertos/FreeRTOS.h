@@ -0,0 +1,26 @@
+/* FreeRTOS.h - host build stand-in, tasks and semaphores map to pthreads */
+#pragma once
+
+#include <assert.h>      // FreeRTOSConfig.h brings it in on target
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ  1000
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(t)    ((uint32_t)(((uint64_t)(t) * 1000) / configTICK_RATE_HZ))
+
+#ifdef __cplusplus
+}
+#endif
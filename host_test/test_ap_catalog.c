@@ -0,0 +1,195 @@
+/* test_ap_catalog.c - catalog images of tools/ap_catalog_gen.py read by ap_catalog.c and ap_records_match_scan()
+ *
+ * Usage: test_ap_catalog <image>
+ *
+ * The image is built from ap_catalog_test.csv at build time, so the generator's
+ * layout, its zlib.crc32 hashes and its bucket probing are checked against the
+ * C reader and esp_rom_crc32_le(0, ...).
+ */
+#include "ap_catalog.h"
+#include "ap_record.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+#include "host_test.h"
+#include <string.h>
+
+#define CATALOG_BUCKETS 16          // 8 entries, at most half full
+
+typedef struct {
+    const char* ssid;
+    const char* password;
+    uint8_t bssid[6];
+} expected_entry_t;
+
+// ap_catalog_test.csv, sorted by SSID
+static const expected_entry_t expected[] = {
+    {"lobby", "", {0}},
+    {"office", "pw-office", {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01}},
+    {"site-04", "pw-site-04", {0}},
+    {"site-11", "pw-site-11", {0}},
+    {"site-14", "pw-site-14", {0}},
+    {"site-26", "pw-site-26", {0}},
+    {"site-39", "pw-site-39", {0}},
+    {"warehouse", "pw-warehouse", {0}},
+};
+
+#define EXPECTED_COUNT ((int)(sizeof(expected) / sizeof(expected[0])))
+
+static uint8_t* image = NULL;
+static size_t image_size = 0;
+
+static void load_image(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    TEST_ASSERT(f != NULL);
+    TEST_ASSERT(fseek(f, 0, SEEK_END) == 0);
+    long size = ftell(f);
+    TEST_ASSERT(size > 0);
+    rewind(f);
+    image = malloc((size_t)size);
+    TEST_ASSERT(image != NULL);
+    TEST_ASSERT(fread(image, 1, (size_t)size, f) == (size_t)size);
+    fclose(f);
+    image_size = (size_t)size;
+}
+
+static uint32_t bucket_of(const char* ssid)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)ssid, strlen(ssid)) & (CATALOG_BUCKETS - 1);
+}
+
+static void assert_entry(const ap_catalog_entry_t* entry, const expected_entry_t* want)
+{
+    TEST_ASSERT(strcmp(entry->ssid, want->ssid) == 0);
+    TEST_ASSERT(strcmp(entry->password, want->password) == 0);
+    TEST_ASSERT(memcmp(entry->bssid, want->bssid, 6) == 0);
+}
+
+static void test_rejects_bad_images(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_catalog_open());
+
+    // A flipped bit past the header fails the CRC
+    uint8_t* copy = malloc(image_size);
+    TEST_ASSERT(copy != NULL);
+    memcpy(copy, image, image_size);
+    copy[image_size - 2] ^= 0x01;
+    esp_partition_host_set("ap_catalog", copy, image_size);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_CRC, ap_catalog_open());
+
+    // Erased flash is no image at all
+    esp_partition_host_set("ap_catalog", NULL, 0);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_VERSION, ap_catalog_open());
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    TEST_ASSERT(!ap_catalog_is_open() && ap_catalog_get_count() == 0);
+    TEST_ASSERT(esp_partition_host_mapped() == 0);
+    esp_partition_host_set(NULL, NULL, 0);
+    free(copy);
+}
+
+static void test_find_hits_and_misses(void)
+{
+    esp_partition_host_set("ap_catalog", image, image_size);
+    TEST_ASSERT_OK(ap_catalog_open());
+    TEST_ASSERT(ap_catalog_get_count() == EXPECTED_COUNT);
+
+    // The colliding SSIDs the CSV promises, as the reader hashes them
+    TEST_ASSERT(bucket_of("site-11") == CATALOG_BUCKETS - 1);
+    TEST_ASSERT(bucket_of("site-26") == CATALOG_BUCKETS - 1 && bucket_of("site-39") == CATALOG_BUCKETS - 1);
+    TEST_ASSERT(bucket_of("site-14") == 0 && bucket_of("site-04") == 1);
+    TEST_ASSERT(bucket_of("site-47") == CATALOG_BUCKETS - 1);
+
+    for (int i = 0; i < EXPECTED_COUNT; i++) {
+        ap_catalog_entry_t entry;
+        int index = -1;
+        TEST_ASSERT_OK(ap_catalog_get(i, &entry));
+        assert_entry(&entry, &expected[i]);
+        TEST_ASSERT_OK(ap_catalog_find(expected[i].ssid, &entry, &index));
+        TEST_ASSERT(index == i);
+        assert_entry(&entry, &expected[i]);
+    }
+
+    // Misses that probe across the wrapped run, prefixes, and SSIDs no entry can have
+    static const char* const misses[] = {"site-47", "site-58", "site-1", "site-110", "", "lobby ",
+                                         "this-ssid-is-longer-than-32-bytes"};
+    for (size_t i = 0; i < sizeof(misses) / sizeof(misses[0]); i++) {
+        TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_catalog_find(misses[i], NULL, NULL));
+    }
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, ap_catalog_get(EXPECTED_COUNT, &(ap_catalog_entry_t){0}));
+    TEST_ASSERT(esp_partition_host_mapped() == 1);
+}
+
+static void set_scan(wifi_ap_record_t* ap, const char* ssid, int8_t rssi, wifi_auth_mode_t authmode)
+{
+    memset(ap, 0, sizeof(*ap));
+    strcpy((char*)ap->ssid, ssid);
+    ap->rssi = rssi;
+    ap->primary = 6;
+    ap->authmode = authmode;
+}
+
+static void test_match_scan(void)
+{
+    // ap_records_init() opens the catalog, already open here
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+    TEST_ASSERT_OK(ap_records_add("site-26", "pw-stored", NULL));
+
+    wifi_ap_record_t scan[6];
+    set_scan(&scan[0], "site-39", -70, WIFI_AUTH_WPA2_PSK);
+    set_scan(&scan[1], "neighbour", -40, WIFI_AUTH_WPA2_PSK);
+    set_scan(&scan[2], "site-26", -60, WIFI_AUTH_WPA2_PSK);
+    set_scan(&scan[3], "site-47", -50, WIFI_AUTH_WPA2_PSK);
+    set_scan(&scan[4], "lobby", -80, WIFI_AUTH_OPEN);
+    set_scan(&scan[5], "office", -55, WIFI_AUTH_OPEN);
+
+    ap_records_candidate_t candidates[6];
+    int count = 6;
+    TEST_ASSERT_OK(ap_records_match_scan(scan, 6, candidates, &count));
+    TEST_ASSERT(count == 4);
+
+    bool seen[6] = {false};
+    for (int c = 0; c < count; c++) {
+        const ap_records_candidate_t* candidate = &candidates[c];
+        const char* ssid = (const char*)scan[candidate->scan_index].ssid;
+        TEST_ASSERT(c == 0 || candidates[c - 1].score >= candidate->score);
+        seen[candidate->scan_index] = true;
+
+        if (candidate->scan_index == 2) {
+            // The stored record shadows the catalog entry of the same SSID
+            TEST_ASSERT(candidate->record_index == 0);
+            continue;
+        }
+        ap_catalog_entry_t entry;
+        TEST_ASSERT(candidate->record_index == AP_RECORDS_CANDIDATE_CATALOG);
+        TEST_ASSERT_OK(ap_catalog_get(candidate->catalog_index, &entry));
+        TEST_ASSERT(strcmp(entry.ssid, ssid) == 0);
+    }
+    TEST_ASSERT(seen[0] && seen[2] && seen[4] && seen[5]);
+    TEST_ASSERT(!seen[1] && !seen[3]);
+}
+
+static void test_close(void)
+{
+    ap_catalog_close();
+    TEST_ASSERT(!ap_catalog_is_open() && ap_catalog_get_count() == 0);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_STATE, ap_catalog_find("lobby", NULL, NULL));
+    TEST_ASSERT(esp_partition_host_mapped() == 0);
+}
+
+int main(int argc, char** argv)
+{
+    TEST_ASSERT(argc > 1);
+    load_image(argv[1]);
+    TEST_ASSERT_OK(nvs_flash_init());
+
+    RUN_TEST(test_rejects_bad_images);
+    RUN_TEST(test_find_hits_and_misses);
+    RUN_TEST(test_match_scan);
+    RUN_TEST(test_close);
+    free(image);
+    return 0;
+}
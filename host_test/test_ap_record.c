@@ -0,0 +1,431 @@
+/* test_ap_record.c - ap_records on the NVS stand-in */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+static void setup(void)
+{
+    TEST_ASSERT_OK(ap_records_clear_all());
+    TEST_ASSERT_OK(ap_records_save());
+}
+
+static void test_add_find_remove(void)
+{
+    setup();
+    const uint8_t bssid[6] = {1, 2, 3, 4, 5, 6};
+    TEST_ASSERT_OK(ap_records_add("home", "secret", bssid));
+    TEST_ASSERT_OK(ap_records_add("office", "password", NULL));
+    TEST_ASSERT(ap_records_get_count() == 2);
+
+    ap_info_t info;
+    int index;
+    TEST_ASSERT_OK(ap_records_find_by_ssid("home", &info, &index));
+    TEST_ASSERT(strcmp((const char*)info.password, "secret") == 0);
+    TEST_ASSERT_OK(ap_records_find_by_bssid(bssid, &info, &index));
+    TEST_ASSERT(strcmp((const char*)info.ssid, "home") == 0);
+
+    TEST_ASSERT_OK(ap_records_remove_by_ssid("home"));
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_find_by_ssid("home", &info, &index));
+    TEST_ASSERT(ap_records_get_count() == 1);
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+static void test_save_load_roundtrip(void)
+{
+    setup();
+    TEST_ASSERT_OK(ap_records_add("alpha", "pw-alpha", NULL));
+    TEST_ASSERT_OK(ap_records_add("beta", "pw-beta", NULL));
+    TEST_ASSERT_OK(ap_records_increment_use_count("beta"));
+    TEST_ASSERT_OK(ap_records_save());
+
+    // Reloading from flash stands in for a reboot
+    TEST_ASSERT_OK(ap_records_load());
+    TEST_ASSERT(ap_records_get_count() == 2);
+
+    ap_info_t info;
+    int index;
+    TEST_ASSERT_OK(ap_records_find_by_ssid("beta", &info, &index));
+    TEST_ASSERT(strcmp((const char*)info.password, "pw-beta") == 0);
+    TEST_ASSERT(info.use_count == 2);     // Adding counts as the first use
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+// Adding past CONFIG_MAX_AP_COUNT replaces a record instead of failing
+static void test_eviction(void)
+{
+    setup();
+    char ssid[16];
+    for (int i = 0; i < CONFIG_MAX_AP_COUNT + 2; i++) {
+        snprintf(ssid, sizeof(ssid), "ap%d", i);
+        TEST_ASSERT_OK(ap_records_add(ssid, "pw", NULL));
+        TEST_ASSERT(ap_records_get_count() <= CONFIG_MAX_AP_COUNT);
+    }
+
+    ap_info_t info;
+    int index;
+    TEST_ASSERT(ap_records_get_count() == CONFIG_MAX_AP_COUNT);
+    TEST_ASSERT_OK(ap_records_find_by_ssid(ssid, &info, &index));
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+// A save that fails on the storage task is redone by the next one
+static void test_failed_save_is_redone(void)
+{
+    setup();
+    TEST_ASSERT_OK(ap_records_add("gamma", "pw-gamma", NULL));
+
+    nvs_host_inject_power_loss(0, NVS_HOST_FAULT_LOST, 0);
+    esp_log_level_set("*", ESP_LOG_NONE);
+    ap_records_save_async(NULL, NULL);
+    ap_records_flush(UINT32_MAX);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT(nvs_host_powered_off());
+    nvs_host_power_cycle();
+
+    TEST_ASSERT_OK(ap_records_save());
+    TEST_ASSERT_OK(ap_records_load());
+    ap_info_t info;
+    int index;
+    TEST_ASSERT_OK(ap_records_find_by_ssid("gamma", &info, &index));
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+// A connection writes one usage log entry; its statistics ride along when the log is folded in
+static void test_connection_stats_not_written_per_connect(void)
+{
+    setup();
+    TEST_ASSERT_OK(ap_records_add("delta", "pw-delta", NULL));
+    TEST_ASSERT_OK(ap_records_save());
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    TEST_ASSERT_OK(ap_records_increment_use_count("delta"));
+    TEST_ASSERT_OK(ap_records_report_connected("delta", 1200));
+    TEST_ASSERT_OK(ap_records_report_disconnect("delta", 8, false));
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 1);
+
+    TEST_ASSERT_OK(ap_records_save());
+    TEST_ASSERT_OK(ap_records_load());
+    int index;
+    ap_records_stats_t stats;
+    TEST_ASSERT_OK(ap_records_find_by_ssid("delta", NULL, &index));
+    TEST_ASSERT_OK(ap_records_get_stats(index, &stats));
+    TEST_ASSERT(stats.success_count == 1 && stats.avg_connect_ms == 1200 && stats.last_disconnect_reason == 8);
+}
+
+static uint16_t use_count_of(const char* ssid)
+{
+    ap_info_t info;
+    int index;
+    TEST_ASSERT_OK(ap_records_find_by_ssid(ssid, &info, &index));
+    return info.use_count;
+}
+
+// An append writes its own entry and leaves the earlier ones alone; a reload picks up after the last one
+static void test_usage_log_appends(void)
+{
+    setup();
+    TEST_ASSERT_OK(ap_records_add("eps", "pw-eps", NULL));
+    TEST_ASSERT_OK(ap_records_save());
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_OK(ap_records_increment_use_count("eps"));
+    }
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 3 && nvs.erases == 0);
+    TEST_ASSERT(nvs.entries_written == 3 * 3);      // Chunk header, one data entry, blob index
+
+    // Counts age with every use, so compare against what was in RAM
+    uint16_t use_count = use_count_of("eps");
+    TEST_ASSERT(use_count > 1);
+    TEST_ASSERT_OK(ap_records_load());
+    TEST_ASSERT(use_count_of("eps") == use_count);
+
+    // Fill the log past its end, which folds it into the record; one connect at a time, as the queue is short
+    for (int i = 0; i < CONFIG_AP_RECORDS_USAGE_LOG_ENTRIES; i++) {
+        TEST_ASSERT_OK(ap_records_increment_use_count("eps"));
+        TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    }
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    uint8_t entry[16];
+    size_t size = sizeof(entry);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, nvs_host_peek("ap_storage", "ap_use3", entry, &size));
+
+    use_count = use_count_of("eps");
+    TEST_ASSERT_OK(ap_records_load());
+    TEST_ASSERT(use_count_of("eps") == use_count);
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+static bool storage_task_held = false;
+static bool storage_task_released = false;
+
+// Keeps the storage task busy in a save callback until released
+static void hold_storage_task(esp_err_t ret, void* arg)
+{
+    (void)arg;
+    TEST_ASSERT_OK(ret);
+    __atomic_store_n(&storage_task_held, true, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&storage_task_released, __ATOMIC_ACQUIRE)) {
+        vTaskDelay(1);
+    }
+}
+
+// With the storage task, a use is appended by that task; the caller never waits for flash
+static void test_usage_log_queued(void)
+{
+    setup();
+    TEST_ASSERT_OK(ap_records_add("zeta", "pw-zeta", NULL));
+    __atomic_store_n(&storage_task_held, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&storage_task_released, false, __ATOMIC_RELAXED);
+    TEST_ASSERT_OK(ap_records_save_async(hold_storage_task, NULL));
+    while (!__atomic_load_n(&storage_task_held, __ATOMIC_ACQUIRE)) {
+        vTaskDelay(1);
+    }
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    TEST_ASSERT_OK(ap_records_increment_use_count("zeta"));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 0);
+
+    __atomic_store_n(&storage_task_released, true, __ATOMIC_RELEASE);
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 1);
+
+    uint16_t use_count = use_count_of("zeta");
+    TEST_ASSERT_OK(ap_records_load());
+    TEST_ASSERT(use_count_of("zeta") == use_count);
+}
+#endif
+
+// Lookups of uncached records while every cache entry holds unsaved changes read around the cache
+static void test_lookup_never_saves(void)
+{
+    if (CONFIG_MAX_AP_COUNT <= CONFIG_AP_RECORDS_CACHE_SIZE) {
+        return;
+    }
+
+    setup();
+    char ssid[16];
+    char password[16];
+    for (int i = 0; i <= CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        snprintf(ssid, sizeof(ssid), "cached%d", i);
+        TEST_ASSERT_OK(ap_records_add(ssid, "pw-old", NULL));
+    }
+    TEST_ASSERT_OK(ap_records_save());
+    TEST_ASSERT_OK(ap_records_load());
+    for (int i = 0; i < CONFIG_AP_RECORDS_CACHE_SIZE; i++) {
+        snprintf(ssid, sizeof(ssid), "cached%d", i);
+        TEST_ASSERT_OK(ap_records_add(ssid, "pw-new", NULL));
+    }
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    ap_info_t info;
+    int index;
+    snprintf(ssid, sizeof(ssid), "cached%d", CONFIG_AP_RECORDS_CACHE_SIZE);
+    TEST_ASSERT_OK(ap_records_find_by_ssid(ssid, &info, &index));
+    TEST_ASSERT(strcmp((const char*)info.password, "pw-old") == 0);
+    TEST_ASSERT_OK(ap_records_get(index, &info));
+    size_t size = sizeof(password);
+    TEST_ASSERT_OK(ap_records_get_field(index, AP_RECORDS_FIELD_PASSWORD, password, &size));
+    TEST_ASSERT(strcmp(password, "pw-old") == 0);
+    TEST_ASSERT_OK(ap_records_report_connected(ssid, 900));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 0 && nvs.erases == 0 && nvs.commits == 0);
+
+    // A new record needs a cache entry, which saves the pending changes first
+    TEST_ASSERT_OK(ap_records_add("uncached", "pw", NULL));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets > 0);
+    TEST_ASSERT_OK(ap_records_save());
+    TEST_ASSERT_OK(ap_records_load());
+    TEST_ASSERT_OK(ap_records_find_by_ssid("cached0", &info, &index));
+    TEST_ASSERT(strcmp((const char*)info.password, "pw-new") == 0);
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+#define WALK_RECORDS (CONFIG_MAX_AP_COUNT < 6 ? CONFIG_MAX_AP_COUNT : 6)
+
+typedef struct {
+    uint32_t fields;
+    int visited;
+    int stop_after;             // Visitor returns false after this many records
+    bool reenter;               // Visitor calls back into ap_records
+} walk_t;
+
+static void walk_network(int i, char* ssid, char* password, uint8_t* bssid)
+{
+    sprintf(ssid, "walk-%d", i);
+    sprintf(password, "pw-walk-%d", i);
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x02, 0x00, (uint8_t)i};
+    memcpy(bssid, mac, 6);
+}
+
+static bool walk_visitor(const ap_records_view_t* view, void* arg)
+{
+    walk_t* walk = arg;
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+
+    TEST_ASSERT(view->index == walk->visited);
+    walk_network(view->index, ssid, password, bssid);
+    if (walk->reenter) {
+        // Lookups of every other record may not take the cache entries the views point into
+        for (int i = 0; i < ap_records_get_count(); i++) {
+            ap_info_t info;
+            TEST_ASSERT_OK(ap_records_get(i, &info));
+        }
+        esp_log_level_set("*", ESP_LOG_NONE);
+        TEST_ASSERT_ESP(ESP_ERR_INVALID_STATE, ap_records_add("walk-new", "pw", NULL));
+        TEST_ASSERT_ESP(ESP_ERR_INVALID_STATE, ap_records_remove_by_index(view->index));
+        TEST_ASSERT_ESP(ESP_ERR_INVALID_STATE, ap_records_report_connected(ssid, 500));
+        TEST_ASSERT_ESP(ESP_ERR_INVALID_STATE, ap_records_clear_all());
+        esp_log_level_set("*", ESP_LOG_WARN);
+    }
+
+    TEST_ASSERT(memcmp(view->bssid, bssid, 6) == 0);
+    TEST_ASSERT(view->stats != NULL && view->use_count == 1);
+    if (walk->fields & AP_RECORDS_FIELD_SSID) {
+        TEST_ASSERT(view->ssid != NULL && strcmp(view->ssid, ssid) == 0);
+    } else {
+        TEST_ASSERT(view->ssid == NULL);
+    }
+    if (walk->fields & AP_RECORDS_FIELD_PASSWORD) {
+        TEST_ASSERT(view->password != NULL && strcmp(view->password, password) == 0);
+    } else {
+        TEST_ASSERT(view->password == NULL);
+    }
+    return ++walk->visited < walk->stop_after;
+}
+
+static void walk_records(uint32_t fields, int stop_after, bool reenter, int expected)
+{
+    walk_t walk = {.fields = fields, .stop_after = stop_after, .reenter = reenter};
+    TEST_ASSERT_OK(ap_records_for_each(fields, walk_visitor, &walk));
+    TEST_ASSERT(walk.visited == expected);
+}
+
+static void test_for_each(void)
+{
+    setup();
+    for (int i = 0; i < WALK_RECORDS; i++) {
+        char ssid[33];
+        char password[65];
+        uint8_t bssid[6];
+        walk_network(i, ssid, password, bssid);
+        TEST_ASSERT_OK(ap_records_add(ssid, password, bssid));
+    }
+    TEST_ASSERT_OK(ap_records_save());
+    TEST_ASSERT_OK(ap_records_load());
+
+    // Field masks, over records read from NVS and then from the cache
+    walk_records(0, WALK_RECORDS, false, WALK_RECORDS);
+    walk_records(AP_RECORDS_FIELD_SSID | AP_RECORDS_FIELD_BSSID, WALK_RECORDS, false, WALK_RECORDS);
+    walk_records(AP_RECORDS_FIELD_PASSWORD, WALK_RECORDS, false, WALK_RECORDS);
+    for (int i = 0; i < WALK_RECORDS; i++) {
+        ap_info_t info;
+        TEST_ASSERT_OK(ap_records_get(i, &info));
+    }
+    walk_records(AP_RECORDS_FIELD_SSID | AP_RECORDS_FIELD_PASSWORD, WALK_RECORDS, false, WALK_RECORDS);
+
+    // Early exit is not an error
+    walk_records(AP_RECORDS_FIELD_SSID, 2, false, 2);
+    walk_records(0, 1, false, 1);
+
+    // Reading from the visitor works, changing records does not
+    walk_records(AP_RECORDS_FIELD_SSID | AP_RECORDS_FIELD_PASSWORD, WALK_RECORDS, true, WALK_RECORDS);
+    TEST_ASSERT(ap_records_get_count() == WALK_RECORDS);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, ap_records_for_each(0, NULL, NULL));
+    TEST_ASSERT_OK(ap_records_add("after-walk", "pw", NULL));
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+static void test_get_field_sizes(void)
+{
+    setup();
+    const char* long_ssid = "an-ssid-of-the-maximum-32-bytes!";
+    const uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x03, 0x00, 0x01};
+    TEST_ASSERT(strlen(long_ssid) == 32);
+    TEST_ASSERT_OK(ap_records_add(long_ssid, "pw-field", bssid));
+    TEST_ASSERT_OK(ap_records_add("short", "", NULL));
+
+    // Too small: nothing copied, the size needed comes back
+    char out[40];
+    size_t size = 0;
+    memset(out, 'x', sizeof(out));
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, ap_records_get_field(0, AP_RECORDS_FIELD_SSID, out, &size));
+    TEST_ASSERT(size == 33 && out[0] == 'x');
+    size = 32;
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, ap_records_get_field(0, AP_RECORDS_FIELD_SSID, out, &size));
+    TEST_ASSERT(size == 33 && out[0] == 'x');
+
+    // Exactly the size asked for, and a larger buffer reports the bytes stored
+    TEST_ASSERT_OK(ap_records_get_field(0, AP_RECORDS_FIELD_SSID, out, &size));
+    TEST_ASSERT(size == 33 && strcmp(out, long_ssid) == 0);
+    size = sizeof(out);
+    TEST_ASSERT_OK(ap_records_get_field(0, AP_RECORDS_FIELD_PASSWORD, out, &size));
+    TEST_ASSERT(size == 9 && strcmp(out, "pw-field") == 0);
+    size = 1;
+    TEST_ASSERT_OK(ap_records_get_field(1, AP_RECORDS_FIELD_PASSWORD, out, &size));
+    TEST_ASSERT(size == 1 && out[0] == '\0');
+
+    // Fixed size fields
+    uint8_t mac[6];
+    size = 5;
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, ap_records_get_field(0, AP_RECORDS_FIELD_BSSID, mac, &size));
+    TEST_ASSERT(size == 6);
+    TEST_ASSERT_OK(ap_records_get_field(0, AP_RECORDS_FIELD_BSSID, mac, &size));
+    TEST_ASSERT(memcmp(mac, bssid, 6) == 0);
+    uint16_t use_count;
+    size = sizeof(use_count);
+    TEST_ASSERT_OK(ap_records_get_field(0, AP_RECORDS_FIELD_USE_COUNT, &use_count, &size));
+    TEST_ASSERT(use_count == 1 && size == sizeof(use_count));
+    ap_records_stats_t stats;
+    size = sizeof(stats);
+    TEST_ASSERT_OK(ap_records_get_field(1, AP_RECORDS_FIELD_STATS, &stats, &size));
+    TEST_ASSERT(stats.success_count == 0);
+
+    // One field at a time, of an existing record
+    size = sizeof(out);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG,
+                    ap_records_get_field(0, AP_RECORDS_FIELD_SSID | AP_RECORDS_FIELD_BSSID, out, &size));
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, ap_records_get_field(2, AP_RECORDS_FIELD_SSID, out, &size));
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, ap_records_get_field(0, AP_RECORDS_FIELD_SSID, NULL, &size));
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    // Fresh flash: initialized, but nothing to load
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    RUN_TEST(test_add_find_remove);
+    RUN_TEST(test_save_load_roundtrip);
+    RUN_TEST(test_eviction);
+    RUN_TEST(test_failed_save_is_redone);
+    RUN_TEST(test_connection_stats_not_written_per_connect);
+    RUN_TEST(test_usage_log_appends);
+#ifdef CONFIG_AP_RECORDS_ASYNC_SAVE
+    RUN_TEST(test_usage_log_queued);
+#endif
+    RUN_TEST(test_lookup_never_saves);
+    RUN_TEST(test_for_each);
+    RUN_TEST(test_get_field_sizes);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/* test_ap_record_migrate.c - records of the shipped single-blob layout adopted by ap_records_init()
+ *
+ * The firmware before the per-record layout saved the whole ap_record_t,
+ * AP_RECORDS_LEGACY_MAX_COUNT raw ap_info_t of 105 bytes and the record
+ * count, under ap_storage/ap_records. Built once per record count: with fewer
+ * slots than stored records the most used ones are kept.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <string.h>
+
+#define LEGACY_SLOTS 5
+#define LEGACY_STORED 4
+
+// ap_info_t and ap_record_t of the single-blob layout
+typedef struct {
+    uint8_t ssid[33];
+    uint8_t password[65];
+    uint8_t bssid[6];
+    uint8_t use_count;
+} legacy_info_t;
+
+typedef struct {
+    legacy_info_t ap_list[LEGACY_SLOTS];
+    uint8_t available_records;
+} legacy_record_t;
+
+static const uint8_t legacy_use_counts[LEGACY_STORED] = {7, 2, 9, 4};
+
+static void legacy_network(int i, char* ssid, char* password, uint8_t* bssid)
+{
+    sprintf(ssid, "legacy-%d", i);
+    sprintf(password, "pw-legacy-%d", i);
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x01, 0x02, (uint8_t)i};
+    memcpy(bssid, mac, 6);
+}
+
+// Whether record i of the blob is among the CONFIG_MAX_AP_COUNT most used ones
+static bool legacy_kept(int i)
+{
+    int more_used = 0;
+    for (int j = 0; j < LEGACY_STORED; j++) {
+        more_used += legacy_use_counts[j] > legacy_use_counts[i];
+    }
+    return more_used < CONFIG_MAX_AP_COUNT;
+}
+
+static void write_legacy_blob(void)
+{
+    legacy_record_t blob;
+    nvs_handle_t nvs;
+
+    TEST_ASSERT(sizeof(blob) == LEGACY_SLOTS * 105 + 1);
+    memset(&blob, 0, sizeof(blob));
+    for (int i = 0; i < LEGACY_STORED; i++) {
+        legacy_network(i, (char*)blob.ap_list[i].ssid, (char*)blob.ap_list[i].password, blob.ap_list[i].bssid);
+        blob.ap_list[i].use_count = legacy_use_counts[i];
+    }
+    blob.available_records = LEGACY_STORED;
+
+    TEST_ASSERT_OK(nvs_open("ap_storage", NVS_READWRITE, &nvs));
+    TEST_ASSERT_OK(nvs_set_blob(nvs, "ap_records", &blob, sizeof(blob)));
+    TEST_ASSERT_OK(nvs_commit(nvs));
+    nvs_close(nvs);
+}
+
+static void check_records(void)
+{
+    int expected = LEGACY_STORED < CONFIG_MAX_AP_COUNT ? LEGACY_STORED : CONFIG_MAX_AP_COUNT;
+    TEST_ASSERT(ap_records_get_count() == expected);
+
+    for (int i = 0; i < LEGACY_STORED; i++) {
+        char ssid[33];
+        char password[65];
+        uint8_t bssid[6];
+        ap_info_t info;
+        int index;
+
+        legacy_network(i, ssid, password, bssid);
+        esp_err_t ret = ap_records_find_by_ssid(ssid, &info, &index);
+        if (!legacy_kept(i)) {
+            TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ret);
+            continue;
+        }
+        TEST_ASSERT_OK(ret);
+        TEST_ASSERT(strcmp((const char*)info.password, password) == 0);
+        TEST_ASSERT(memcmp(info.bssid, bssid, 6) == 0);
+        TEST_ASSERT(info.use_count == legacy_use_counts[i]);
+    }
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+static void test_init_adopts_legacy_blob(void)
+{
+    write_legacy_blob();
+    TEST_ASSERT_OK(ap_records_init());
+    check_records();
+
+    // The records have keys of their own now, the old blob is gone
+    uint8_t buf[LEGACY_SLOTS * 105 + 1];
+    size_t size = sizeof(buf);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, nvs_host_peek("ap_storage", "ap_records", buf, &size));
+}
+
+static void test_migrated_records_reload(void)
+{
+    TEST_ASSERT_OK(ap_records_load());
+    check_records();
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_ERROR);     // Records that do not fit are dropped with a warning
+    TEST_ASSERT_OK(nvs_flash_init());
+
+    RUN_TEST(test_init_adopts_legacy_blob);
+    RUN_TEST(test_migrated_records_reload);
+    return 0;
+}
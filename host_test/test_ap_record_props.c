@@ -0,0 +1,316 @@
+/* test_ap_record_props.c - randomized workload checked against a model
+ *
+ * Usage: test_ap_record_props [operations] [seed]
+ *
+ * Adds (with eviction once CONFIG_MAX_AP_COUNT records are stored), uses,
+ * lookups by SSID and BSSID, removals by index, sorts and save/load round
+ * trips in random order. After every operation the records are compared with
+ * a model of what was added: no SSID stored twice, the count within bounds,
+ * every record with its latest password and BSSID, lookups finding exactly
+ * what is stored. Records are read back with ap_records_peek(), so checking
+ * leaves the record cache as the workload left it. Prints per operation the
+ * host time and the flash bytes programmed by the NVS stand-in; host times
+ * only rank the operations against each other.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define PROP_NETWORKS (CONFIG_MAX_AP_COUNT * 2 + 2)     // Twice what fits, adds keep evicting
+
+typedef enum {
+    PROP_ADD = 0,
+    PROP_USE,
+    PROP_FIND_SSID,
+    PROP_FIND_BSSID,
+    PROP_REMOVE_INDEX,
+    PROP_SORT,
+    PROP_SAVE,
+    PROP_LOAD,
+    PROP_OP_COUNT,
+} prop_op_t;
+
+static const char* const prop_op_names[] = {
+    "add", "increment_use_count", "find_by_ssid", "find_by_bssid",
+    "remove_by_index", "sort_by_usage", "save", "load",
+};
+
+typedef struct {
+    uint32_t ops;
+    uint64_t ns;
+    uint64_t flash_bytes;
+} prop_cost_t;
+
+// What the records must hold for each network; present is refreshed from the records after every operation
+typedef struct {
+    char password[65];
+    bool has_bssid;
+    bool present;
+} prop_network_t;
+
+static prop_network_t networks[PROP_NETWORKS];
+static prop_cost_t costs[PROP_OP_COUNT];
+static int stored_count = 0;
+
+static void network_ssid(int n, char* ssid)
+{
+    sprintf(ssid, "prop-%03d", n);
+}
+
+static void network_bssid(int n, uint8_t* bssid)
+{
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x77, (uint8_t)(n >> 8), (uint8_t)n};
+    memcpy(bssid, mac, 6);
+}
+
+static int network_of(const uint8_t* ssid)
+{
+    int n;
+    TEST_ASSERT(sscanf((const char*)ssid, "prop-%d", &n) == 1 && n >= 0 && n < PROP_NETWORKS);
+    return n;
+}
+
+// Time one operation and charge it the flash it programmed
+typedef struct {
+    uint64_t start_ns;
+    uint32_t start_entries;
+} prop_mark_t;
+
+static void cost_begin(prop_mark_t* mark)
+{
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    mark->start_entries = nvs.entries_written;
+    mark->start_ns = host_now_ns();
+}
+
+static void cost_end(const prop_mark_t* mark, prop_op_t op)
+{
+    uint64_t elapsed = host_now_ns() - mark->start_ns;
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    costs[op].ops++;
+    costs[op].ns += elapsed;
+    costs[op].flash_bytes += (uint64_t)(nvs.entries_written - mark->start_entries) * NVS_HOST_ENTRY_SIZE;
+}
+
+// Read every record back and hold it against the model
+static void verify(void)
+{
+    bool seen[PROP_NETWORKS] = {0};
+    int count = ap_records_get_count();
+
+    TEST_ASSERT(count >= 0 && count <= CONFIG_MAX_AP_COUNT);
+    for (int i = 0; i < count; i++) {
+        ap_info_t info;
+        uint8_t bssid[6];
+        static const uint8_t no_bssid[6] = {0};
+
+        TEST_ASSERT_OK(ap_records_peek(i, &info));
+        int n = network_of(info.ssid);
+        TEST_ASSERT(!seen[n]);      // No SSID stored twice
+        seen[n] = true;
+        TEST_ASSERT(strcmp((const char*)info.password, networks[n].password) == 0);
+        network_bssid(n, bssid);
+        TEST_ASSERT(memcmp(info.bssid, networks[n].has_bssid ? bssid : no_bssid, 6) == 0);
+    }
+
+    ap_info_t info;
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, ap_records_peek(count, &info));
+    for (int n = 0; n < PROP_NETWORKS; n++) {
+        networks[n].present = seen[n];
+    }
+    stored_count = count;
+    TEST_ASSERT_OK(ap_records_check());
+}
+
+static void prop_add(uint32_t r)
+{
+    int n = (int)((r >> 8) % PROP_NETWORKS);
+    bool with_bssid = (r >> 20) & 1;
+    bool was_present = networks[n].present;
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+    prop_mark_t mark;
+
+    network_ssid(n, ssid);
+    network_bssid(n, bssid);
+    sprintf(password, "pw-%03d-%u", n, (unsigned)((r >> 21) % 4));   // Often unchanged, re-adding is not a change
+
+    cost_begin(&mark);
+    TEST_ASSERT_OK(ap_records_add(ssid, password, with_bssid ? bssid : NULL));
+    cost_end(&mark, PROP_ADD);
+
+    strcpy(networks[n].password, password);
+    networks[n].has_bssid = with_bssid || (was_present && networks[n].has_bssid);
+    int expected = stored_count + (was_present || stored_count == CONFIG_MAX_AP_COUNT ? 0 : 1);
+    verify();
+    TEST_ASSERT(networks[n].present && stored_count == expected);
+}
+
+static void prop_use(uint32_t r)
+{
+    int n = (int)((r >> 8) % PROP_NETWORKS);
+    char ssid[33];
+    prop_mark_t mark;
+
+    network_ssid(n, ssid);
+    cost_begin(&mark);
+    esp_err_t ret = ap_records_increment_use_count(ssid);
+    cost_end(&mark, PROP_USE);
+    TEST_ASSERT_ESP(networks[n].present ? ESP_OK : ESP_ERR_NOT_FOUND, ret);
+}
+
+static void prop_find_ssid(uint32_t r)
+{
+    int n = (int)((r >> 8) % PROP_NETWORKS);
+    char ssid[33];
+    ap_info_t info;
+    int index;
+    prop_mark_t mark;
+
+    network_ssid(n, ssid);
+    cost_begin(&mark);
+    esp_err_t ret = ap_records_find_by_ssid(ssid, &info, &index);
+    cost_end(&mark, PROP_FIND_SSID);
+
+    TEST_ASSERT_ESP(networks[n].present ? ESP_OK : ESP_ERR_NOT_FOUND, ret);
+    if (ret == ESP_OK) {
+        ap_info_t stored;
+        TEST_ASSERT(index >= 0 && index < stored_count);
+        TEST_ASSERT_OK(ap_records_peek(index, &stored));
+        TEST_ASSERT(strcmp((const char*)stored.ssid, ssid) == 0);
+        TEST_ASSERT(strcmp((const char*)info.password, networks[n].password) == 0);
+    }
+}
+
+static void prop_find_bssid(uint32_t r)
+{
+    int n = (int)((r >> 8) % PROP_NETWORKS);
+    uint8_t bssid[6];
+    ap_info_t info;
+    int index;
+    prop_mark_t mark;
+
+    network_bssid(n, bssid);
+    cost_begin(&mark);
+    esp_err_t ret = ap_records_find_by_bssid(bssid, &info, &index);
+    cost_end(&mark, PROP_FIND_BSSID);
+
+    TEST_ASSERT_ESP(networks[n].present && networks[n].has_bssid ? ESP_OK : ESP_ERR_NOT_FOUND, ret);
+    if (ret == ESP_OK) {
+        TEST_ASSERT(network_of(info.ssid) == n && index >= 0 && index < stored_count);
+    }
+}
+
+static void prop_remove_index(uint32_t r)
+{
+    int index = (int)((r >> 8) % (CONFIG_MAX_AP_COUNT + 1));
+    int before = stored_count;
+    prop_mark_t mark;
+
+    cost_begin(&mark);
+    esp_err_t ret = ap_records_remove_by_index(index);
+    cost_end(&mark, PROP_REMOVE_INDEX);
+
+    TEST_ASSERT_ESP(index < before ? ESP_OK : ESP_ERR_INVALID_ARG, ret);
+    verify();
+    TEST_ASSERT(stored_count == (ret == ESP_OK ? before - 1 : before));
+}
+
+static void prop_sort(void)
+{
+    uint8_t indices[CONFIG_MAX_AP_COUNT];
+    int count = CONFIG_MAX_AP_COUNT;
+    prop_mark_t mark;
+
+    cost_begin(&mark);
+    TEST_ASSERT_OK(ap_records_sort_by_usage());
+    cost_end(&mark, PROP_SORT);
+
+    // Sorted, the list order is the rank order
+    TEST_ASSERT_OK(ap_records_get_ranked(indices, &count));
+    TEST_ASSERT(count == stored_count);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT(indices[i] == i);
+    }
+    verify();
+}
+
+// Saving and loading again must give back every record as it was, use counts and order included
+static void prop_round_trip(void)
+{
+    static ap_info_t before[CONFIG_MAX_AP_COUNT];
+    int count = stored_count;
+    prop_mark_t mark;
+
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_OK(ap_records_peek(i, &before[i]));
+    }
+
+    cost_begin(&mark);
+    TEST_ASSERT_OK(ap_records_save());
+    cost_end(&mark, PROP_SAVE);
+    cost_begin(&mark);
+    TEST_ASSERT_OK(ap_records_load());
+    cost_end(&mark, PROP_LOAD);
+
+    TEST_ASSERT(ap_records_get_count() == count);
+    for (int i = 0; i < count; i++) {
+        ap_info_t after;
+        TEST_ASSERT_OK(ap_records_peek(i, &after));
+        TEST_ASSERT(memcmp(&after, &before[i], sizeof(after)) == 0);
+    }
+    verify();
+}
+
+int main(int argc, char** argv)
+{
+    int operations = argc > 1 ? atoi(argv[1]) : 5000;
+    uint32_t seed = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 0x5eed0000u + CONFIG_MAX_AP_COUNT;
+    uint32_t rand_state = seed;
+
+    TEST_ASSERT(operations > 0 && seed != 0);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+    TEST_ASSERT_OK(ap_records_clear_all());
+    TEST_ASSERT_OK(ap_records_save());
+    verify();
+
+    for (int i = 0; i < operations; i++) {
+        uint32_t r = host_rand(&rand_state);
+        uint32_t pick = r % 32;
+        if (pick < 10) {
+            prop_add(r);
+        } else if (pick < 15) {
+            prop_use(r);
+        } else if (pick < 22) {
+            prop_find_ssid(r);
+        } else if (pick < 26) {
+            prop_find_bssid(r);
+        } else if (pick < 28) {
+            prop_remove_index(r);
+        } else if (pick < 29) {
+            prop_sort();
+        } else {
+            prop_round_trip();
+        }
+    }
+
+    printf("CONFIG_MAX_AP_COUNT %d, %d operations, seed 0x%08x, %d records stored at the end\n",
+           CONFIG_MAX_AP_COUNT, operations, (unsigned)seed, stored_count);
+    printf("%-22s %8s %10s %12s\n", "op", "ops", "ns/op", "flash B/op");
+    for (int op = 0; op < PROP_OP_COUNT; op++) {
+        const prop_cost_t* cost = &costs[op];
+        uint32_t ops = cost->ops ? cost->ops : 1;
+        printf("%-22s %8" PRIu32 " %10.0f %12.1f\n", prop_op_names[op], cost->ops,
+               (double)cost->ns / ops, (double)cost->flash_bytes / ops);
+    }
+    return 0;
+}
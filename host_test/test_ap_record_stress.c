@@ -0,0 +1,187 @@
+/* test_ap_record_stress.c - lock-free readers against concurrent writers
+ *
+ * Writer threads add, use, remove, sort, save and reload records while reader
+ * threads copy them with ap_records_peek() and ap_records_get_ranked(). Every
+ * copy must be whole: the password and BSSID of a record are derived from its
+ * SSID, so a copy mixing two records shows. Readers never time out, and save
+ * callbacks read on the storage task while writers hold the lock.
+ */
+#include "ap_record.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+
+#define STRESS_READERS 4
+#define STRESS_WRITERS 2
+#define STRESS_WRITER_OPS 3000
+#define STRESS_NETWORKS (CONFIG_MAX_AP_COUNT * 3)    // More than fit, adds keep evicting
+
+static bool writers_done = false;
+static uint32_t peeks = 0;
+static uint32_t rankings = 0;
+static uint32_t callback_reads = 0;
+
+static void network(int n, char* ssid, char* password, uint8_t* bssid)
+{
+    sprintf(ssid, "stress-%02d", n);
+    sprintf(password, "pw-%s", ssid);
+    const uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x5a, 0x00, (uint8_t)n};
+    memcpy(bssid, mac, 6);
+}
+
+// A copy is whole if its password and BSSID, when set, belong to its SSID
+static void check_copy(const ap_info_t* info)
+{
+    int n;
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+    static const uint8_t no_bssid[6] = {0};
+
+    TEST_ASSERT(sscanf((const char*)info->ssid, "stress-%d", &n) == 1 && n >= 0 && n < STRESS_NETWORKS);
+    network(n, ssid, password, bssid);
+    TEST_ASSERT(strcmp((const char*)info->ssid, ssid) == 0);
+    TEST_ASSERT(strcmp((const char*)info->password, password) == 0);
+    TEST_ASSERT(memcmp(info->bssid, bssid, 6) == 0 || memcmp(info->bssid, no_bssid, 6) == 0);
+}
+
+static void check_ranked(void)
+{
+    uint8_t indices[CONFIG_MAX_AP_COUNT];
+    int count = CONFIG_MAX_AP_COUNT;
+    uint8_t seen[CONFIG_MAX_AP_COUNT] = {0};
+
+    TEST_ASSERT_OK(ap_records_get_ranked(indices, &count));
+    TEST_ASSERT(count >= 0 && count <= CONFIG_MAX_AP_COUNT);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT(indices[i] < count && !seen[indices[i]]);
+        seen[indices[i]] = 1;
+    }
+}
+
+static void read_once(uint32_t* rand_state)
+{
+    ap_info_t info;
+    int index = (int)(host_rand(rand_state) % CONFIG_MAX_AP_COUNT);
+    esp_err_t ret = ap_records_peek(index, &info);
+
+    TEST_ASSERT(ret == ESP_OK || ret == ESP_ERR_INVALID_ARG);
+    if (ret == ESP_OK) {
+        check_copy(&info);
+    }
+    check_ranked();
+}
+
+static void* reader(void* arg)
+{
+    uint32_t rand_state = (uint32_t)(uintptr_t)arg;
+
+    while (!__atomic_load_n(&writers_done, __ATOMIC_RELAXED)) {
+        read_once(&rand_state);
+        __atomic_add_fetch(&peeks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rankings, 1, __ATOMIC_RELAXED);
+        int count = ap_records_get_count();
+        TEST_ASSERT(count >= 0 && count <= CONFIG_MAX_AP_COUNT);
+    }
+    return NULL;
+}
+
+// Runs on the storage task with CONFIG_AP_RECORDS_ASYNC_SAVE, where readers may not take the lock
+static void save_done(esp_err_t ret, void* arg)
+{
+    uint32_t rand_state = (uint32_t)(uintptr_t)arg;
+
+    TEST_ASSERT_OK(ret);
+    read_once(&rand_state);
+    __atomic_add_fetch(&callback_reads, 1, __ATOMIC_RELAXED);
+}
+
+static void* writer(void* arg)
+{
+    uint32_t rand_state = (uint32_t)(uintptr_t)arg;
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+
+    for (int op = 0; op < STRESS_WRITER_OPS; op++) {
+        uint32_t r = host_rand(&rand_state);
+        network((int)((r >> 8) % STRESS_NETWORKS), ssid, password, bssid);
+
+        esp_err_t ret;
+        switch (r % 16) {
+        case 0: case 1: case 2: case 3: case 4:
+            TEST_ASSERT_OK(ap_records_add(ssid, password, (r & 0x100) ? bssid : NULL));
+            break;
+        case 5: case 6: case 7: case 8:
+            ret = ap_records_increment_use_count(ssid);
+            TEST_ASSERT(ret == ESP_OK || ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_TIMEOUT);
+            break;
+        case 9: case 10:
+            ret = ap_records_remove_by_ssid(ssid);
+            TEST_ASSERT(ret == ESP_OK || ret == ESP_ERR_NOT_FOUND);
+            break;
+        case 11:
+            ret = ap_records_remove_by_index(0);
+            TEST_ASSERT(ret == ESP_OK || ret == ESP_ERR_INVALID_ARG);
+            break;
+        case 12:
+            TEST_ASSERT_OK(ap_records_sort_by_usage());
+            break;
+        case 13:
+            ret = ap_records_save_async(save_done, (void*)(uintptr_t)(r | 1));
+            TEST_ASSERT(ret == ESP_OK || ret == ESP_ERR_TIMEOUT);
+            break;
+        case 14:
+            TEST_ASSERT_OK(ap_records_save());
+            break;
+        case 15:
+            // Drops what the other writer has not saved yet
+            TEST_ASSERT_OK(ap_records_load());
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_readers_writers(void)
+{
+    pthread_t readers[STRESS_READERS];
+    pthread_t writers[STRESS_WRITERS];
+
+    TEST_ASSERT_OK(ap_records_clear_all());
+    TEST_ASSERT_OK(ap_records_save());
+    __atomic_store_n(&writers_done, false, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < STRESS_READERS; i++) {
+        TEST_ASSERT(pthread_create(&readers[i], NULL, reader, (void*)(uintptr_t)(0x1234u + i)) == 0);
+    }
+    for (int i = 0; i < STRESS_WRITERS; i++) {
+        TEST_ASSERT(pthread_create(&writers[i], NULL, writer, (void*)(uintptr_t)(0xbeefu + i)) == 0);
+    }
+    for (int i = 0; i < STRESS_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    __atomic_store_n(&writers_done, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < STRESS_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    TEST_ASSERT_OK(ap_records_flush(UINT32_MAX));
+    TEST_ASSERT_OK(ap_records_check());
+    TEST_ASSERT(peeks > 0 && rankings > 0);
+    printf(" (%" PRIu32 " peeks, %" PRIu32 " from save callbacks)", peeks, callback_reads);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);     // Evictions and reloads log at info level
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_ESP(ESP_ERR_NOT_FOUND, ap_records_init());
+
+    RUN_TEST(test_concurrent_readers_writers);
+    return 0;
+}
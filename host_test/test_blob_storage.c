@@ -0,0 +1,723 @@
+/* test_blob_storage.c - blob_storage on the NVS stand-in */
+#include "blob_storage.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs_host.h"
+#include "host_test.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_NAMESPACE "test_ns"
+
+static void setup(void)
+{
+    nvs_host_reset(NVS_HOST_DEFAULT_PAGES);
+    blob_storage_reset_io_stats(NULL);
+}
+
+static void fill_pattern(uint8_t* buf, size_t size, uint8_t seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(seed + i * 7);
+    }
+}
+
+static void test_write_read_roundtrip(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle(&handle, TEST_NAMESPACE, "blob", 256));
+
+    uint8_t data[200];
+    uint8_t out[256];
+    size_t size = sizeof(out);
+    fill_pattern(data, sizeof(data), 1);
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_read(&handle, out, &size));
+    TEST_ASSERT_OK(blob_storage_write(&handle, data, sizeof(data)));
+
+    size = sizeof(out);
+    TEST_ASSERT_OK(blob_storage_read(&handle, out, &size));
+    TEST_ASSERT(size == sizeof(data) && memcmp(out, data, size) == 0);
+
+    // Too small a buffer reports the size needed
+    size = 10;
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, blob_storage_read(&handle, out, &size));
+    TEST_ASSERT(size == sizeof(data));
+
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, blob_storage_write(&handle, out, 257));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void test_exists_delete_and_stats(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 64, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    bool exists = true;
+    size_t used = 1;
+    size_t max = 0;
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, &used));
+    TEST_ASSERT(!exists && used == 0);
+
+    uint8_t data[40] = {1, 2, 3};
+    TEST_ASSERT_OK(blob_storage_write(&handle, data, sizeof(data)));
+    TEST_ASSERT_OK(blob_storage_get_stats(&handle, &used, &max));
+    TEST_ASSERT(used == sizeof(data) && max == 64);
+
+    TEST_ASSERT_OK(blob_storage_delete(&handle));
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_delete(&handle));
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, NULL));
+    TEST_ASSERT(!exists);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+// blob_storage's footprint estimate must match what the stand-in lays out for blobs within one page
+static void test_flash_accounting_matches_stand_in(void)
+{
+    static const size_t sizes[] = {1, 31, 32, 33, 100, 1000, 3968};
+    uint8_t data[3968];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        setup();
+        blob_storage_handle_t handle;
+        TEST_ASSERT_OK(blob_storage_create_handle(&handle, TEST_NAMESPACE, "blob", sizeof(data)));
+
+        // Register the namespace first, it costs an entry of its own
+        fill_pattern(data, sizes[i], 3);
+        TEST_ASSERT_OK(blob_storage_write(&handle, data, sizes[i]));
+        nvs_host_reset_stats();
+        blob_storage_reset_io_stats(&handle);
+
+        fill_pattern(data, sizes[i], 4);
+        TEST_ASSERT_OK(blob_storage_write(&handle, data, sizes[i]));
+
+        blob_storage_io_stats_t io;
+        nvs_host_stats_t nvs;
+        TEST_ASSERT_OK(blob_storage_get_io_stats(&handle, &io));
+        nvs_host_get_stats(&nvs);
+        TEST_ASSERT(nvs.entries_relocated == 0);
+        TEST_ASSERT(io.flash_entries == nvs.entries_written);
+        TEST_ASSERT(io.flash_bytes == (uint64_t)nvs.entries_written * NVS_HOST_ENTRY_SIZE);
+        TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+    }
+}
+
+// Rewrites only mark entries erased; once the pages are used up, garbage collection erases sectors
+static void test_rewrites_trigger_garbage_collection(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 512, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    uint8_t data[500];
+    uint32_t live_first = 0;
+    uint32_t erased;
+    for (int i = 0; i < 200; i++) {
+        fill_pattern(data, sizeof(data), (uint8_t)i);
+        TEST_ASSERT_OK(blob_storage_write(&handle, data, sizeof(data)));
+        uint32_t live;
+        nvs_host_get_usage(&live, &erased);
+        if (i == 0) {
+            live_first = live;
+        }
+        TEST_ASSERT(live == live_first);
+    }
+
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.page_erases > 0);
+
+    size_t size = sizeof(data);
+    uint8_t out[512];
+    TEST_ASSERT_OK(blob_storage_read(&handle, out, &size));
+    TEST_ASSERT(size == sizeof(data) && memcmp(out, data, size) == 0);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+// More live data than the partition holds fails instead of corrupting what is stored
+static void test_partition_full(void)
+{
+    setup();
+    blob_storage_handle_t handles[8];
+    uint8_t data[3968];
+    fill_pattern(data, sizeof(data), 9);
+
+    esp_err_t err = ESP_OK;
+    int written = 0;
+    for (int i = 0; i < 8 && err == ESP_OK; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "big%d", i);
+        TEST_ASSERT_OK(blob_storage_create_handle(&handles[i], TEST_NAMESPACE, key, sizeof(data)));
+        esp_log_level_set("*", ESP_LOG_NONE);
+        err = blob_storage_write(&handles[i], data, sizeof(data));
+        esp_log_level_set("*", ESP_LOG_WARN);
+        written += err == ESP_OK;
+    }
+    TEST_ASSERT(err == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ASSERT(written > 0 && written < NVS_HOST_DEFAULT_PAGES);
+
+    for (int i = 0; i <= written; i++) {
+        uint8_t out[sizeof(data)];
+        size_t size = sizeof(out);
+        if (i < written) {
+            TEST_ASSERT_OK(blob_storage_read(&handles[i], out, &size));
+            TEST_ASSERT(memcmp(out, data, sizeof(data)) == 0);
+        }
+        TEST_ASSERT_OK(blob_storage_close_handle(&handles[i]));
+    }
+}
+
+static void test_cache_and_elide(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 64,
+                                                 BLOB_STORAGE_FLAG_CACHE | BLOB_STORAGE_FLAG_ELIDE_UNCHANGED));
+
+    uint8_t data[32] = {7};
+    bool elided = true;
+    TEST_ASSERT_OK(blob_storage_write_ex(&handle, data, sizeof(data), &elided));
+    TEST_ASSERT(!elided);
+    TEST_ASSERT_OK(blob_storage_write_ex(&handle, data, sizeof(data), &elided));
+    TEST_ASSERT(elided);
+
+    nvs_host_reset_stats();
+    const void* view;
+    size_t size;
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_OK(blob_storage_read_view(&handle, &view, &size));
+    }
+    TEST_ASSERT(size == sizeof(data) && memcmp(view, data, size) == 0);
+
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.gets == 0 && nvs.sets == 0);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void test_deferred_commit(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 64,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_DEFERRED_COMMIT));
+
+    uint8_t data[16];
+    for (int i = 0; i < 10; i++) {
+        fill_pattern(data, sizeof(data), (uint8_t)i);
+        TEST_ASSERT_OK(blob_storage_write(&handle, data, sizeof(data)));
+    }
+
+    size_t size = sizeof(data);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, nvs_host_peek(TEST_NAMESPACE, "blob", data, &size));
+
+    TEST_ASSERT_OK(blob_storage_flush());
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 1 && nvs.commits == 1);
+
+    uint8_t out[16];
+    size = sizeof(out);
+    TEST_ASSERT_OK(nvs_host_peek(TEST_NAMESPACE, "blob", out, &size));
+    TEST_ASSERT(size == sizeof(data) && memcmp(out, data, size) == 0);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+// Without a flush the commit window timer has the flush task commit the staged write
+static void test_deferred_commit_window(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 64,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_DEFERRED_COMMIT));
+
+    uint8_t data[16];
+    uint8_t out[16];
+    size_t size = sizeof(out);
+    fill_pattern(data, sizeof(data), 5);
+    TEST_ASSERT_OK(blob_storage_write(&handle, data, sizeof(data)));
+
+    uint64_t deadline = host_now_ns() + (uint64_t)(CONFIG_BLOB_STORAGE_COMMIT_WINDOW_MS + 2000) * 1000000;
+    while (nvs_host_peek(TEST_NAMESPACE, "blob", out, &size) != ESP_OK) {
+        TEST_ASSERT(host_now_ns() < deadline);
+        usleep(10000);
+        size = sizeof(out);
+    }
+    TEST_ASSERT(size == sizeof(data) && memcmp(out, data, size) == 0);
+
+    // Waits for the flush task to finish its commit, then finds nothing left
+    TEST_ASSERT_OK(blob_storage_flush());
+    nvs_host_stats_t nvs;
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 1 && nvs.commits == 1);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void write_version(blob_storage_handle_t* handle, uint8_t version)
+{
+    uint8_t data[100];
+    fill_pattern(data, sizeof(data), version);
+    TEST_ASSERT_OK(blob_storage_write(handle, data, sizeof(data)));
+}
+
+static void assert_version(blob_storage_handle_t* handle, uint8_t version)
+{
+    uint8_t expected[100];
+    uint8_t out[128];
+    size_t size = sizeof(out);
+    fill_pattern(expected, sizeof(expected), version);
+    TEST_ASSERT_OK(blob_storage_read(handle, out, &size));
+    TEST_ASSERT(size == sizeof(expected) && memcmp(out, expected, size) == 0);
+}
+
+// Reopening the handle stands in for a reboot: it has to find the newest slot in NVS
+static void reopen_ab(blob_storage_handle_t* handle)
+{
+    TEST_ASSERT_OK(blob_storage_close_handle(handle));
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(handle, TEST_NAMESPACE, "blob", 128,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS));
+}
+
+// Power lost in the middle of a write leaves the previous version readable
+static void test_ab_torn_write(void)
+{
+    static const size_t torn_bytes[] = {0, 4, 8, 9, 50, 107};
+
+    for (int fault = NVS_HOST_FAULT_LOST; fault <= NVS_HOST_FAULT_TORN; fault++) {
+        for (size_t i = 0; i < sizeof(torn_bytes) / sizeof(torn_bytes[0]); i++) {
+            setup();
+            blob_storage_handle_t handle;
+            TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 128,
+                                                         BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS));
+            write_version(&handle, 1);
+            write_version(&handle, 2);
+
+            nvs_host_inject_power_loss(0, (nvs_host_fault_t)fault, torn_bytes[i]);
+            uint8_t data[100];
+            fill_pattern(data, sizeof(data), 3);
+            esp_log_level_set("*", ESP_LOG_NONE);
+            TEST_ASSERT(blob_storage_write(&handle, data, sizeof(data)) != ESP_OK);
+            esp_log_level_set("*", ESP_LOG_WARN);
+            TEST_ASSERT(nvs_host_powered_off());
+            nvs_host_power_cycle();
+
+            reopen_ab(&handle);
+            esp_log_level_set("*", ESP_LOG_NONE);
+            assert_version(&handle, 2);
+            esp_log_level_set("*", ESP_LOG_WARN);
+
+            // The next write replaces the damaged slot, not the good one
+            write_version(&handle, 4);
+            assert_version(&handle, 4);
+            reopen_ab(&handle);
+            assert_version(&handle, 4);
+            TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+        }
+    }
+}
+
+// A slot that went bad after it was written is caught by its CRC, on an open handle too
+static void test_ab_corrupt_slot(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 128,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS));
+    write_version(&handle, 1);
+    write_version(&handle, 2);      // Second write goes to slot b
+
+    TEST_ASSERT_OK(nvs_host_corrupt(TEST_NAMESPACE, "blob.b", 20));
+    esp_log_level_set("*", ESP_LOG_NONE);
+    assert_version(&handle, 1);
+    reopen_ab(&handle);
+    assert_version(&handle, 1);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+// A write that cannot tell which slot is newest fails instead of reusing sequence number 1
+static void test_ab_unreadable_slots(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 128,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS));
+    write_version(&handle, 1);
+    write_version(&handle, 2);
+    reopen_ab(&handle);
+
+    uint8_t data[100];
+    nvs_host_stats_t nvs;
+    fill_pattern(data, sizeof(data), 3);
+    nvs_host_reset_stats();
+    nvs_host_fail_reads(2, ESP_FAIL);
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_FAIL, blob_storage_write(&handle, data, sizeof(data)));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 0);
+
+    // The next write scans again and supersedes version 2
+    write_version(&handle, 3);
+    reopen_ab(&handle);
+    assert_version(&handle, 3);
+
+    // Only the size is needed to answer exists
+    bool exists;
+    size_t size;
+    reopen_ab(&handle);
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, &size));
+    TEST_ASSERT(exists && size == 100);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+// Once the handle knows the newest slot, a read is one NVS lookup into the caller's buffer
+static void test_ab_reads_cached_slot(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 128,
+                                                 BLOB_STORAGE_FLAG_PERSISTENT | BLOB_STORAGE_FLAG_AB_SLOTS));
+    write_version(&handle, 1);
+    write_version(&handle, 2);
+    reopen_ab(&handle);
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    assert_version(&handle, 2);
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.gets == 2);
+
+    nvs_host_reset_stats();
+    assert_version(&handle, 2);
+    write_version(&handle, 3);
+    assert_version(&handle, 3);
+    bool exists;
+    size_t size;
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, &size));
+    TEST_ASSERT(exists && size == 100);
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.gets == 3 && nvs.sets == 1);
+
+    // A buffer that fits the payload but not the slot header still works
+    uint8_t out[104];
+    size = sizeof(out);
+    TEST_ASSERT_OK(blob_storage_read(&handle, out, &size));
+    TEST_ASSERT(size == 100);
+
+    size = 99;
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, blob_storage_read(&handle, out, &size));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT(size == 100);
+
+    TEST_ASSERT_OK(blob_storage_delete(&handle));
+    nvs_host_reset_stats();
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, NULL));
+    TEST_ASSERT(!exists);
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.gets == 0);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void assert_pack_entry(blob_storage_pack_t* pack, const char* name, const uint8_t* data, size_t size)
+{
+    uint8_t out[128];
+    size_t out_size = sizeof(out);
+    TEST_ASSERT_OK(blob_storage_pack_get(pack, name, out, &out_size));
+    TEST_ASSERT(out_size == size && memcmp(out, data, size) == 0);
+}
+
+// Logical blobs of a pack: set, overwrite, resize and remove, every change one NVS write, all there after a reopen
+static void test_pack_set_get_remove(void)
+{
+    setup();
+    blob_storage_pack_t pack;
+    TEST_ASSERT_OK(blob_storage_pack_open(&pack, TEST_NAMESPACE, "pack", 256, 8, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    uint8_t a[10];
+    uint8_t b[20];
+    uint8_t c[5];
+    uint8_t out[64];
+    size_t size = sizeof(out);
+    fill_pattern(a, sizeof(a), 1);
+    fill_pattern(b, sizeof(b), 2);
+    fill_pattern(c, sizeof(c), 3);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_pack_get(&pack, "a", out, &size));
+
+    nvs_host_stats_t nvs;
+    nvs_host_reset_stats();
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "a", a, sizeof(a)));
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "b", b, sizeof(b)));
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "c", c, sizeof(c)));
+    nvs_host_get_stats(&nvs);
+    TEST_ASSERT(nvs.sets == 3);
+    assert_pack_entry(&pack, "a", a, sizeof(a));
+    assert_pack_entry(&pack, "b", b, sizeof(b));
+    assert_pack_entry(&pack, "c", c, sizeof(c));
+
+    // Too small a buffer reports the size needed
+    size = 4;
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_SIZE, blob_storage_pack_get(&pack, "b", out, &size));
+    TEST_ASSERT(size == sizeof(b));
+
+    // Same size in place, then a new size, which moves the entry behind the others
+    fill_pattern(a, sizeof(a), 4);
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "a", a, sizeof(a)));
+    assert_pack_entry(&pack, "a", a, sizeof(a));
+    fill_pattern(b, sizeof(b), 5);
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "b", b, 12));
+    assert_pack_entry(&pack, "b", b, 12);
+    assert_pack_entry(&pack, "c", c, sizeof(c));
+
+    TEST_ASSERT_OK(blob_storage_pack_remove(&pack, "c"));
+    size = sizeof(out);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_pack_get(&pack, "c", out, &size));
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_pack_remove(&pack, "c"));
+    TEST_ASSERT(pack.count == 2);
+    TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+
+    TEST_ASSERT_OK(blob_storage_pack_open(&pack, TEST_NAMESPACE, "pack", 256, 8, BLOB_STORAGE_FLAG_PERSISTENT));
+    TEST_ASSERT(pack.count == 2);
+    assert_pack_entry(&pack, "a", a, sizeof(a));
+    assert_pack_entry(&pack, "b", b, 12);
+    size = sizeof(out);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_pack_get(&pack, "c", out, &size));
+    TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+
+    // An image that fails validation opens as an empty pack
+    TEST_ASSERT_OK(nvs_host_corrupt(TEST_NAMESPACE, "pack", 0));
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_OK(blob_storage_pack_open(&pack, TEST_NAMESPACE, "pack", 256, 8, BLOB_STORAGE_FLAG_PERSISTENT));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT(pack.count == 0);
+    TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+}
+
+// A full directory or image refuses new entries and leaves the stored ones alone
+static void test_pack_overflow(void)
+{
+    setup();
+    blob_storage_pack_t pack;
+    TEST_ASSERT_OK(blob_storage_pack_open(&pack, TEST_NAMESPACE, "pack", 64, 3, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    uint8_t data[64];
+    char name[16];
+    fill_pattern(data, sizeof(data), 6);
+    for (int i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), "entry%d", i);
+        TEST_ASSERT_OK(blob_storage_pack_set(&pack, name, data, 4));
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_ERR_NO_MEM, blob_storage_pack_set(&pack, "entry3", data, 4));
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "entry1", data, 8));        // Replacing one still fits
+    TEST_ASSERT_OK(blob_storage_pack_remove(&pack, "entry2"));
+
+    // Header 4 bytes, entry0 13 and entry1 17 leave 30: a new entry "big" takes 3 + 3 of them, entry0 may grow by 30
+    TEST_ASSERT_ESP(ESP_ERR_NO_MEM, blob_storage_pack_set(&pack, "big", data, 30 - 3 - 3 + 1));
+    TEST_ASSERT_ESP(ESP_ERR_NO_MEM, blob_storage_pack_set(&pack, "entry0", data, 4 + 30 + 1));
+    assert_pack_entry(&pack, "entry0", data, 4);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, blob_storage_pack_set(&pack, "name-longer-than-15", data, 4));
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_ARG, blob_storage_pack_set(&pack, "", data, 4));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT_OK(blob_storage_pack_set(&pack, "big", data, 30 - 3 - 3));
+    assert_pack_entry(&pack, "entry0", data, 4);
+    assert_pack_entry(&pack, "entry1", data, 8);
+    assert_pack_entry(&pack, "big", data, 24);
+    TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+
+    TEST_ASSERT_OK(blob_storage_pack_open(&pack, TEST_NAMESPACE, "pack", 64, 3, BLOB_STORAGE_FLAG_PERSISTENT));
+    TEST_ASSERT(pack.count == 3 && pack.image_size == 64);
+    assert_pack_entry(&pack, "big", data, 24);
+    TEST_ASSERT_OK(blob_storage_pack_close(&pack));
+}
+
+#define POOL_TEST_THREADS 4
+#define POOL_TEST_ROUNDS 2000
+
+static void* pool_worker(void* arg)
+{
+    uint8_t value = (uint8_t)(uintptr_t)arg;
+    char key[16];
+    snprintf(key, sizeof(key), "pool%u", value);
+
+    for (int i = 0; i < POOL_TEST_ROUNDS; i++) {
+        blob_storage_handle_t handle;
+        TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, key, 4, BLOB_STORAGE_FLAG_PERSISTENT));
+        TEST_ASSERT_OK(blob_storage_write(&handle, &value, 1));
+        TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+    }
+    return NULL;
+}
+
+// Handles on one namespace share a pooled NVS handle; opening and closing them concurrently must not leak or drop it
+static void test_pool_concurrent_open_close(void)
+{
+    setup();
+    int open_before = nvs_host_open_handles();
+    pthread_t threads[POOL_TEST_THREADS];
+
+    for (uintptr_t i = 0; i < POOL_TEST_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, pool_worker, (void*)i) == 0);
+    }
+    for (int i = 0; i < POOL_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_ASSERT(nvs_host_open_handles() == open_before);
+}
+
+static void write_stream(blob_storage_handle_t* handle, const uint8_t* data, size_t size, size_t piece)
+{
+    blob_storage_stream_t stream;
+    TEST_ASSERT_OK(blob_storage_stream_write_begin(&stream, handle, 16));
+    for (size_t done = 0; done < size; done += piece) {
+        TEST_ASSERT_OK(blob_storage_stream_write(&stream, &data[done], (size - done < piece) ? size - done : piece));
+    }
+    TEST_ASSERT_OK(blob_storage_stream_write_end(&stream));
+}
+
+// Read a whole stream in pieces; the result of the last read is returned
+static esp_err_t read_stream(blob_storage_handle_t* handle, uint8_t* out, size_t* size)
+{
+    blob_storage_stream_t stream;
+    size_t total;
+    size_t done = 0;
+    size_t read;
+    esp_err_t err;
+
+    TEST_ASSERT_OK(blob_storage_stream_read_begin(&stream, handle, &total));
+    do {
+        err = blob_storage_stream_read(&stream, &out[done], 10, &read);
+        done += read;
+    } while (err == ESP_OK && read > 0);
+    TEST_ASSERT_OK(blob_storage_stream_close(&stream));
+    TEST_ASSERT(done == total);
+    *size = done;
+    return err;
+}
+
+static bool chunk_stored(const char* key)
+{
+    uint8_t buf[16];
+    size_t size = sizeof(buf);
+    return nvs_host_peek(TEST_NAMESPACE, key, buf, &size) == ESP_OK;
+}
+
+static void test_stream_roundtrip_and_shrink(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 16, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    // Larger than max_size, written in pieces that straddle the 16 byte chunks
+    uint8_t data[100];
+    uint8_t out[110];
+    size_t size;
+    fill_pattern(data, sizeof(data), 11);
+    write_stream(&handle, data, sizeof(data), 13);
+    TEST_ASSERT_OK(read_stream(&handle, out, &size));
+    TEST_ASSERT(size == sizeof(data) && memcmp(out, data, size) == 0);
+    TEST_ASSERT(chunk_stored("blob.06") && !chunk_stored("blob.07"));
+
+    // A shorter stream erases the chunks it no longer uses
+    fill_pattern(data, 40, 12);
+    write_stream(&handle, data, 40, 40);
+    TEST_ASSERT(chunk_stored("blob.02"));
+    for (int index = 3; index <= 6; index++) {
+        char key[16];
+        snprintf(key, sizeof(key), "blob.%02x", index);
+        TEST_ASSERT(!chunk_stored(key));
+    }
+    TEST_ASSERT_OK(read_stream(&handle, out, &size));
+    TEST_ASSERT(size == 40 && memcmp(out, data, size) == 0);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void test_stream_corrupt_chunk(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 16, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    uint8_t data[100];
+    uint8_t out[110];
+    size_t size;
+    fill_pattern(data, sizeof(data), 13);
+    write_stream(&handle, data, sizeof(data), sizeof(data));
+    TEST_ASSERT_OK(nvs_host_corrupt(TEST_NAMESPACE, "blob.01", 3));
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_ESP(ESP_ERR_INVALID_CRC, read_stream(&handle, out, &size));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT(size == sizeof(data));
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+static void test_stream_delete(void)
+{
+    setup();
+    blob_storage_handle_t handle;
+    TEST_ASSERT_OK(blob_storage_create_handle_ex(&handle, TEST_NAMESPACE, "blob", 16, BLOB_STORAGE_FLAG_PERSISTENT));
+
+    uint8_t data[100];
+    uint32_t live_entries;
+    uint32_t erased_entries;
+    fill_pattern(data, sizeof(data), 14);
+    write_stream(&handle, data, sizeof(data), sizeof(data));
+    TEST_ASSERT_OK(blob_storage_stream_delete(&handle));
+    nvs_host_get_usage(&live_entries, &erased_entries);
+    TEST_ASSERT(live_entries == 0);
+    TEST_ASSERT_ESP(ESP_ERR_NVS_NOT_FOUND, blob_storage_stream_delete(&handle));
+
+    // Chunks an abandoned longer write left past the listed ones go too
+    write_stream(&handle, data, 32, 32);
+    blob_storage_stream_t stream;
+    TEST_ASSERT_OK(blob_storage_stream_write_begin(&stream, &handle, 16));
+    TEST_ASSERT_OK(blob_storage_stream_write(&stream, data, 80));
+    esp_log_level_set("*", ESP_LOG_NONE);
+    TEST_ASSERT_OK(blob_storage_stream_close(&stream));
+    esp_log_level_set("*", ESP_LOG_WARN);
+    TEST_ASSERT(chunk_stored("blob.04"));
+    TEST_ASSERT_OK(blob_storage_stream_delete(&handle));
+    nvs_host_get_usage(&live_entries, &erased_entries);
+    TEST_ASSERT(live_entries == 0);
+
+    // A plain blob under the key is erased as well
+    TEST_ASSERT_OK(blob_storage_write(&handle, data, 16));
+    TEST_ASSERT_OK(blob_storage_stream_delete(&handle));
+    bool exists;
+    TEST_ASSERT_OK(blob_storage_exists(&handle, &exists, NULL));
+    TEST_ASSERT(!exists);
+    TEST_ASSERT_OK(blob_storage_close_handle(&handle));
+}
+
+int main(void)
+{
+    TEST_ASSERT_OK(nvs_flash_init());
+    TEST_ASSERT_OK(blob_storage_init());
+
+    RUN_TEST(test_write_read_roundtrip);
+    RUN_TEST(test_exists_delete_and_stats);
+    RUN_TEST(test_flash_accounting_matches_stand_in);
+    RUN_TEST(test_rewrites_trigger_garbage_collection);
+    RUN_TEST(test_partition_full);
+    RUN_TEST(test_cache_and_elide);
+    RUN_TEST(test_deferred_commit);
+    RUN_TEST(test_deferred_commit_window);
+    RUN_TEST(test_pool_concurrent_open_close);
+    RUN_TEST(test_ab_torn_write);
+    RUN_TEST(test_ab_corrupt_slot);
+    RUN_TEST(test_ab_unreadable_slots);
+    RUN_TEST(test_ab_reads_cached_slot);
+    RUN_TEST(test_pack_set_get_remove);
+    RUN_TEST(test_pack_overflow);
+    RUN_TEST(test_stream_roundtrip_and_shrink);
+    RUN_TEST(test_stream_corrupt_chunk);
+    RUN_TEST(test_stream_delete);
+    return 0;
+}
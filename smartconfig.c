@@ -21,7 +21,11 @@
 #include "esp_netif.h"
 #include "esp_smartconfig.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
 #include  "ap_record.h"
+#ifdef CONFIG_AP_RECORDS_CATALOG
+#include  "ap_catalog.h"
+#endif
 #include  "smartconfig.h"
 
 #define     MAX_SCANNED_AP                  6
@@ -78,6 +82,8 @@ static struct {
     wifi_connect_success_callback callback;
     bool attemp_reconnect;
     wifi_protocol_state_t state;
+    uint8_t disconnect_reason;              //wifi_err_reason_t of the last disconnect event
+    uint8_t connected_ssid[33];             //Stored AP we are connected to, empty if connected through smartconfig
     
 
 }wifi_state={0};
@@ -109,7 +115,7 @@ static esp_err_t scan_live_wifi_access_points(wifi_ap_record_t* ap_records,uint1
 
 static esp_err_t wifi_connect_to_ap(uint8_t* ssid,uint8_t*password,uint8_t* bssid){
 
-
+    (void)bssid;    //Only the disabled CONFIG_SET_MAC_ADDRESS_OF_TARGET_AP block below would use it
     wifi_config_t wifi_config;
     bzero(&wifi_config, sizeof(wifi_config_t));
     memcpy(wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
@@ -146,17 +152,27 @@ static esp_err_t wifi_connect_to_ap(uint8_t* ssid,uint8_t*password,uint8_t* bssi
 
 
 
-static esp_err_t stored_ssid_connection_attempt(wifi_ap_record_t* ap_scanned){
+static esp_err_t stored_ssid_connection_attempt(wifi_ap_record_t* ap_scanned,const ap_records_candidate_t* candidate){
 
 
-    //This is not correct. The loop should actually run equal to total number of records which can be less  thaan max
-    ap_info_t ap_record={0};          //Record from the storafe
-    int index=0;
-    
+#ifdef CONFIG_AP_RECORDS_CATALOG
+    if(candidate->record_index==AP_RECORDS_CANDIDATE_CATALOG){
+        uint8_t password[65]={0};
+        ap_catalog_entry_t entry;
+        if(ap_catalog_get(candidate->catalog_index,&entry)!=ESP_OK){
+            return ERR_WIFI_SSID_NOT_FOUND;
+        }
+        //Copied out of flash, wifi_connect_to_ap() reads the full password field
+        strncpy((char*)password,entry.password,sizeof(password)-1);
+        return wifi_connect_to_ap(ap_scanned->ssid,password,ap_scanned->bssid);
+    }
+#endif
         
-    if(ap_records_find_by_ssid((const char*)ap_scanned->ssid, &ap_record, &index)==ESP_OK){
+    //Looked up again by SSID: candidate->record_index is a list position, which shifts if a record was removed since the scan was matched
+    ap_info_t ap_info;
+    if(ap_records_find_by_ssid((const char*)ap_scanned->ssid,&ap_info,NULL)==ESP_OK){
         //Use the live AP SSID, password from the record and live ap bssid
-        return wifi_connect_to_ap(ap_scanned->ssid,ap_record.password,ap_scanned->bssid);
+        return wifi_connect_to_ap(ap_scanned->ssid,ap_info.password,ap_scanned->bssid);
     }
     
 
@@ -164,18 +180,18 @@ static esp_err_t stored_ssid_connection_attempt(wifi_ap_record_t* ap_scanned){
 }
 
 
-static esp_err_t stored_ssid_delete_record(wifi_ap_record_t* ap_scanned){
-
-    return ap_records_remove_by_ssid((const char*)ap_scanned->ssid);
+static void ssid_record_saved(esp_err_t result,void* arg){
 
+    (void)arg;
+    if(result!=ESP_OK)
+        ESP_LOGW(TAG,"Failed to save AP record: %s",esp_err_to_name(result));
 }
 
-
 static esp_err_t add_success_ssid_record(const char* ssid,const char* password){
 
     esp_err_t ret=0;
     if(ap_records_add(ssid,password,NULL)==ESP_OK)
-        ret=ap_records_save();              //save to non volatile
+        ret=ap_records_save_async(ssid_record_saved,NULL);  //save to non volatile without blocking the wifi task
 
     return ret;
 
@@ -188,6 +204,7 @@ static esp_err_t add_success_ssid_record(const char* ssid,const char* password){
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data){
 
+    (void)arg;
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
 
         //First check if can be connected to any available AP because it is in record
@@ -203,6 +220,8 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         
      else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
 
+        wifi_event_sta_disconnected_t* disconnected=(wifi_event_sta_disconnected_t*)event_data;
+        wifi_state.disconnect_reason=disconnected->reason;
 
         xEventGroupSetBits(wifi_state.wifi_event_group,WIFI_EVENT_DISCONNECTED_BIT);
                 
@@ -353,6 +372,8 @@ static esp_err_t wifi_stored_ap_record_connect(){
     esp_err_t ret=0;
     wifi_ap_record_t ap_scan_results[MAX_SCANNED_AP];          //Live scan records
     uint16_t ap_count=MAX_SCANNED_AP;
+    ap_records_candidate_t candidates[MAX_SCANNED_AP];         //Scan results with a stored record, best first
+    int candidate_count=MAX_SCANNED_AP;
     bool ssid_found=false;
     //uint8_t reconnect_attempts=WIFI_RECONNECT_ATTEMPTS;
     EventBits_t uxBits;
@@ -363,12 +384,19 @@ static esp_err_t wifi_stored_ap_record_connect(){
     }
     
     
-    for(uint8_t i=0;i<ap_count;i++){
+    //One pass over the scan results; the stored record of each candidate is known, no lookups per attempt
+    if(ap_records_match_scan(ap_scan_results,ap_count,candidates,&candidate_count)!=ESP_OK){
+        candidate_count=0;
+    }
+
+    for(int i=0;i<candidate_count;i++){
+        wifi_ap_record_t* ap_scanned=&ap_scan_results[candidates[i].scan_index];
         
         for(uint8_t j=0;j<WIFI_RECONNECT_ATTEMPTS;j++){
-            ret=stored_ssid_connection_attempt(&ap_scan_results[i]);
+            int64_t connect_start_us=esp_timer_get_time();
+            ret=stored_ssid_connection_attempt(ap_scanned,&candidates[i]);
             
-            //If not found then break from this loop, and try next ssid
+            //If the record is gone meanwhile, try the next candidate
             if(ret==ERR_WIFI_SSID_NOT_FOUND){
                 break;
             }
@@ -388,11 +416,18 @@ static esp_err_t wifi_stored_ap_record_connect(){
                             pdTRUE,pdFALSE,portMAX_DELAY);
 
             if(uxBits&WIFI_EVENT_CONNECTED_BIT){
+                //Catalog entries have no record, so these only count for stored records
+                ap_records_increment_use_count((const char*)ap_scanned->ssid);   //One usage log entry, the record is rewritten when the log is folded in
+                ap_records_report_connected((const char*)ap_scanned->ssid,(uint32_t)((esp_timer_get_time()-connect_start_us)/1000));  //RAM only, saved with that rewrite
+                memcpy(wifi_state.connected_ssid,ap_scanned->ssid,sizeof(wifi_state.connected_ssid));
                 return ESP_OK;
             }
+
+            //Disconnected before getting an IP, ranks this AP lower next time
+            ap_records_report_disconnect((const char*)ap_scanned->ssid,wifi_state.disconnect_reason,true);
         }
             //If it doesn exit , it means that record has wrong password , so remove that record
-            //stored_ssid_delete_record(&ap_scan_results[i]);
+            //stored_ssid_delete_record(ap_scanned);
 
     }
 
@@ -459,6 +494,7 @@ static esp_err_t wifi_smartconfig_connect(){
 
 static void wifi_task(void* args){
 
+    (void)args;
     EventBits_t uxBits;
     esp_err_t ret=0;
     wifi_protocol_state_t next_state=0;
@@ -502,6 +538,7 @@ static void wifi_task(void* args){
                     
                     
                 case WIFI_STATE_ATTEMPT_SMARTCONFIG:
+                    wifi_state.connected_ssid[0]='\0';
                     ret=wifi_smartconfig_connect();
                             if(ret==ESP_OK){
                                     next_state=WIFI_STATE_CONNECTED;
@@ -512,6 +549,8 @@ static void wifi_task(void* args){
                 case WIFI_STATE_CONNECTED:
                     uxBits=xEventGroupWaitBits(wifi_state.wifi_event_group,WIFI_EVENT_DISCONNECTED_BIT,pdTRUE,pdTRUE,portMAX_DELAY);
                     if (uxBits & WIFI_EVENT_DISCONNECTED_BIT) {
+                        if(wifi_state.connected_ssid[0]!='\0')
+                            ap_records_report_disconnect((const char*)wifi_state.connected_ssid,wifi_state.disconnect_reason,false);
                         if(wifi_state.attemp_reconnect==true)
                             next_state=WIFI_STATE_INIT;
                     }
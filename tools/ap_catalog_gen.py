@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Build an AP credential catalog image for CONFIG_AP_RECORDS_CATALOG.
+
+Input is a CSV file with one AP per line: ssid,password[,bssid]. The password
+may be empty for open networks, the BSSID is written as aa:bb:cc:dd:ee:ff.
+Lines starting with # are ignored.
+
+Flash the image to the catalog partition, for example with a partition table
+line like
+
+    ap_catalog, data, 0x40, , 64K
+
+and
+
+    parttool.py write_partition --partition-name ap_catalog --input catalog.bin
+
+The layout must match ap_catalog.c.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import zlib
+
+MAGIC = 0x54435041          # "APCT"
+VERSION = 1
+HEADER = struct.Struct('<IHHHHIIII')
+RECORD = struct.Struct('<IIBB6s')
+SSID_MAX_LEN = 32
+PASSWORD_MAX_LEN = 64
+MAX_ENTRIES = 32767         # Bucket count must stay below 65536
+
+
+def parse_bssid(text, line):
+    if not text:
+        return bytes(6)
+    parts = text.split(':')
+    if len(parts) != 6:
+        raise ValueError('line {}: invalid BSSID {!r}'.format(line, text))
+    return bytes(int(part, 16) for part in parts)
+
+
+def read_entries(path):
+    entries = {}
+    with open(path, newline='', encoding='utf-8') as f:
+        for line, row in enumerate(csv.reader(f), 1):
+            if not row or row[0].startswith('#'):
+                continue
+            if len(row) < 2 or len(row) > 3:
+                raise ValueError('line {}: expected ssid,password[,bssid]'.format(line))
+            ssid = row[0].encode('utf-8')
+            password = row[1].encode('utf-8')
+            bssid = parse_bssid(row[2].strip() if len(row) > 2 else '', line)
+            if not 0 < len(ssid) <= SSID_MAX_LEN:
+                raise ValueError('line {}: SSID must be 1 to {} bytes'.format(line, SSID_MAX_LEN))
+            if len(password) > PASSWORD_MAX_LEN:
+                raise ValueError('line {}: password longer than {} bytes'.format(line, PASSWORD_MAX_LEN))
+            if ssid in entries:
+                raise ValueError('line {}: duplicate SSID {!r}'.format(line, row[0]))
+            entries[ssid] = (password, bssid)
+    if len(entries) > MAX_ENTRIES:
+        raise ValueError('at most {} entries are supported'.format(MAX_ENTRIES))
+    return sorted(entries.items())
+
+
+def build_image(entries):
+    # Open addressing over the SSID CRC32, at most half full
+    bucket_count = 2
+    while bucket_count < 2 * len(entries):
+        bucket_count *= 2
+    buckets = [0] * bucket_count
+    records = b''
+    strings = b''
+    for index, (ssid, (password, bssid)) in enumerate(entries):
+        ssid_hash = zlib.crc32(ssid)
+        bucket = ssid_hash & (bucket_count - 1)
+        while buckets[bucket]:
+            bucket = (bucket + 1) & (bucket_count - 1)
+        buckets[bucket] = index + 1
+        records += RECORD.pack(ssid_hash, len(strings), len(ssid), len(password), bssid)
+        strings += ssid + b'\0' + password + b'\0'
+
+    table = struct.pack('<{}H'.format(bucket_count), *buckets)
+    entries_offset = HEADER.size + len(table)
+    padding = (-entries_offset) % 4
+    entries_offset += padding
+    strings_offset = entries_offset + len(records)
+    body = table + bytes(padding) + records + strings
+    image_size = HEADER.size + len(body)
+    header = HEADER.pack(MAGIC, VERSION, len(entries), bucket_count, 0,
+                         entries_offset, strings_offset, image_size, zlib.crc32(body))
+    return header + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', help='CSV file with ssid,password[,bssid] lines')
+    parser.add_argument('output', help='Image file to write')
+    parser.add_argument('--partition-size', type=lambda s: int(s, 0),
+                        help='Fail if the image does not fit a partition of this size')
+    args = parser.parse_args()
+
+    try:
+        entries = read_entries(args.input)
+    except (OSError, ValueError) as e:
+        sys.exit('error: {}'.format(e))
+    image = build_image(entries)
+    if args.partition_size is not None and len(image) > args.partition_size:
+        sys.exit('error: image is {} bytes, partition only {}'.format(len(image), args.partition_size))
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('Wrote {} entries, {} bytes to {}'.format(len(entries), len(image), args.output))
+
+
+if __name__ == '__main__':
+    main()